@@ -0,0 +1,42 @@
+#include "alignedbuffer.h"
+#include <cstdlib>
+
+#ifdef Q_OS_WIN
+#  include <malloc.h>
+#endif
+
+AlignedBuffer::AlignedBuffer(qint64 size, quint32 align) {
+    // Выравнивание должно быть степенью двойки и не меньше sizeof(void*)
+    if (align < sizeof(void*) || (align & (align - 1)) != 0) align = 4096;
+#ifdef Q_OS_WIN
+    m_data = static_cast<char*>(_aligned_malloc(size_t(size), align));
+#else
+    void *p = nullptr;
+    if (::posix_memalign(&p, align, size_t(size)) == 0) m_data = static_cast<char*>(p);
+#endif
+    if (m_data) m_size = size;
+}
+
+AlignedBuffer::~AlignedBuffer() { release(); }
+
+AlignedBuffer::AlignedBuffer(AlignedBuffer &&o) noexcept : m_data(o.m_data), m_size(o.m_size) {
+    o.m_data = nullptr; o.m_size = 0;
+}
+
+AlignedBuffer &AlignedBuffer::operator=(AlignedBuffer &&o) noexcept {
+    if (this != &o) {
+        release();
+        m_data = o.m_data; m_size = o.m_size;
+        o.m_data = nullptr; o.m_size = 0;
+    }
+    return *this;
+}
+
+void AlignedBuffer::release() {
+#ifdef Q_OS_WIN
+    _aligned_free(m_data);
+#else
+    ::free(m_data);
+#endif
+    m_data = nullptr; m_size = 0;
+}
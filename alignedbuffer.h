@@ -0,0 +1,27 @@
+#pragma once
+#include <QtGlobal>
+
+// Буфер с выровненным адресом начала. Нужен для O_DIRECT (Linux) и FILE_FLAG_NO_BUFFERING (Windows):
+// ядро требует, чтобы адрес, длина и смещение были кратны размеру сектора.
+class AlignedBuffer {
+public:
+    AlignedBuffer() = default;
+    AlignedBuffer(qint64 size, quint32 align);
+    ~AlignedBuffer();
+
+    AlignedBuffer(AlignedBuffer &&o) noexcept;
+    AlignedBuffer &operator=(AlignedBuffer &&o) noexcept;
+    AlignedBuffer(const AlignedBuffer &) = delete;
+    AlignedBuffer &operator=(const AlignedBuffer &) = delete;
+
+    char *data() { return m_data; }
+    const char *constData() const { return m_data; }
+    qint64 size() const { return m_size; }
+    bool isNull() const { return m_data == nullptr; }
+
+private:
+    void release();
+
+    char *m_data = nullptr;
+    qint64 m_size = 0;
+};
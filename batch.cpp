@@ -0,0 +1,240 @@
+#include "batch.h"
+#include "diskio.h"
+#include "usedblocks.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QElapsedTimer>
+#include <vector>
+
+// Разбить строку на слова по пробелам; кавычки "..." склеивают слово с пробелами
+static bool splitWords(const QString &line, QStringList &words, QString &diag) {
+    words.clear();
+    QString cur;
+    bool quoted = false, any = false;
+    for (int i = 0; i < line.size(); ++i) {
+        const QChar c = line[i];
+        if (c == '"') { quoted = !quoted; any = true; continue; }
+        if (!quoted && c.isSpace()) {
+            if (any) words << cur;
+            cur.clear();
+            any = false;
+            continue;
+        }
+        cur += c;
+        any = true;
+    }
+    if (quoted) { diag = "не закрыта кавычка"; return false; }
+    if (any) words << cur;
+    return true;
+}
+
+static QStringList splitList(const QString &value) {
+    return QString(value).replace(',', ' ').split(' ', Qt::SkipEmptyParts);
+}
+
+bool Batch::parse(const QString &line, int number, BatchJob &job, QString &diag) {
+    QStringList words;
+    if (!splitWords(line, words, diag)) return false;
+    job = BatchJob();
+    job.name = "job" + QString::number(number);
+    bool hasMode = false;
+    for (const QString &w : words) {
+        const int eq = w.indexOf('=');
+        if (eq <= 0) { diag = "ожидалось ключ=значение: " + w; return false; }
+        const QString key = w.left(eq), value = w.mid(eq + 1);
+        bool ok = true;
+        if (key == "name") job.name = value;
+        else if (key == "mode") {
+            const QString m = value.toLower();
+            if (m == "w" || m == "write") job.write = true;
+            else if (m == "r" || m == "read") job.write = false;
+            else { diag = "некорректный режим: " + value; return false; }
+            hasMode = true;
+        }
+        else if (key == "disk") job.disks = splitList(value);
+        else if (key == "file") job.file = value;
+        else if (key == "block") {
+            job.autoBlock = value.toLower() == "auto";
+            if (!job.autoBlock) job.blockSize = value.toLongLong(&ok);
+            ok = ok && job.blockSize > 0;
+        }
+        else if (key == "offset") { job.offset = value.toLongLong(&ok); ok = ok && job.offset >= 0; }
+        else if (key == "limit") { job.limit = value.toLongLong(&ok); ok = ok && job.limit > 0; }
+        else if (key == "source-part") { job.sourcePart = value.toInt(&ok); ok = ok && job.sourcePart >= 0; }
+        else if (key == "source-range") {
+            ByteRange r;
+            if (!UsedBlocks::parseRange(value, r, diag)) return false;
+            job.sourceOffset = r.offset;
+            job.sourceLength = r.length;
+        }
+        else if (key == "manifest") job.manifest = value;
+        else if (key == "base-manifest") job.baseManifest = value;
+        else if (key == "checkpoint") job.checkpoint = value;
+        else if (key == "rescue") job.rescue = value;
+        else if (key == "delta") job.deltas = splitList(value);
+        else { diag = "неизвестный ключ: " + key; return false; }
+        if (!ok) { diag = "некорректное значение " + key + ": " + value; return false; }
+    }
+    if (!hasMode) { diag = "не указан mode"; return false; }
+    if (job.sourcePart >= 0 && job.sourceLength > 0) { diag = "source-part и source-range — что-то одно"; return false; }
+    if (job.disks.isEmpty()) { diag = "не указан disk"; return false; }
+    if (job.file.isEmpty()) { diag = "не указан file"; return false; }
+    if (job.name.isEmpty() || job.name.contains('/') || job.name.contains('\\')) { diag = "некорректное имя: " + job.name; return false; }
+    return true;
+}
+
+bool Batch::load(const QString &path, QVector<BatchJob> &jobs, QString &diag) {
+    QFile f(path == "-" ? QString() : path);
+    const bool opened = path == "-" ? f.open(stdin, QIODevice::ReadOnly) : f.open(QIODevice::ReadOnly);
+    if (!opened) { diag = f.errorString(); return false; }
+    const QStringList lines = QString::fromUtf8(f.readAll()).split('\n');
+    for (int i = 0; i < lines.size(); ++i) {
+        const QString line = lines[i].trimmed();
+        if (line.isEmpty() || line.startsWith("#")) continue;
+        BatchJob job;
+        if (!parse(line, jobs.size() + 1, job, diag)) { diag = "строка " + QString::number(i + 1) + ": " + diag; return false; }
+        jobs.push_back(job);
+    }
+    return true;
+}
+
+// От строки прогресса ("\rПередано: ...") в журнале остаётся только последнее состояние
+static QString collapseProgress(const QString &text) {
+    QStringList lines = text.split('\n');
+    for (QString &l : lines) {
+        const int cr = l.lastIndexOf('\r');
+        if (cr >= 0) l = l.mid(cr + 1);
+    }
+    return lines.join('\n');
+}
+
+static QString describe(const BatchJob &job) {
+    return job.write ? "запись " + job.file + " -> " + job.disks.join(", ") : "чтение " + job.disks.join(", ") + " -> " + job.file;
+}
+
+static QString codeText(int code) {
+    switch (code) {
+    case 0:  return "успешно";
+    case 1:  return "ошибка параметров или открытия";
+    case 2:  return "ошибка передачи";
+    case 3:  return "проверка не пройдена";
+    case 4:  return "остались плохие сектора";
+    default: return "код " + QString::number(code);
+    }
+}
+
+// Один файл или устройство под разными путями (ссылки /dev/disk/by-id/..., относительные пути) — одно и то же.
+// Ещё не созданный файл — по абсолютному пути.
+static QString canonicalPath(const QString &path) {
+    const QFileInfo fi(path);
+    const QString canon = fi.canonicalFilePath();
+    return canon.isEmpty() ? QDir::cleanPath(fi.absoluteFilePath()) : canon;
+}
+
+static bool overlaps(const QStringList &a, const QStringList &b) {
+    for (const QString &p : a) {
+        if (b.contains(p)) return true;
+    }
+    return false;
+}
+
+int Batch::run(QVector<BatchJob> &jobs, int parallel, const QString &logDir, const Runner &runner, QTextStream &out) {
+    const int n = jobs.size();
+    // Что задание читает и что пишет: при чтении пишется файл, при записи — устройства
+    QVector<QStringList> devices(n), reads(n), writes(n);
+    for (int i = 0; i < n; ++i) {
+        for (const QString &d : jobs[i].disks) devices[i] << canonicalPath(d);
+        const QStringList file{ canonicalPath(jobs[i].file) };
+        reads[i] = jobs[i].write ? file : devices[i];
+        writes[i] = jobs[i].write ? devices[i] : file;
+    }
+
+    enum State { Pending, Running, Finished };
+    std::vector<State> state(size_t(n), Pending);
+    QMutex lock;                 // состояние заданий и вывод в out
+    QWaitCondition changed;
+    // Задание можно начинать, когда завершены все более ранние задания на его устройствах и все более ранние,
+    // которые пишут то, что оно читает или пишет, или читают то, что оно пишет (образ, который ещё не дописан)
+    auto ready = [&](int i) {
+        for (int j = 0; j < i; ++j) {
+            if (state[size_t(j)] == Finished) continue;
+            if (overlaps(devices[i], devices[j]) || overlaps(writes[i], reads[j] + writes[j]) || overlaps(writes[j], reads[i])) return false;
+        }
+        return true;
+    };
+
+    auto worker = [&] {
+        lock.lock();
+        for (;;) {
+            int pick = -1;
+            bool pending = false;
+            for (int i = 0; i < n && pick < 0; ++i) {
+                if (state[size_t(i)] != Pending) continue;
+                pending = true;
+                if (ready(i)) pick = i;
+            }
+            if (!pending) break;
+            if (pick < 0) { changed.wait(&lock); continue; }
+
+            BatchJob &job = jobs[pick];
+            state[size_t(pick)] = Running;
+            out << "Начато [" << job.name << "]: " << describe(job) << "\n" << Qt::flush;
+            lock.unlock();
+
+            // Отчёт и ошибки в один поток, чтобы сохранить их порядок
+            QString text;
+            QTextStream jobOut(&text);
+            QElapsedTimer t; t.start();
+            job.exitCode = runner(job, jobOut, jobOut);
+            jobOut.flush();
+            job.ns = t.nsecsElapsed();
+            job.log = collapseProgress(text);
+            QString logError;
+            if (!logDir.isEmpty()) {
+                QFile lf(QDir(logDir).filePath(job.name + ".log"));
+                const QByteArray bytes = job.log.toUtf8();
+                if (!lf.open(QIODevice::WriteOnly | QIODevice::Truncate) || lf.write(bytes) != bytes.size()) logError = lf.errorString();
+            }
+
+            lock.lock();
+            state[size_t(pick)] = Finished;
+            out << "Завершено [" << job.name << "]: " << codeText(job.exitCode) << " за "
+                << QString::number(job.ns / 1e9, 'f', 1) << " с\n";
+            if (logDir.isEmpty()) {
+                out << job.log.trimmed() << "\n\n";
+            } else if (!logError.isEmpty()) {
+                out << "Не записать журнал задания: " << logError << "\n" << job.log.trimmed() << "\n\n";
+            }
+            out << Qt::flush;
+            changed.wakeAll();
+        }
+        lock.unlock();
+    };
+
+    QElapsedTimer total; total.start();
+    std::vector<QThread*> workers;
+    for (int i = 0; i < std::min(std::max(1, parallel), n); ++i) {
+        workers.push_back(QThread::create(worker));
+        workers.back()->start();
+    }
+    for (QThread *th : workers) {
+        th->wait();
+        delete th;
+    }
+
+    int result = 0, failed = 0;
+    out << "Итог пакета (" << n << " заданий за " << QString::number(total.nsecsElapsed() / 1e9, 'f', 1) << " с):\n";
+    for (const BatchJob &job : jobs) {
+        out << " [" << job.name << "] " << codeText(job.exitCode) << ", " << QString::number(job.ns / 1e9, 'f', 1) << " с — " << describe(job) << "\n";
+        if (job.exitCode != 0) {
+            ++failed;
+            if (result == 0) result = job.exitCode;
+        }
+    }
+    if (failed) out << "Неудачных заданий: " << failed << "\n";
+    return result;
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QTextStream>
+#include <functional>
+
+// Задание пакетного режима: одна передача между устройством (при записи — несколькими) и файлом.
+// Строка задания — пары "ключ=значение" через пробел, значение с пробелами — в кавычках:
+//   name=sdb mode=read disk=/dev/sdb file="/backup/sdb.img" block=auto limit=1073741824
+struct BatchJob {
+    QString name;              // для отчёта и имени журнала; по умолчанию job<номер>
+    bool write = false;
+    QStringList disks;         // пути устройств
+    QString file;              // входной образ при записи, выходной файл при чтении
+    qint64 blockSize = 1048576;
+    bool autoBlock = false;
+    qint64 offset = 0;
+    qint64 limit = -1;
+    int sourcePart = -1;       // запись раздела образа (source-part=) или его диапазона (source-range=)
+    qint64 sourceOffset = 0, sourceLength = 0;
+    // Пути, которые у каждого задания свои (одноимённые ключи командной строки)
+    QString manifest;
+    QString baseManifest;
+    QString checkpoint;
+    QString rescue;
+    QStringList deltas;
+    // результат
+    int exitCode = -1;
+    qint64 ns = 0;
+    QString log;
+};
+
+// Пакетный режим: задания из файла или командной строки, без вопросов в stdin.
+// Задания идут параллельно, не больше заданного числа сразу; задания с общим устройством, а также
+// пишущее файл и читающее его (или оба пишущие) — строго по очереди, в порядке списка.
+class Batch {
+public:
+    // Разобрать строку задания; number — номер для имени по умолчанию
+    static bool parse(const QString &line, int number, BatchJob &job, QString &diag);
+    // Файл заданий ("-" — stdin): по заданию на строку, пустые строки и комментарии "#" пропускаются
+    static bool load(const QString &path, QVector<BatchJob> &jobs, QString &diag);
+
+    // Выполняет одно задание: отчёт — в out, ошибки — в err, возвращает код возврата задания
+    using Runner = std::function<int(BatchJob &job, QTextStream &out, QTextStream &err)>;
+
+    // Выполнить задания. Отчёт задания целиком печатается в out по его завершении,
+    // а если задан logDir — пишется в logDir/<имя>.log. В конце — сводка по заданиям.
+    // Возвращает 0, если все задания успешны, иначе код первого по списку неудачного.
+    static int run(QVector<BatchJob> &jobs, int parallel, const QString &logDir, const Runner &runner, QTextStream &out);
+};
@@ -0,0 +1,182 @@
+#include <QCoreApplication>
+#include <QTextStream>
+#include <QFile>
+#include <QFileInfo>
+#include <QCommandLineParser>
+#include "diskio.h"
+#include "diskbench.h"
+#include "ioengine.h"
+#include <algorithm>
+#include <cstring>
+
+// Список чисел через запятую; false — если хоть одно не число или не больше нуля
+template <typename T>
+static bool parseList(const QString &text, QVector<T> &out) {
+    out.clear();
+    for (const QString &s : QString(text).replace(',', ' ').split(' ', Qt::SkipEmptyParts)) {
+        bool ok = false;
+        const qint64 v = s.toLongLong(&ok);
+        if (!ok || v <= 0) return false;
+        out.push_back(T(v));
+    }
+    return !out.isEmpty();
+}
+
+// Рабочий файл: дописать до size байт неповторяющимися данными (в tmpfs дырки читались бы слишком быстро)
+static bool prepareScratch(const QString &path, qint64 size, QTextStream &out, QTextStream &err) {
+    QFile f(path);
+    if (!f.open(QIODevice::ReadWrite)) { err << "Не открыть рабочий файл: " << f.errorString() << "\n"; return false; }
+    if (f.size() >= size) return true;
+    out << "Заполнение рабочего файла " << path << " до " << DiskIO::humanSize(quint64(size)) << "...\n" << Qt::flush;
+    QByteArray chunk(1024 * 1024, '\0');
+    quint64 x = 0x9E3779B97F4A7C15ULL;
+    if (!f.seek(f.size())) { err << "Не удалось дописать рабочий файл.\n"; return false; }
+    for (qint64 pos = f.size(); pos < size; pos += chunk.size()) {
+        for (int i = 0; i + 8 <= chunk.size(); i += 8) {
+            x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+            memcpy(chunk.data() + i, &x, 8);
+        }
+        const qint64 n = std::min<qint64>(chunk.size(), size - pos);
+        if (f.write(chunk.constData(), n) != n) { err << "Ошибка записи рабочего файла: " << f.errorString() << "\n"; return false; }
+    }
+    if (!DiskIO::flushToDisk(f)) { err << "Не удалось сбросить рабочий файл на носитель.\n"; return false; }
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("rawbench");
+    QCoreApplication::setApplicationVersion("6.0");
+#ifdef Q_OS_WIN
+system("chcp 65001");
+#endif
+QCommandLineParser parser;
+parser.setApplicationDescription("rawbench: замеры скорости чтения/записи диска или файла через конвейер RawWriter");
+parser.addHelpOption();
+parser.addVersionOption();
+QCommandLineOption diskOpt("disk", "Индекс диска из списка (без ключа — показать список).", "N");
+parser.addOption(diskOpt);
+QCommandLineOption fileOpt("file", "Рабочий файл вместо диска (например, в tmpfs). Создаётся и заполняется при необходимости, "
+                           "созданный удаляется в конце.", "path");
+parser.addOption(fileOpt);
+QCommandLineOption offsetOpt("offset", "Смещение замеров на диске, байт.", "bytes", "0");
+parser.addOption(offsetOpt);
+QCommandLineOption bytesOpt("bytes", "Объём одного замера, байт.", "bytes", "67108864");
+parser.addOption(bytesOpt);
+QCommandLineOption modeOpt("mode", "Что замерять: read, write или both. Запись на диск портит данные, нужен --allow-write.", "mode");
+parser.addOption(modeOpt);
+QCommandLineOption allowWriteOpt("allow-write", "Разрешить замеры записи на диск: содержимое [offset, offset+bytes) будет уничтожено.");
+parser.addOption(allowWriteOpt);
+QCommandLineOption enginesOpt("engines", "Движки через запятую.", "list", IoEngine::available().join(","));
+parser.addOption(enginesOpt);
+QCommandLineOption blocksOpt("block-sizes", "Размеры блока через запятую, байт.", "list", "65536,262144,1048576,4194304,16777216");
+parser.addOption(blocksOpt);
+QCommandLineOption buffersOpt("buffers", "Числа буферов конвейера через запятую.", "list", "2,4,8");
+parser.addOption(buffersOpt);
+QCommandLineOption qdOpt("queue-depths", "Глубины очереди через запятую (для движков с очередью).", "list", "1,8,32");
+parser.addOption(qdOpt);
+QCommandLineOption directOpt("direct", "Кэш ОС: off (через кэш), on (мимо кэша) или off,on.", "list", "off,on");
+parser.addOption(directOpt);
+QCommandLineOption copyToOpt("copy-to", "Сравнить копирование замеряемого диапазона в этот файл обычным конвейером и ядром "
+                             "(--zero-copy): скорость и время ЦП на ГиБ. Файл перезаписывается и удаляется. "
+                             "Без --mode другие замеры не делаются.", "file");
+parser.addOption(copyToOpt);
+QCommandLineOption jsonOpt("json", "Сохранить результаты в JSON (- — в stdout).", "file");
+parser.addOption(jsonOpt);
+parser.process(app);
+
+QTextStream out(stdout), err(stderr);
+bool ok = false;
+BenchPlan plan;
+plan.offset = parser.value(offsetOpt).toLongLong(&ok);
+if (!ok || plan.offset < 0 || plan.offset % 4096) { err << "Некорректное смещение (нужно кратное 4096): " << parser.value(offsetOpt) << "\n"; return 1; }
+plan.bytes = parser.value(bytesOpt).toLongLong(&ok);
+if (!ok || plan.bytes <= 0 || plan.bytes % 4096) { err << "Некорректный объём замера (нужно кратное 4096): " << parser.value(bytesOpt) << "\n"; return 1; }
+if (!parseList(parser.value(blocksOpt), plan.blockSizes)) { err << "Некорректные размеры блока: " << parser.value(blocksOpt) << "\n"; return 1; }
+for (qint64 bs : plan.blockSizes) {
+    if (bs % 4096) { err << "Размер блока должен быть кратен 4096: " << bs << "\n"; return 1; }
+}
+if (!parseList(parser.value(buffersOpt), plan.buffers)) { err << "Некорректные числа буферов: " << parser.value(buffersOpt) << "\n"; return 1; }
+if (!parseList(parser.value(qdOpt), plan.queueDepths)) { err << "Некорректные глубины очереди: " << parser.value(qdOpt) << "\n"; return 1; }
+for (const QString &e : parser.value(enginesOpt).toLower().replace(',', ' ').split(' ', Qt::SkipEmptyParts)) {
+    if (!IoEngine::available().contains(e)) { err << "Движок недоступен: " << e << " (есть: " << IoEngine::available().join(", ") << ")\n"; return 1; }
+    plan.engines << e;
+}
+if (plan.engines.isEmpty()) { err << "Не указаны движки.\n"; return 1; }
+for (const QString &d : parser.value(directOpt).toLower().replace(',', ' ').split(' ', Qt::SkipEmptyParts)) {
+    if (d == "off") plan.direct << false;
+    else if (d == "on") plan.direct << true;
+    else { err << "Некорректное значение --direct: " << d << "\n"; return 1; }
+}
+if (plan.direct.isEmpty()) { err << "Некорректное значение --direct.\n"; return 1; }
+
+const bool isFile = parser.isSet(fileOpt);
+if (isFile == parser.isSet(diskOpt)) {
+    if (!isFile) {
+        // Без цели — показать, что можно замерить
+        const auto disks = DiskIO::enumerate(err);
+        for (int i=0;i<disks.size();++i) {
+            out << " [" << i << "] " << disks[i].path << " | " << disks[i].model << " | " << DiskIO::humanSize(disks[i].size) << "\n";
+        }
+    }
+    err << "Укажите ровно одно из --disk и --file.\n";
+    return 1;
+}
+
+// По умолчанию диск только читается, рабочий файл — и читается, и пишется
+const QString mode = parser.isSet(modeOpt) ? parser.value(modeOpt).trimmed().toLower() : QString(isFile ? "both" : "read");
+if (mode != "read" && mode != "write" && mode != "both") { err << "Некорректный режим: " << mode << "\n"; return 1; }
+plan.read = mode != "write";
+plan.write = mode != "read";
+if (parser.isSet(copyToOpt)) {
+    plan.copyTo = parser.value(copyToOpt);
+    // Диск обычным файлом не бывает, так что перезаписать источник можно только рабочим файлом
+    if (QFileInfo::exists(plan.copyTo) && !QFileInfo(plan.copyTo).isFile()) { err << "--copy-to должен быть обычным файлом: " << plan.copyTo << "\n"; return 1; }
+    if (isFile && QFileInfo(plan.copyTo).absoluteFilePath() == QFileInfo(parser.value(fileOpt)).absoluteFilePath()) { err << "Файл копии совпадает с источником.\n"; return 1; }
+    if (!parser.isSet(modeOpt)) plan.read = plan.write = false;
+}
+
+bool created = false;
+if (isFile) {
+    plan.path = parser.value(fileOpt);
+    created = !QFileInfo::exists(plan.path);
+    if (!prepareScratch(plan.path, plan.offset + plan.bytes, out, err)) return 1;
+} else {
+    const auto disks = DiskIO::enumerate(err);
+    const int idx = parser.value(diskOpt).toInt(&ok);
+    if (!ok || idx < 0 || idx >= disks.size()) { err << "Некорректный индекс диска: " << parser.value(diskOpt) << "\n"; return 1; }
+    const DiskInfo &d = disks[idx];
+    plan.path = d.path;
+    if (d.size > 0 && plan.offset + plan.bytes > qint64(d.size)) { err << "Диапазон замера выходит за конец диска (" << DiskIO::humanSize(d.size) << ").\n"; return 1; }
+    out << "Диск: " << d.path << " | " << d.model << " | " << DiskIO::humanSize(d.size)
+        << " | L=" << d.logicalSector << " P=" << d.physicalSector << "\n";
+    if (plan.write) {
+        if (!parser.isSet(allowWriteOpt)) { err << "Замер записи на диск уничтожает данные, нужен --allow-write.\n"; return 1; }
+        out << "\nВНИМАНИЕ! Будет перезаписано " << DiskIO::humanSize(quint64(plan.bytes)) << " со смещения " << plan.offset
+            << " на устройстве " << d.path << "\nПродолжить? (yes/NO): " << Qt::flush;
+        if (QTextStream(stdin).readLine().trimmed().toLower() != "yes") { out << "Отменено пользователем.\n"; return 0; }
+    }
+}
+
+out << "Замеры по " << DiskIO::humanSize(quint64(plan.bytes)) << ":\n";
+const QVector<BenchPoint> pts = DiskBench::sweep(plan, out);
+if (created) QFile::remove(plan.path);
+out << "\n";
+DiskBench::printTable(pts, out);
+
+if (parser.isSet(jsonOpt)) {
+    const QByteArray json = DiskBench::toJson(plan, pts);
+    const QString jsonPath = parser.value(jsonOpt);
+    if (jsonPath == "-") {
+        out << json << Qt::flush;
+    } else {
+        QFile jf(jsonPath);
+        if (!jf.open(QIODevice::WriteOnly | QIODevice::Truncate) || jf.write(json) != json.size()) {
+            err << "Не записать " << jsonPath << ": " << jf.errorString() << "\n";
+            return 1;
+        }
+    }
+}
+const bool anyOk = std::any_of(pts.cbegin(), pts.cend(), [](const BenchPoint &p) { return p.ok; });
+return anyOk ? 0 : 2;
+}
@@ -0,0 +1,7 @@
+# Замеры скорости чтения/записи (отдельная программа: её можно гонять в CI на файлах в tmpfs)
+TEMPLATE = app
+CONFIG += console c++17
+TARGET = rawbench
+QT += core
+include(../core.pri)
+SOURCES += main.cpp
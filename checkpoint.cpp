@@ -0,0 +1,97 @@
+#include "checkpoint.h"
+#include "alignedbuffer.h"
+#include "ioengine.h"
+#include "xxh64.h"
+#include <QSaveFile>
+#include <QStringList>
+#include <algorithm>
+
+static const char kHeader[] = "# RawWriter checkpoint 1";
+static const qint64 kSample = 64 * 1024;
+
+bool Checkpoint::commit(qint64 copied, QString &diag) {
+    done = m_base + copied;
+    return save(m_path, diag);
+}
+
+bool Checkpoint::save(const QString &path, QString &diag) const {
+    QString text = QString(kHeader) + "\n";
+    text += "mode=" + mode + "\n";
+    text += "device=" + device + "\n";
+    text += "file=" + file + "\n";
+    text += "offset=" + QString::number(devOffset) + "\n";
+    text += "block=" + QString::number(blockSize) + "\n";
+    text += "total=" + QString::number(total) + "\n";
+    text += "options=" + options + "\n";
+    text += "fingerprint=" + fingerprint + "\n";
+    text += "done=" + QString::number(done) + "\n";
+
+    const QByteArray buf = text.toUtf8();
+    QSaveFile f(path);
+    if (!f.open(QIODevice::WriteOnly) || f.write(buf) != buf.size() || !f.commit()) {
+        diag = f.errorString();
+        return false;
+    }
+    return true;
+}
+
+bool Checkpoint::load(const QString &path, QString &diag) {
+    QFile f(path);
+    if (!f.open(QIODevice::ReadOnly)) { diag = f.errorString(); return false; }
+    const QStringList lines = QString::fromUtf8(f.readAll()).split('\n');
+    if (lines.isEmpty() || lines[0].trimmed() != kHeader) { diag = "файл не является журналом RawWriter"; return false; }
+
+    int seen = 0;
+    bool okDone = false, okOff = false, okBlock = false, okTotal = false;
+    for (int i = 1; i < lines.size(); ++i) {
+        const QString line = lines[i];
+        const int eq = line.indexOf('=');
+        if (line.trimmed().isEmpty() || line.startsWith("#") || eq < 0) continue;
+        const QString key = line.left(eq), value = line.mid(eq + 1);
+        ++seen;
+        if (key == "mode") mode = value;
+        else if (key == "device") device = value;
+        else if (key == "file") file = value;
+        else if (key == "offset") devOffset = value.toLongLong(&okOff);
+        else if (key == "block") blockSize = value.toLongLong(&okBlock);
+        else if (key == "total") total = value.toLongLong(&okTotal);
+        else if (key == "options") options = value;
+        else if (key == "fingerprint") fingerprint = value;
+        else if (key == "done") done = value.toLongLong(&okDone);
+        else --seen;
+    }
+    if (seen != 9 || !okDone || !okOff || !okBlock || !okTotal || done < 0 || done > total) {
+        diag = "журнал повреждён";
+        return false;
+    }
+    return true;
+}
+
+bool Checkpoint::sameJob(const Checkpoint &o, QString &diag) const {
+    QStringList diff;
+    if (mode != o.mode) diff << "режим " + o.mode;
+    if (device != o.device) diff << "устройство " + o.device;
+    if (file != o.file) diff << "файл " + o.file;
+    if (devOffset != o.devOffset) diff << "смещение " + QString::number(o.devOffset);
+    if (blockSize != o.blockSize) diff << "размер блока " + QString::number(o.blockSize);
+    if (total != o.total) diff << "объём " + QString::number(o.total);
+    if (options != o.options) diff << "ключи «" + o.options + "»";
+    if (diff.isEmpty()) return true;
+    diag = "в журнале другое задание: " + diff.join(", ");
+    return false;
+}
+
+QString Checkpoint::fingerprintOf(QFile &f, qint64 from, qint64 size) {
+    // Смещения и длины кратны 4096 — годится и для устройства, открытого мимо кэша
+    AlignedBuffer buf(kSample, 4096);
+    Xxh64 h;
+    const qint64 mid = (size / 2) - (size / 2) % 4096;
+    const qint64 tail = std::max<qint64>(0, size - kSample);
+    for (qint64 off : { qint64(0), mid, tail - tail % 4096 }) {
+        IoRequest r;
+        r.fd = f.handle(); r.buf = buf.data(); r.len = kSample; r.offset = from + off;
+        const qint64 n = IoEngine::execute(r);
+        if (n > 0) h.update(buf.constData(), std::min(n, size - off));
+    }
+    return QString::number(size) + ":" + QString::number(h.digest(), 16).rightJustified(16, '0');
+}
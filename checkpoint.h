@@ -0,0 +1,40 @@
+#pragma once
+#include <QString>
+#include <QFile>
+
+// Журнал возобновления передачи. Текстовый файл "ключ=значение": параметры задания,
+// отпечаток источника и сколько байт уже точно на носителе (записано и сброшено).
+// Переписывается целиком через временный файл, так что при сбое остаётся прошлая версия.
+class Checkpoint {
+public:
+    QString mode;           // "read" или "write"
+    QString device;
+    QString file;           // входной образ при записи, выходной файл при чтении
+    qint64 devOffset = 0;
+    qint64 blockSize = 0;
+    qint64 total = 0;       // байт во всём задании
+    QString options;        // ключи, от которых зависит результат (--zero-blocks, --used-only, дельты)
+    QString fingerprint;
+    qint64 done = 0;        // байт от начала задания, сброшенных на носитель
+
+    // Куда сохранять и с какого места идёт текущий запуск (done прошлого запуска)
+    void bind(const QString &path, qint64 resumedFrom) { m_path = path; m_base = resumedFrom; }
+    const QString &path() const { return m_path; }
+
+    // Текущий запуск передал copied байт и сбросил их на носитель
+    bool commit(qint64 copied, QString &diag);
+
+    bool save(const QString &path, QString &diag) const;
+    bool load(const QString &path, QString &diag);
+
+    // То же задание? Что не совпало — в diag
+    bool sameJob(const Checkpoint &other, QString &diag) const;
+
+    // Отпечаток источника: размер и XXH64 трёх участков по 64 КиБ (начало, середина, конец)
+    // диапазона [from, from+size). Читается позиционно, позицию f не меняет.
+    static QString fingerprintOf(QFile &f, qint64 from, qint64 size);
+
+private:
+    QString m_path;
+    qint64 m_base = 0;
+};
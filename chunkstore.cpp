@@ -0,0 +1,442 @@
+#include "chunkstore.h"
+#include "imagefile.h"
+#include "zeroblock.h"
+#include "xxh64.h"
+#include <QDir>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QCryptographicHash>
+#include <QtEndian>
+#include <algorithm>
+#include <cstring>
+
+#ifdef Q_OS_WIN
+#  include <windows.h>
+#else
+#  include <errno.h>
+#endif
+
+static const char kChunkMagic[8] = {'R','W','C','H','U','N','K','1'};
+static const char kRecipeMagic[8] = {'R','W','R','E','C','I','P','E'};
+static const int kHeaderSize = 32;
+static const int kEntrySize = 40;
+static const quint32 kVersion = 1;
+static const quint32 kZeroFlag = 1;
+
+#ifdef Q_OS_WIN
+static const qint64 kCorrupt = -qint64(ERROR_INVALID_DATA);
+#else
+static const qint64 kCorrupt = -qint64(EIO);
+#endif
+
+// Gear-хэш для нарезки по содержимому: по случайному 64-битному числу на байт (splitmix64, всегда одни и те же)
+struct GearTable {
+    quint64 v[256];
+    GearTable() {
+        quint64 x = 0x2545F4914F6CDD1DULL;
+        for (quint64 &g : v) {
+            x += 0x9E3779B97F4A7C15ULL;
+            quint64 z = x;
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+            g = z ^ (z >> 31);
+        }
+    }
+};
+static const GearTable g_gear;
+
+bool ChunkStore::parseChunking(const QString &spec, Chunking &mode, quint32 &size, QString &diag) {
+    const QString name = spec.section(':', 0, 0).trimmed().toLower();
+    const QString value = spec.section(':', 1, 1).trimmed();
+    if (name == "fixed") mode = Fixed;
+    else if (name == "cdc") mode = ContentDefined;
+    else { diag = QString("неизвестная нарезка '%1' (fixed или cdc)").arg(name); return false; }
+    size = 1024 * 1024;
+    if (!value.isEmpty()) {
+        bool ok = false;
+        const qint64 v = value.toLongLong(&ok);
+        if (!ok || v < 4096 || v > 64 * 1024 * 1024) { diag = "размер чанка должен быть от 4096 до 67108864 байт"; return false; }
+        size = quint32(v);
+    }
+    return true;
+}
+
+bool ChunkStore::isRecipe(QFile &f, qint64 &rawSize) {
+    char head[kHeaderSize];
+    if (f.size() < kHeaderSize || (f.size() - kHeaderSize) % kEntrySize) return false;
+    const qint64 pos = f.pos();
+    const bool ok = f.seek(0) && f.read(head, kHeaderSize) == kHeaderSize;
+    f.seek(pos);
+    if (!ok || std::memcmp(head, kRecipeMagic, 8) != 0) return false;
+    rawSize = qint64(qFromLittleEndian<quint64>(head + 24));
+    return true;
+}
+
+bool ChunkStore::open(bool create, QString &diag) {
+    QDir d(m_dir);
+    if (!d.exists()) {
+        if (!create) { diag = "нет каталога хранилища " + m_dir; return false; }
+        if (!QDir().mkpath(m_dir)) { diag = "не создать каталог " + m_dir; return false; }
+    }
+    if (!create) return true;
+    // Подкаталоги по первому байту хэша — заранее, чтобы не проверять их на каждом чанке
+    for (int i = 0; i < 256; ++i) {
+        const QString sub = QString::number(i, 16).rightJustified(2, '0');
+        if (!d.mkpath(sub)) { diag = "не создать каталог " + d.filePath(sub); return false; }
+    }
+    return true;
+}
+
+QString ChunkStore::pathOf(const QByteArray &hash) const {
+    const QString hex = QString::fromLatin1(hash.toHex());
+    return QDir(m_dir).filePath(hex.left(2) + "/" + hex);
+}
+
+bool ChunkStore::put(const QByteArray &hash, const char *data, qint64 n, int codec, int level, bool &added, qint64 &stored, QString &diag) {
+    added = false;
+    stored = 0;
+    const QString path = pathOf(hash);
+    {
+        QMutexLocker lock(&m_mutex);
+        if (m_known.contains(hash)) return true;
+        m_known.insert(hash);
+    }
+    if (QFileInfo::exists(path)) return true;
+
+    QByteArray body;
+    const quint32 used = ImageFile::compressBlock(data, n, codec, level, body);
+    char head[kHeaderSize] = {};
+    std::memcpy(head, kChunkMagic, 8);
+    qToLittleEndian<quint32>(used, head + 8);
+    qToLittleEndian<quint32>(quint32(n), head + 12);
+    qToLittleEndian<quint32>(quint32(body.size()), head + 16);
+    qToLittleEndian<quint64>(Xxh64::hash(data, n), head + 24);
+    // Временный файл и переименование: недописанный чанк никогда не виден под своим хэшем
+    QSaveFile f(path);
+    if (!f.open(QIODevice::WriteOnly) || f.write(head, kHeaderSize) != kHeaderSize
+        || f.write(body) != body.size() || !f.commit()) {
+        diag = "не сохранить чанк " + path + ": " + f.errorString();
+        QMutexLocker lock(&m_mutex);
+        m_known.remove(hash);
+        return false;
+    }
+    added = true;
+    stored = kHeaderSize + body.size();
+    return true;
+}
+
+bool ChunkStore::get(const QByteArray &hash, quint32 rawSize, QByteArray &out, QString &diag) const {
+    const QString path = pathOf(hash);
+    QFile f(path);
+    if (!f.open(QIODevice::ReadOnly)) { diag = "нет чанка " + path + ": " + f.errorString(); return false; }
+    const QByteArray all = f.readAll();
+    const char *head = all.constData();
+    if (all.size() < kHeaderSize || std::memcmp(head, kChunkMagic, 8) != 0
+        || qFromLittleEndian<quint32>(head + 12) != rawSize
+        || qint64(qFromLittleEndian<quint32>(head + 16)) != all.size() - kHeaderSize) {
+        diag = "повреждён чанк " + path;
+        return false;
+    }
+    out.resize(int(rawSize));
+    if (!ImageFile::decompressBlock(head + kHeaderSize, all.size() - kHeaderSize, qFromLittleEndian<quint32>(head + 8), out.data(), rawSize)
+        || Xxh64::hash(out.constData(), rawSize) != qFromLittleEndian<quint64>(head + 24)) {
+        diag = "повреждён чанк " + path;
+        return false;
+    }
+    return true;
+}
+
+// ---------- запись ----------
+
+ChunkStoreWriterEngine::ChunkStoreWriterEngine(ChunkStore &store, QFile &recipe, ChunkStore::Chunking mode, quint32 chunkSize,
+                                               int codec, int level, int threads)
+    : m_store(store), m_recipe(recipe), m_mode(mode), m_chunkSize(chunkSize),
+      m_codec(codec), m_level(level), m_threads(std::max(1, threads)) {
+    m_pool.setMaxThreadCount(m_threads);
+    if (mode == ChunkStore::Fixed) {
+        m_min = m_max = chunkSize;
+        m_mask = 0;
+    } else {
+        // Срез после минимума с вероятностью 1/2^bits на байт: в среднем около chunkSize
+        m_min = chunkSize / 4;
+        m_max = qint64(chunkSize) * 4;
+        int bits = 0;
+        while ((qint64(2) << bits) <= qint64(chunkSize) * 3 / 4) ++bits;
+        m_mask = (quint64(1) << bits) - 1;
+    }
+}
+
+ChunkStoreWriterEngine::~ChunkStoreWriterEngine() {
+    m_pool.waitForDone();
+}
+
+QString ChunkStoreWriterEngine::name() const {
+    return m_mode == ChunkStore::Fixed ? "store-fixed" : "store-cdc";
+}
+
+bool ChunkStoreWriterEngine::submit(const IoRequest &r) {
+    QMutexLocker lock(&m_mutex);
+    if (r.offset != m_lastEnd || !m_error.isEmpty()) return false;
+    // Не держать в памяти больше пары чанков на поток
+    while (m_jobs >= m_threads * 2) m_cond.wait(&m_mutex);
+    m_lastEnd += r.len;
+    m_rawBytes += r.len;
+    m_pending.append(r.buf, int(r.len));
+    cut(false);
+    // Данные уже скопированы — буфер свободен; ошибки сохранения всплывут в wait() и finish()
+    IoCompletion c;
+    c.tag = r.tag;
+    c.result = r.len;
+    m_ready.push_back(c);
+    return true;
+}
+
+// Нарезать ненарезанный хвост m_pending; final — последний кусок тоже чанк
+void ChunkStoreWriterEngine::cut(bool final) {
+    const uchar *p = reinterpret_cast<const uchar*>(m_pending.constData());
+    for (;;) {
+        const qint64 avail = m_pending.size() - m_head;
+        qint64 len = -1;
+        if (m_mode == ChunkStore::Fixed) {
+            if (avail >= m_max) len = m_max;
+        } else {
+            // Первые m_min байт чанка не хэшируются: чанк не бывает короче минимума
+            qint64 i = std::max(m_scan, std::min(m_min, avail));
+            const qint64 stop = std::min(avail, m_max);
+            for (; i < stop && len < 0; ++i) {
+                m_gear = (m_gear << 1) + g_gear.v[p[m_head + i]];
+                if (!(m_gear & m_mask)) len = i + 1;
+            }
+            m_scan = i;
+            if (len < 0 && avail >= m_max) len = m_max;
+        }
+        if (len < 0 && final && avail > 0) len = avail;
+        if (len < 0) break;
+        dispatch(m_head, len);
+        m_head += len;
+        m_scan = 0;
+        m_gear = 0;
+    }
+    // Сдвигать данные, только когда нарезанного набралось много
+    if (m_head > 0 && (m_head >= m_pending.size() / 2 || final)) {
+        m_pending.remove(0, int(m_head));
+        m_head = 0;
+    }
+}
+
+void ChunkStoreWriterEngine::dispatch(qint64 from, qint64 len) {
+    const int seq = m_entries.size();
+    RecipeEntry e;
+    e.rawSize = quint32(len);
+    m_entries.push_back(e);
+    ++m_jobs;
+    const QByteArray data = m_pending.mid(int(from), int(len));
+    m_pool.start([this, seq, data] {
+        RecipeEntry e;
+        e.rawSize = quint32(data.size());
+        bool added = false;
+        qint64 stored = 0;
+        QString diag;
+        bool ok = true;
+        if (ZeroBlock::isAllZero(data.constData(), data.size())) {
+            e.zero = true;
+            e.hash = QByteArray(32, '\0');
+        } else {
+            QCryptographicHash h(QCryptographicHash::Sha256);
+            h.addData(data.constData(), data.size());
+            e.hash = h.result();
+            ok = m_store.put(e.hash, data.constData(), data.size(), m_codec, m_level, added, stored, diag);
+        }
+        QMutexLocker l(&m_mutex);
+        m_entries[seq] = e;
+        if (!ok && m_error.isEmpty()) m_error = diag;
+        if (e.zero) m_zeroBytes += data.size();
+        if (added) {
+            ++m_newChunks;
+            m_newBytes += data.size();
+            m_storedBytes += stored;
+        }
+        --m_jobs;
+        m_cond.wakeAll();
+    });
+}
+
+bool ChunkStoreWriterEngine::wait(QVector<IoCompletion> &done, int minCount, QString &diag) {
+    Q_UNUSED(minCount);
+    QMutexLocker lock(&m_mutex);
+    if (!m_error.isEmpty()) { diag = m_error; return false; }
+    done += m_ready;
+    m_ready.clear();
+    return true;
+}
+
+bool ChunkStoreWriterEngine::finish(QString &diag) {
+    {
+        QMutexLocker lock(&m_mutex);
+        cut(true);
+    }
+    m_pool.waitForDone();
+    if (!m_error.isEmpty()) { diag = m_error; return false; }
+
+    QByteArray out(kHeaderSize + m_entries.size() * kEntrySize, '\0');
+    char *p = out.data();
+    std::memcpy(p, kRecipeMagic, 8);
+    qToLittleEndian<quint32>(kVersion, p + 8);
+    qToLittleEndian<quint32>(quint32(m_mode), p + 12);
+    qToLittleEndian<quint32>(m_chunkSize, p + 16);
+    qToLittleEndian<quint64>(quint64(m_rawBytes), p + 24);
+    p += kHeaderSize;
+    for (const RecipeEntry &e : m_entries) {
+        qToLittleEndian<quint32>(e.rawSize, p);
+        qToLittleEndian<quint32>(e.zero ? kZeroFlag : 0u, p + 4);
+        std::memcpy(p + 8, e.hash.constData(), 32);
+        p += kEntrySize;
+    }
+    if (!m_recipe.seek(0) || m_recipe.write(out) != out.size() || !m_recipe.resize(out.size())) {
+        diag = "не записать рецепт: " + m_recipe.errorString();
+        return false;
+    }
+    return true;
+}
+
+// ---------- чтение ----------
+
+ChunkStoreReaderEngine::ChunkStoreReaderEngine(const ChunkStore &store, QFile &recipe, int threads)
+    : m_store(store), m_recipe(recipe), m_threads(std::max(1, threads)) {
+    // Потоки пула и собирают запросы, и загружают чанки впрок
+    m_pool.setMaxThreadCount(m_threads);
+    m_cacheLimit = m_threads * 6;
+}
+
+ChunkStoreReaderEngine::~ChunkStoreReaderEngine() {
+    m_pool.waitForDone();
+}
+
+bool ChunkStoreReaderEngine::open(QString &diag) {
+    qint64 rawSize = 0;
+    if (!ChunkStore::isRecipe(m_recipe, rawSize)) { diag = "файл не является рецептом хранилища"; return false; }
+    // Позиция файла — смещение в данных образа для конвейера, поэтому после чтения возвращается на место
+    const qint64 pos0 = m_recipe.pos();
+    if (!m_recipe.seek(0)) { diag = m_recipe.errorString(); return false; }
+    const QByteArray all = m_recipe.readAll();
+    m_recipe.seek(pos0);
+    if (qFromLittleEndian<quint32>(all.constData() + 8) != kVersion) { diag = "неизвестная версия рецепта"; return false; }
+    const int count = (all.size() - kHeaderSize) / kEntrySize;
+    m_entries.resize(count);
+    m_offsets.resize(count + 1);
+    qint64 pos = 0;
+    for (int i = 0; i < count; ++i) {
+        const char *p = all.constData() + kHeaderSize + i * kEntrySize;
+        RecipeEntry &e = m_entries[i];
+        e.rawSize = qFromLittleEndian<quint32>(p);
+        e.zero = qFromLittleEndian<quint32>(p + 4) & kZeroFlag;
+        e.hash = QByteArray(p + 8, 32);
+        m_offsets[i] = pos;
+        pos += e.rawSize;
+    }
+    m_offsets[count] = pos;
+    if (pos != rawSize) { diag = "повреждён рецепт: сумма чанков не совпадает с размером данных"; return false; }
+    return true;
+}
+
+// Чанк, в который попадает off (off < rawSize)
+int ChunkStoreReaderEngine::chunkAt(qint64 off) const {
+    return int(std::upper_bound(m_offsets.begin(), m_offsets.end(), off) - m_offsets.begin()) - 1;
+}
+
+bool ChunkStoreReaderEngine::submit(const IoRequest &r) {
+    {
+        QMutexLocker lock(&m_mutex);
+        ++m_inFlight;
+    }
+    char *buf = r.buf;
+    const qint64 off = r.offset, len = r.len;
+    const quint64 tag = r.tag;
+    m_pool.start([this, buf, off, len, tag] {
+        IoCompletion c;
+        c.tag = tag;
+        c.result = readRange(buf, off, len);
+        QMutexLocker l(&m_mutex);
+        m_ready.push_back(c);
+        m_cond.wakeAll();
+    });
+
+    // Впрок — чанки сразу за запросом, чтобы они грузились, пока собираются текущие блоки
+    if (off < rawSize()) {
+        const int last = chunkAt(std::min(off + len, rawSize()) - 1);
+        const int upto = std::min(last + m_threads * 2, chunkCount() - 1);
+        for (int i = std::max(m_prefetched + 1, last + 1); i <= upto; ++i) {
+            if (m_entries[i].zero) continue;
+            m_pool.start([this, i] { QByteArray d; QString diag; chunk(i, d, diag); });
+        }
+        m_prefetched = std::max(m_prefetched, upto);
+    }
+    return true;
+}
+
+bool ChunkStoreReaderEngine::wait(QVector<IoCompletion> &done, int minCount, QString &diag) {
+    QMutexLocker lock(&m_mutex);
+    const int need = std::min(minCount, m_inFlight);
+    while (m_ready.size() < need) m_cond.wait(&m_mutex);
+    m_inFlight -= m_ready.size();
+    done += m_ready;
+    m_ready.clear();
+    // Причина ошибки чанка понятнее, чем код ошибки в завершении
+    if (!m_error.isEmpty()) { diag = m_error; return false; }
+    return true;
+}
+
+// Чанк i из кэша или из хранилища. Загружает тот, кто первым за ним пришёл, остальные ждут.
+bool ChunkStoreReaderEngine::chunk(int i, QByteArray &data, QString &diag) {
+    QMutexLocker lock(&m_cacheMutex);
+    for (;;) {
+        auto it = m_cache.find(i);
+        if (it == m_cache.end()) break;
+        if (!it.value().loading) { data = it.value().data; return true; }
+        m_cacheCond.wait(&m_cacheMutex);
+    }
+    m_cache.insert(i, Cached());
+    lock.unlock();
+
+    const bool ok = m_store.get(m_entries[i].hash, m_entries[i].rawSize, data, diag);
+
+    lock.relock();
+    if (ok) {
+        Cached &c = m_cache[i];
+        c.data = data;
+        c.loading = false;
+        // Вытесняются самые ранние: данные идут по возрастанию смещений
+        for (auto it = m_cache.begin(); it != m_cache.end() && m_cache.size() > m_cacheLimit;) {
+            if (it.value().loading || it.key() == i) ++it;
+            else it = m_cache.erase(it);
+        }
+    } else {
+        m_cache.remove(i);
+    }
+    m_cacheCond.wakeAll();
+    return ok;
+}
+
+// Собрать [off, off+len) из чанков. Как обычный файл: меньше len у конца данных, 0 за концом.
+qint64 ChunkStoreReaderEngine::readRange(char *buf, qint64 off, qint64 len) {
+    if (off >= rawSize()) return 0;
+    len = std::min(len, rawSize() - off);
+    const qint64 end = off + len;
+    QByteArray data;
+    QString diag;
+    for (int i = chunkAt(off); i < chunkCount() && m_offsets[i] < end; ++i) {
+        const qint64 from = std::max(off, m_offsets[i]);
+        const qint64 to = std::min(end, m_offsets[i + 1]);
+        if (m_entries[i].zero) {
+            std::memset(buf + (from - off), 0, size_t(to - from));
+            continue;
+        }
+        if (!chunk(i, data, diag)) {
+            QMutexLocker lock(&m_mutex);
+            if (m_error.isEmpty()) m_error = diag;
+            return kCorrupt;
+        }
+        std::memcpy(buf + (from - off), data.constData() + (from - m_offsets[i]), size_t(to - from));
+    }
+    return len;
+}
@@ -0,0 +1,141 @@
+#pragma once
+#include "ioengine.h"
+#include <QFile>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QThreadPool>
+#include <QMap>
+#include <QSet>
+#include <QByteArray>
+
+// Хранилище чанков: каталог, где каждый чанк лежит один раз под своим SHA-256,
+//   <каталог>/<первые 2 hex>/<64 hex>
+// Файл чанка: [заголовок 32 байта: "RWCHUNK1", кодек, исходный размер, размер данных, 0, XXH64 исходных данных][данные].
+// Образ в хранилище — рецепт: список ссылок на чанки по порядку,
+//   [заголовок 32 байта: "RWRECIPE", версия, нарезка, размер чанка, 0, размер данных][40 байт на чанк: размер, флаги, SHA-256]
+// Нулевые чанки в хранилище не попадают (флаг Zero). Все числа little-endian.
+struct RecipeEntry {
+    quint32 rawSize = 0;
+    bool zero = false;
+    QByteArray hash;           // SHA-256, 32 байта
+};
+
+class ChunkStore {
+public:
+    enum Chunking { Fixed = 0, ContentDefined = 1 };
+
+    // "fixed:1048576" или "cdc:1048576" (у cdc — средний размер, чанк от 1/4 до 4 средних)
+    static bool parseChunking(const QString &spec, Chunking &mode, quint32 &size, QString &diag);
+    // Это рецепт? Тогда rawSize — размер данных образа
+    static bool isRecipe(QFile &f, qint64 &rawSize);
+
+    explicit ChunkStore(const QString &dir) : m_dir(dir) {}
+    // create — создать каталог и подкаталоги, если их нет
+    bool open(bool create, QString &diag);
+    QString dir() const { return m_dir; }
+
+    // Сохранить чанк, если такого ещё нет. added — чанк новый, stored — сколько байт он занял.
+    // Потокобезопасно; один и тот же чанк из нескольких потоков и процессов сохраняется один раз.
+    bool put(const QByteArray &hash, const char *data, qint64 n, int codec, int level, bool &added, qint64 &stored, QString &diag);
+    // Прочитать и распаковать чанк, сверив размер и XXH64
+    bool get(const QByteArray &hash, quint32 rawSize, QByteArray &out, QString &diag) const;
+
+private:
+    QString pathOf(const QByteArray &hash) const;
+
+    QString m_dir;
+    QMutex m_mutex;
+    QSet<QByteArray> m_known;      // уже есть в хранилище или сохраняются сейчас
+};
+
+// Сторона записи конвейера при чтении в хранилище: поток режется на чанки (фиксированные или
+// по содержимому, gear-хэш), чанки хэшируются, сжимаются и сохраняются на пуле потоков.
+// Рецепт пишется в файл образа в finish(). Смещения запросов должны идти подряд.
+class ChunkStoreWriterEngine : public IoEngine {
+public:
+    ChunkStoreWriterEngine(ChunkStore &store, QFile &recipe, ChunkStore::Chunking mode, quint32 chunkSize, int codec, int level, int threads);
+    ~ChunkStoreWriterEngine() override;
+
+    QString name() const override;
+    int queueDepth() const override { return m_threads * 2; }
+    bool submit(const IoRequest &r) override;
+    bool wait(QVector<IoCompletion> &done, int minCount, QString &diag) override;
+    bool finish(QString &diag) override;
+
+    qint64 rawBytes() const { return m_rawBytes; }
+    qint64 chunkCount() const { return m_entries.size(); }
+    qint64 newChunks() const { return m_newChunks; }
+    qint64 newBytes() const { return m_newBytes; }
+    qint64 storedBytes() const { return m_storedBytes; }
+    qint64 zeroBytes() const { return m_zeroBytes; }
+
+private:
+    void cut(bool final);
+    void dispatch(qint64 from, qint64 len);
+
+    ChunkStore &m_store;
+    QFile &m_recipe;
+    ChunkStore::Chunking m_mode;
+    quint32 m_chunkSize;
+    qint64 m_min, m_max;
+    quint64 m_mask;
+    int m_codec, m_level, m_threads;
+    QThreadPool m_pool;
+    QMutex m_mutex;
+    QWaitCondition m_cond;
+    QVector<IoCompletion> m_ready;
+    QVector<RecipeEntry> m_entries;    // по порядку данных; хэши заполняет пул
+    int m_jobs = 0;                    // чанков в пуле
+    QByteArray m_pending;              // данные после последнего среза
+    qint64 m_head = 0;                 // начало ненарезанного в m_pending
+    qint64 m_scan = 0;                 // сколько байт текущего чанка уже просмотрено
+    quint64 m_gear = 0;
+    qint64 m_lastEnd = 0;
+    QString m_error;
+    qint64 m_rawBytes = 0, m_newChunks = 0, m_newBytes = 0, m_storedBytes = 0, m_zeroBytes = 0;
+};
+
+// Сторона чтения конвейера при записи из хранилища: запросы собираются из чанков рецепта
+// на пуле потоков, а следующие за запросом чанки загружаются заранее. Загруженные чанки
+// держатся в небольшом кэше: чанк на границе блоков читается с диска один раз.
+class ChunkStoreReaderEngine : public IoEngine {
+public:
+    ChunkStoreReaderEngine(const ChunkStore &store, QFile &recipe, int threads);
+    ~ChunkStoreReaderEngine() override;
+
+    // Прочитать рецепт
+    bool open(QString &diag);
+    qint64 rawSize() const { return m_offsets.isEmpty() ? 0 : m_offsets.last(); }
+    int chunkCount() const { return m_entries.size(); }
+
+    QString name() const override { return "store"; }
+    int queueDepth() const override { return m_threads * 2; }
+    bool submit(const IoRequest &r) override;
+    bool wait(QVector<IoCompletion> &done, int minCount, QString &diag) override;
+
+private:
+    struct Cached {
+        QByteArray data;
+        bool loading = true;
+    };
+    qint64 readRange(char *buf, qint64 off, qint64 len);
+    bool chunk(int i, QByteArray &data, QString &diag);
+    int chunkAt(qint64 off) const;
+
+    const ChunkStore &m_store;
+    QFile &m_recipe;
+    int m_threads;
+    QThreadPool m_pool;
+    QMutex m_mutex;
+    QWaitCondition m_cond;
+    QVector<IoCompletion> m_ready;
+    int m_inFlight = 0;
+    QVector<RecipeEntry> m_entries;
+    QVector<qint64> m_offsets;         // начало каждого чанка и в конце — размер данных
+    QMutex m_cacheMutex;
+    QWaitCondition m_cacheCond;
+    QMap<int, Cached> m_cache;
+    int m_cacheLimit;
+    int m_prefetched = -1;             // до какого чанка загрузка уже поставлена
+    QString m_error;
+};
@@ -0,0 +1,54 @@
+# Общая часть RawWriter и rawbench: всё, кроме main.cpp
+INCLUDEPATH += $$PWD
+SOURCES += $$PWD/diskio.cpp\
+           $$PWD/alignedbuffer.cpp\
+           $$PWD/ioengine.cpp\
+           $$PWD/zeroblock.cpp\
+           $$PWD/imagefile.cpp\
+           $$PWD/chunkstore.cpp\
+           $$PWD/usedblocks.cpp\
+           $$PWD/xxh64.cpp\
+           $$PWD/manifest.cpp\
+           $$PWD/streamhash.cpp\
+           $$PWD/rescue.cpp\
+           $$PWD/checkpoint.cpp\
+           $$PWD/diskbench.cpp\
+           $$PWD/telemetry.cpp\
+           $$PWD/throttle.cpp
+HEADERS += $$PWD/diskio.h\
+           $$PWD/alignedbuffer.h\
+           $$PWD/ioengine.h\
+           $$PWD/zeroblock.h\
+           $$PWD/imagefile.h\
+           $$PWD/chunkstore.h\
+           $$PWD/usedblocks.h\
+           $$PWD/xxh64.h\
+           $$PWD/manifest.h\
+           $$PWD/streamhash.h\
+           $$PWD/rescue.h\
+           $$PWD/checkpoint.h\
+           $$PWD/diskbench.h\
+           $$PWD/telemetry.h\
+           $$PWD/throttle.h
+
+# Движок io_uring — только если в системе есть liburing (иначе доступен лишь sync)
+unix:!macx {
+    CONFIG += link_pkgconfig
+    packagesExist(liburing) {
+        PKGCONFIG += liburing
+        DEFINES += RAWWRITER_HAVE_URING
+    }
+}
+
+# Кодеки образа RWI: zlib есть всегда (через Qt), zstd и lz4 — если найдены в системе
+unix {
+    CONFIG += link_pkgconfig
+    packagesExist(libzstd) {
+        PKGCONFIG += libzstd
+        DEFINES += RAWWRITER_HAVE_ZSTD
+    }
+    packagesExist(liblz4) {
+        PKGCONFIG += liblz4
+        DEFINES += RAWWRITER_HAVE_LZ4
+    }
+}
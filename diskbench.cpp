@@ -0,0 +1,285 @@
+#include "diskbench.h"
+#include "ioengine.h"
+#include <QElapsedTimer>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <algorithm>
+#include <memory>
+
+#ifdef Q_OS_LINUX
+#  include <fcntl.h>
+#endif
+
+static const char *modeName(bool write) { return write ? "запись" : "чтение"; }
+static const char *modeName(const BenchPoint &p) { return p.copy ? "копия" : modeName(p.write); }
+
+// Буферов в кольце на самом деле: копирование добирает до суммы глубин очередей обеих сторон
+static int effectiveBuffers(const BenchPoint &p) {
+    return std::max({2, p.buffers, (p.engine == "sync" ? 1 : p.queueDepth) + 1});
+}
+
+static QString describe(const BenchPoint &p) {
+    QString s = p.engine + (p.direct ? " direct" : " кэш") + ", блок " + DiskIO::humanSize(quint64(p.blockSize));
+    if (p.engine == "kernel") return s;
+    s += ", буферов " + QString::number(effectiveBuffers(p));
+    if (p.engine != "sync") s += ", очередь " + QString::number(p.queueDepth);
+    return s;
+}
+
+static QString speedText(const BenchPoint &p) {
+    if (!p.ok) return "ошибка: " + p.error;
+    QString s = QString::number(p.mibPerSec(), 'f', 1) + " MiB/s";
+    if (p.copy) s += ", ЦП " + QString::number(p.cpuSecPerGiB(), 'f', 2) + " с/ГиБ";
+    return s;
+}
+
+bool DiskBench::measure(const QString &path, qint64 offset, qint64 bytes, BenchPoint &p) {
+    p.ok = false;
+    p.bytes = p.ns = 0;
+    p.error.clear();
+
+    // Вторая сторона не открывается: её запросы завершает движок null
+    QFile dev, none;
+    QString diag;
+    quint32 l = 512, ph = 4096;
+    const bool opened = p.write ? DiskIO::openWrite(path, dev, diag, l, ph, p.direct)
+                                : DiskIO::openRead(path, dev, diag, l, ph, p.direct);
+    if (!opened) { p.error = diag; return false; }
+    if (offset > 0 && !dev.seek(offset)) { p.error = "не удалось перейти на смещение " + QString::number(offset); return false; }
+    if (p.blockSize % l) { p.error = "размер блока не кратен сектору " + QString::number(l); return false; }
+#ifdef Q_OS_LINUX
+    // Иначе повторное чтение того же диапазона придёт из кэша страниц, а не с носителя
+    if (!p.write && !p.direct) ::posix_fadvise(dev.handle(), offset, bytes, POSIX_FADV_DONTNEED);
+#endif
+
+    std::unique_ptr<IoEngine> idle = IoEngine::create("null", 1, diag);
+    CopyOptions o;
+    o.bufferCount = p.buffers;
+    o.directIo = p.direct;
+    o.bufferAlign = ph;
+    o.ioEngine = p.engine;
+    o.queueDepth = p.queueDepth;
+    if (p.write) o.sourceEngine = idle.get();
+    else         o.destEngine = idle.get();
+
+    QVector<CopyTarget> targets(1);
+    targets[0].file = p.write ? &dev : &none;
+    QString log, errors;
+    QTextStream quiet(&log), quietErr(&errors);
+    QElapsedTimer t; t.start();
+    const qint64 cpu0 = DiskIO::cpuTimeNs();
+    const bool ok = DiskIO::copyToMany(p.write ? none : dev, targets, bytes, p.blockSize, l, p.write, quiet, quietErr, o);
+    p.ns = t.nsecsElapsed();
+    p.cpuNs = DiskIO::cpuTimeNs() - cpu0;
+    p.bytes = targets[0].written;
+    quietErr.flush();
+    if (!ok) {
+        p.error = targets[0].error.isEmpty() ? errors.trimmed() : targets[0].error;
+        return false;
+    }
+    if (p.bytes == 0) { p.error = "нечего читать: смещение за концом"; return false; }
+    p.ok = true;
+    return true;
+}
+
+bool DiskBench::measureCopy(const QString &path, const QString &dstPath, qint64 offset, qint64 bytes, BenchPoint &p) {
+    p.ok = false;
+    p.bytes = p.ns = p.cpuNs = 0;
+    p.error.clear();
+
+    QFile src, dst(dstPath);
+    QString diag;
+    quint32 l = 512, ph = 4096;
+    if (!DiskIO::openRead(path, src, diag, l, ph, p.direct)) { p.error = diag; return false; }
+    if (offset > 0 && !src.seek(offset)) { p.error = "не удалось перейти на смещение " + QString::number(offset); return false; }
+    if (p.blockSize % l) { p.error = "размер блока не кратен сектору " + QString::number(l); return false; }
+    if (!dst.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Unbuffered)) { p.error = dst.errorString(); return false; }
+#ifdef Q_OS_LINUX
+    if (!p.direct) ::posix_fadvise(src.handle(), offset, bytes, POSIX_FADV_DONTNEED);
+#endif
+
+    CopyOptions o;
+    o.bufferCount = p.buffers;
+    o.directIo = p.direct;
+    o.bufferAlign = ph;
+    o.ioEngine = p.engine == "kernel" ? QString("sync") : p.engine;
+    o.queueDepth = p.queueDepth;
+    QString log, errors;
+    QTextStream quiet(&log), quietErr(&errors);
+    QElapsedTimer t; t.start();
+    const qint64 cpu0 = DiskIO::cpuTimeNs();
+    const bool ok = p.engine == "kernel" ? DiskIO::copyInKernel(src, dst, bytes, p.blockSize, l, false, quiet, quietErr, o)
+                                         : DiskIO::copyAlignedWithPadding(src, dst, bytes, p.blockSize, l, false, quiet, quietErr, o);
+    p.ns = t.nsecsElapsed();
+    p.cpuNs = DiskIO::cpuTimeNs() - cpu0;
+    p.bytes = dst.size();
+    dst.close();
+    QFile::remove(dstPath);
+    quietErr.flush();
+    if (!ok) { p.error = errors.trimmed(); return false; }
+    if (p.bytes == 0) { p.error = "нечего читать: смещение за концом"; return false; }
+    p.ok = true;
+    return true;
+}
+
+QVector<BenchPoint> DiskBench::sweep(const BenchPlan &plan, QTextStream &out) {
+    QVector<BenchPoint> pts;
+    for (int pass = 0; pass < 2; ++pass) {
+        const bool write = pass == 1;
+        if (write ? !plan.write : !plan.read) continue;
+        for (const QString &engine : plan.engines) {
+            // sync всегда держит один запрос
+            const QVector<int> depths = engine == "sync" ? QVector<int>{ 1 } : plan.queueDepths;
+            for (bool direct : plan.direct) {
+                for (qint64 bs : plan.blockSizes) {
+                    for (int nb : plan.buffers) {
+                        for (int qd : depths) {
+                            BenchPoint p;
+                            p.write = write;
+                            p.engine = engine;
+                            p.direct = direct;
+                            p.blockSize = bs;
+                            p.buffers = nb;
+                            p.queueDepth = qd;
+                            // Маленькие списки буферов при глубокой очереди дают одно и то же кольцо
+                            p.buffers = effectiveBuffers(p);
+                            const bool dup = std::any_of(pts.cbegin(), pts.cend(), [&](const BenchPoint &q) {
+                                return q.write == p.write && q.engine == p.engine && q.direct == p.direct && q.blockSize == p.blockSize
+                                    && q.buffers == p.buffers && q.queueDepth == p.queueDepth;
+                            });
+                            if (dup) continue;
+                            out << modeName(write) << ", " << describe(p) << ": " << Qt::flush;
+                            measure(plan.path, plan.offset, plan.bytes, p);
+                            out << speedText(p) << "\n" << Qt::flush;
+                            pts.push_back(p);
+                        }
+                    }
+                }
+            }
+        }
+    }
+    if (!plan.copyTo.isEmpty()) {
+        // Конвейер каждым движком против ядра, остальные параметры — первые из списков
+        QStringList engines = plan.engines;
+        engines << "kernel";
+        for (qint64 bs : plan.blockSizes) {
+            for (const QString &engine : engines) {
+                BenchPoint p;
+                p.copy = true;
+                p.engine = engine;
+                p.blockSize = bs;
+                p.buffers = plan.buffers.value(0, 4);
+                p.queueDepth = engine == "sync" || engine == "kernel" ? 1 : plan.queueDepths.value(0, 8);
+                p.buffers = effectiveBuffers(p);
+                out << modeName(p) << ", " << describe(p) << ": " << Qt::flush;
+                measureCopy(plan.path, plan.copyTo, plan.offset, plan.bytes, p);
+                out << speedText(p) << "\n" << Qt::flush;
+                pts.push_back(p);
+            }
+        }
+    }
+    return pts;
+}
+
+int DiskBench::best(const QVector<BenchPoint> &pts, bool write) {
+    int bi = -1;
+    for (int i = 0; i < pts.size(); ++i) {
+        if (!pts[i].ok || pts[i].copy || pts[i].write != write) continue;
+        if (bi < 0 || pts[i].mibPerSec() > pts[bi].mibPerSec()) bi = i;
+    }
+    return bi;
+}
+
+void DiskBench::printTable(const QVector<BenchPoint> &pts, QTextStream &out) {
+    const int bestRead = best(pts, false), bestWrite = best(pts, true);
+    out << QString("Режим").leftJustified(8) << QString("Движок").leftJustified(8) << QString("Кэш").leftJustified(8)
+        << QString("Блок").rightJustified(10) << QString("Буферов").rightJustified(9) << QString("Очередь").rightJustified(9)
+        << QString("MiB/s").rightJustified(10) << QString("ЦП с/ГиБ").rightJustified(10) << "\n";
+    for (int i = 0; i < pts.size(); ++i) {
+        const BenchPoint &p = pts[i];
+        out << QString(modeName(p)).leftJustified(8) << p.engine.leftJustified(8)
+            << QString(p.direct ? "direct" : "кэш").leftJustified(8)
+            << DiskIO::humanSize(quint64(p.blockSize)).rightJustified(10)
+            << QString::number(p.buffers).rightJustified(9) << QString::number(p.queueDepth).rightJustified(9);
+        if (p.ok) out << QString::number(p.mibPerSec(), 'f', 1).rightJustified(10) << QString::number(p.cpuSecPerGiB(), 'f', 2).rightJustified(10)
+                      << (i == bestRead || i == bestWrite ? " *" : "");
+        else      out << "  ошибка: " << p.error;
+        out << "\n";
+    }
+    for (int i : { bestRead, bestWrite }) {
+        if (i < 0) continue;
+        out << "Лучшее (" << modeName(pts[i].write) << "): " << describe(pts[i]) << " — " << speedText(pts[i]) << "\n";
+    }
+}
+
+static QJsonObject pointJson(const BenchPoint &p) {
+    QJsonObject o;
+    o["mode"] = p.copy ? "copy" : p.write ? "write" : "read";
+    o["engine"] = p.engine;
+    o["direct"] = p.direct;
+    o["blockSize"] = p.blockSize;
+    o["buffers"] = p.buffers;
+    o["queueDepth"] = p.queueDepth;
+    o["ok"] = p.ok;
+    o["bytes"] = p.bytes;
+    o["seconds"] = p.ns / 1e9;
+    o["mibPerSec"] = p.mibPerSec();
+    o["cpuSecPerGiB"] = p.cpuSecPerGiB();
+    if (!p.ok) o["error"] = p.error;
+    return o;
+}
+
+QByteArray DiskBench::toJson(const BenchPlan &plan, const QVector<BenchPoint> &pts) {
+    QJsonArray results;
+    for (const BenchPoint &p : pts) results.append(pointJson(p));
+    QJsonObject bestObj;
+    const int bestRead = best(pts, false), bestWrite = best(pts, true);
+    if (bestRead >= 0) bestObj["read"] = pointJson(pts[bestRead]);
+    if (bestWrite >= 0) bestObj["write"] = pointJson(pts[bestWrite]);
+    QJsonObject root;
+    root["path"] = plan.path;
+    root["offset"] = plan.offset;
+    root["bytesPerRun"] = plan.bytes;
+    if (!plan.copyTo.isEmpty()) root["copyTo"] = plan.copyTo;
+    root["results"] = results;
+    root["best"] = bestObj;
+    return QJsonDocument(root).toJson(QJsonDocument::Indented);
+}
+
+bool DiskBench::autoTune(const QString &path, bool write, qint64 offset, qint64 bytes, qint64 sector, const CopyOptions &opt,
+                         BenchPoint &best, QTextStream &out) {
+    static const qint64 sizes[] = { 64 * 1024, 256 * 1024, 1024 * 1024, 4 * 1024 * 1024, 16 * 1024 * 1024 };
+    // Глубину очереди подбираем только у движка, который её держит
+    QVector<int> depths{ opt.queueDepth };
+    if (opt.ioEngine != "sync") depths = { 1, 8, 32 };
+
+    out << "Подбор размера блока (" << modeName(write) << " по " << DiskIO::humanSize(quint64(bytes)) << " на замер):\n";
+    QVector<BenchPoint> pts;
+    for (qint64 bs : sizes) {
+        // Блок больше замера ничего не покажет
+        if (bs % sector || bs > bytes) continue;
+        for (int qd : depths) {
+            BenchPoint p;
+            p.write = write;
+            p.engine = opt.ioEngine;
+            p.direct = opt.directIo;
+            p.blockSize = bs;
+            p.buffers = opt.bufferCount;
+            p.queueDepth = qd;
+            out << "  " << describe(p) << ": " << Qt::flush;
+            measure(path, offset, bytes, p);
+            out << speedText(p) << "\n" << Qt::flush;
+            pts.push_back(p);
+        }
+    }
+    int bi = DiskBench::best(pts, write);
+    if (bi < 0) return false;
+    // Почти равные (в пределах 5%) — берём меньший блок: меньше памяти и чаще прогресс
+    for (int i = 0; i < pts.size(); ++i) {
+        if (pts[i].ok && pts[i].blockSize < pts[bi].blockSize && pts[i].mibPerSec() >= pts[bi].mibPerSec() * 0.95) { bi = i; break; }
+    }
+    best = pts[bi];
+    out << "Выбрано: " << describe(best) << " — " << speedText(best) << "\n";
+    return true;
+}
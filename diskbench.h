@@ -0,0 +1,67 @@
+#pragma once
+#include "diskio.h"
+#include <QByteArray>
+
+// Один замер: сколько байт прошло через конвейер копирования с этими параметрами и за сколько
+struct BenchPoint {
+    bool write = false;
+    bool copy = false;        // копирование диапазона в файл (BenchPlan::copyTo), а не чтение или запись
+    QString engine = "sync";  // "kernel" — копирование ядром (DiskIO::copyInKernel)
+    bool direct = false;
+    qint64 blockSize = 1048576;
+    int buffers = 4;
+    int queueDepth = 1;
+    // результат
+    bool ok = false;
+    qint64 bytes = 0;
+    qint64 ns = 0;
+    qint64 cpuNs = 0;         // процессорное время процесса за замер
+    QString error;
+
+    double mibPerSec() const { return ns > 0 ? bytes/1024.0/1024.0/(ns/1e9) : 0.0; }
+    double cpuSecPerGiB() const { return bytes > 0 ? cpuNs/1e9/(bytes/1073741824.0) : 0.0; }
+};
+
+// Что перебирать: все сочетания списков. Глубина очереди — только для движков с очередью (uring).
+struct BenchPlan {
+    QString path;             // устройство или рабочий файл
+    qint64 offset = 0;        // откуда на устройстве
+    qint64 bytes = 64 * 1024 * 1024;  // на один замер
+    bool read = true;
+    bool write = false;       // запись портит [offset, offset+bytes)
+    QString copyTo;           // не пусто — сравнить копирование диапазона в этот файл конвейером и ядром
+    QStringList engines;
+    QVector<qint64> blockSizes;
+    QVector<int> buffers;
+    QVector<int> queueDepths;
+    QVector<bool> direct;
+};
+
+// Замеры скорости чтения и записи через тот же конвейер, что и копирование (DiskIO::copyToMany):
+// при чтении вторая сторона — служебный движок "null", который ничего не пишет, при записи — ничего не читает.
+// Так измеряется ровно то, что получит настоящее копирование, включая сброс на носитель в конце записи.
+class DiskBench {
+public:
+    // Открыть path (без кэша, если p.direct), перед чтением мимо кэша вытеснить диапазон из кэша страниц,
+    // прогнать bytes байт с offset. Результат — в p.
+    static bool measure(const QString &path, qint64 offset, qint64 bytes, BenchPoint &p);
+
+    // Скопировать [offset, offset+bytes) path в файл dstPath (перезаписывается и удаляется):
+    // конвейером с движком p.engine или ядром, если p.engine == "kernel"
+    static bool measureCopy(const QString &path, const QString &dstPath, qint64 offset, qint64 bytes, BenchPoint &p);
+
+    // Все сочетания плана, по строке на замер в out по мере выполнения
+    static QVector<BenchPoint> sweep(const BenchPlan &plan, QTextStream &out);
+
+    // Индекс самого быстрого удачного замера чтения или записи (копирования не в счёт), -1 — таких нет
+    static int best(const QVector<BenchPoint> &pts, bool write);
+
+    static void printTable(const QVector<BenchPoint> &pts, QTextStream &out);
+    static QByteArray toJson(const BenchPlan &plan, const QVector<BenchPoint> &pts);
+
+    // Размер блока "auto": короткий перебор размеров блока (и глубины очереди для uring) при остальных
+    // параметрах из opt. Для записи — только по месту, которое всё равно будет перезаписано.
+    // false — ни один замер не удался, тогда best не меняется.
+    static bool autoTune(const QString &path, bool write, qint64 offset, qint64 bytes, qint64 sector, const CopyOptions &opt,
+                         BenchPoint &best, QTextStream &out);
+};
@@ -1,10 +1,26 @@
 #include "diskio.h"
+#include "alignedbuffer.h"
+#include "ioengine.h"
+#include "zeroblock.h"
+#include "usedblocks.h"
+#include "manifest.h"
+#include "streamhash.h"
+#include "checkpoint.h"
+#include "telemetry.h"
+#include "throttle.h"
 #include <QDir>
 #include <QElapsedTimer>
 #include <QByteArray>
 #include <QFileInfo>
+#include <QThread>
+#include <QSemaphore>
+#include <QAtomicInteger>
+#include <QMutex>
 #include <algorithm>
+#include <limits>
 #include <cstring>
+#include <vector>
+#include <memory>
 
 #ifdef Q_OS_WIN
 #  include <windows.h>
@@ -18,10 +34,16 @@
 #  include <fcntl.h>
 #  include <sys/stat.h>
 #  include <sys/types.h>
+#  include <sys/resource.h>
 #  include <errno.h>
 #  include <string.h>
 #endif
 
+#ifdef Q_OS_LINUX
+#  include <sys/ioctl.h>
+#  include <linux/fs.h>
+#endif
+
 QString DiskIO::humanSize(quint64 b) {
     const char* units[] = {"B","KiB","MiB","GiB","TiB"};
     int i=0; double v=b;
@@ -49,6 +71,21 @@ bool DiskIO::flushToDisk(QFile &f) {
 #endif
 }
 
+bool DiskIO::syncRange(QFile &f, qint64 offset, qint64 len, bool wait) {
+#ifdef Q_OS_LINUX
+    const int fd = f.handle();
+    if (fd < 0) return false;
+    // С ожиданием: дождаться уже идущей записи, записать остальное и дождаться его
+    const unsigned flags = wait ? SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER : SYNC_FILE_RANGE_WRITE;
+    int rc;
+    do { rc = ::sync_file_range(fd, offset, len, flags); } while (rc != 0 && errno == EINTR);
+    return rc == 0;
+#else
+    Q_UNUSED(offset); Q_UNUSED(len);
+    return !wait || flushToDisk(f);
+#endif
+}
+
 #ifdef Q_OS_UNIX
 static quint64 readFileULongLong(const QString &path) {
     QFile f(path);
@@ -58,6 +95,43 @@ static quint64 readFileULongLong(const QString &path) {
     quint64 v = s.toULongLong(&ok);
     return ok ? v : 0;
 }
+
+// Реальные размеры сектора блочного устройства (для обычных файлов ничего не меняет)
+static void querySectorSizes(int fd, quint32 &logical, quint32 &physical) {
+#ifdef Q_OS_LINUX
+    struct stat st{};
+    if (::fstat(fd, &st) != 0 || !S_ISBLK(st.st_mode)) return;
+    int lss = 0;
+    unsigned int pbs = 0;
+    if (::ioctl(fd, BLKSSZGET, &lss) == 0 && lss > 0) logical = quint32(lss);
+    if (::ioctl(fd, BLKPBSZGET, &pbs) == 0 && pbs > 0) physical = pbs;
+#else
+    Q_UNUSED(fd); Q_UNUSED(logical); Q_UNUSED(physical);
+#endif
+}
+
+// Открытие через свой дескриптор: в обход кэша страниц (direct) и/или с дополнительными флагами open()
+static bool openUnixFd(const QString &devicePath, int flags, bool direct, QFile &outFile, QIODevice::OpenMode mode, QString &diag) {
+#ifdef O_DIRECT
+    if (direct) flags |= O_DIRECT;
+#endif
+    int fd = ::open(devicePath.toLocal8Bit().constData(), flags | O_CLOEXEC);
+    if (fd < 0) {
+        int e = errno;
+        diag = QString::fromLocal8Bit(::strerror(e));
+        if (e == EINVAL && direct) diag += " (файловая система не поддерживает O_DIRECT)";
+        return false;
+    }
+#if !defined(O_DIRECT) && defined(F_NOCACHE)
+    if (direct) ::fcntl(fd, F_NOCACHE, 1);
+#endif
+    if (!outFile.open(fd, mode | QIODevice::Unbuffered, QFileDevice::AutoCloseHandle)) {
+        diag = QString("QFile::open(fd) не удалось: %1").arg(outFile.errorString());
+        ::close(fd);
+        return false;
+    }
+    return true;
+}
 #endif
 
 #ifdef Q_OS_WIN
@@ -201,13 +275,14 @@ QVector<DiskInfo> DiskIO::enumerate(QTextStream &err) {
     return out;
 }
 
-bool DiskIO::openWrite(const QString &devicePath, QFile &outFile, QString &diag, quint32 &logicalSector, quint32 &physicalSector) {
+bool DiskIO::openWrite(const QString &devicePath, QFile &outFile, QString &diag, quint32 &logicalSector, quint32 &physicalSector, bool direct,
+                       bool writeThrough) {
 #ifdef Q_OS_WIN
     HANDLE h = CreateFileW((LPCWSTR)devicePath.utf16(),
                            GENERIC_READ | GENERIC_WRITE,
                            FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
                            nullptr, OPEN_EXISTING,
-                           FILE_FLAG_WRITE_THROUGH, nullptr);
+                           (writeThrough ? FILE_FLAG_WRITE_THROUGH : 0) | (direct ? FILE_FLAG_NO_BUFFERING : 0), nullptr);
     if (h == INVALID_HANDLE_VALUE) {
         diag = sysErrorMessage(GetLastError());
         return false;
@@ -225,24 +300,30 @@ bool DiskIO::openWrite(const QString &devicePath, QFile &outFile, QString &diag,
     }
     return true;
 #else
-    Q_UNUSED(physicalSector);
-    Q_UNUSED(logicalSector);
-    outFile.setFileName(devicePath);
-    if (!outFile.open(QIODevice::WriteOnly | QIODevice::Unbuffered)) {
-        diag = outFile.errorString();
-        return false;
+    if (direct || writeThrough) {
+        if (!openUnixFd(devicePath, O_WRONLY | (writeThrough ? O_DSYNC : 0), direct, outFile, QIODevice::WriteOnly, diag)) return false;
+    } else {
+        // WriteOnly в QFile обрезает обычный файл, а он здесь — образ диска вместо устройства:
+        // запись со смещения или продолжение по журналу не должны терять остальное
+        const QIODevice::OpenMode mode = QFileInfo(devicePath).isFile() ? QIODevice::ReadWrite : QIODevice::WriteOnly;
+        outFile.setFileName(devicePath);
+        if (!outFile.open(mode | QIODevice::Unbuffered)) {
+            diag = outFile.errorString();
+            return false;
+        }
     }
+    querySectorSizes(outFile.handle(), logicalSector, physicalSector);
     return true;
 #endif
 }
 
-bool DiskIO::openRead(const QString &devicePath, QFile &outFile, QString &diag, quint32 &logicalSector, quint32 &physicalSector) {
+bool DiskIO::openRead(const QString &devicePath, QFile &outFile, QString &diag, quint32 &logicalSector, quint32 &physicalSector, bool direct) {
 #ifdef Q_OS_WIN
     HANDLE h = CreateFileW((LPCWSTR)devicePath.utf16(),
                            GENERIC_READ,
                            FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
                            nullptr, OPEN_EXISTING,
-                           FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+                           direct ? FILE_FLAG_NO_BUFFERING : FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
     if (h == INVALID_HANDLE_VALUE) {
         diag = sysErrorMessage(GetLastError());
         return false;
@@ -260,75 +341,1151 @@ bool DiskIO::openRead(const QString &devicePath, QFile &outFile, QString &diag,
     }
     return true;
 #else
-    Q_UNUSED(physicalSector);
-    Q_UNUSED(logicalSector);
-    outFile.setFileName(devicePath);
-    if (!outFile.open(QIODevice::ReadOnly | QIODevice::Unbuffered)) {
-        diag = outFile.errorString();
-        return false;
+    if (direct) {
+        if (!openUnixFd(devicePath, O_RDONLY, true, outFile, QIODevice::ReadOnly, diag)) return false;
+    } else {
+        outFile.setFileName(devicePath);
+        if (!outFile.open(QIODevice::ReadOnly | QIODevice::Unbuffered)) {
+            diag = outFile.errorString();
+            return false;
+        }
     }
+    querySectorSizes(outFile.handle(), logicalSector, physicalSector);
     return true;
 #endif
 }
 
-bool DiskIO::copyAlignedWithPadding(QFile &src, QFile &dst, qint64 totalTarget, qint64 blockSize, qint64 sectorAlign, bool padUp, QTextStream &out, QTextStream &err) {
-    QByteArray buf; buf.resize(int(blockSize));
+// Слот кольца буферов. Поля заполняет поток чтения, состояние записи у каждой стороны своё (WriteSide),
+// владение слотом передаётся через семафоры.
+struct RingSlot {
+    enum Kind { Data, Padded, Zeros, End, ReadError };
+    AlignedBuffer buf;
+    Kind kind = End;
+    qint64 len = 0;          // сколько байт отдать на запись
+    bool zero = false;       // блок из одних нулей (проверяется, только если включён SparseTarget)
+    bool unread = false;     // блок вне opt.readRanges: не читался, в буфере нули
+    bool same = false;       // на устройстве уже те же данные (opt.compareWith), писать не нужно
+    AlignedBuffer cur;       // текущее содержимое устройства для сравнения
+    QAtomicInt holders;      // сколько потребителей (стороны записи, хэширование) ещё держат отданный блок
+    // поток чтения
+    qint64 srcOff = 0;
+    qint64 want = 0;
+    qint64 rd = 0;           // байт или -код ошибки
+    bool readDone = false;
+    qint64 submitNs = 0;     // когда поставлен в очередь (для телеметрии)
+};
+
+// Сторона записи: у каждого назначения свой движок, своя очередь отданных читателем блоков
+// и своё состояние слотов кольца. Данные в буферах общие, слот освобождается последним потребителем.
+struct WriteSide {
+    struct SlotState {
+        qint64 dstOff = 0;
+        qint64 len = 0;                 // копия полей слота: после отцепления слот уже у читателя
+        RingSlot::Kind kind = RingSlot::Data;
+        qint64 written = 0;
+        bool done = false;
+        qint64 submitNs = 0;
+    };
+    CopyTarget *target = nullptr;
+    TelemetrySide *tel = nullptr;      // задержки записи и сброса этого назначения
+    std::unique_ptr<IoEngine> own;
+    IoEngine *engine = nullptr;
+    SparseTarget sparse;
+    QSemaphore ready;                  // блоки, отданные читателем этой стороне
+    std::vector<SlotState> st;
+    int fd = -1;
+    qint64 start = 0, pos = 0, zeroBytes = 0;
+    qint64 sameBytes = 0, sameBlocks = 0, writtenBlocks = 0;
+    QAtomicInteger<qint64> done, durable, stallNs, elapsedNs;
+    qint64 syncNs = 0, finalFlushNs = 0;   // ожидание записи на носитель по ходу и финальный сброс
+    QAtomicInt finished;
+    // Отцеплена (своим отказом или отставанием): блоки ей больше не отдаются. Под handMx вместе с released —
+    // сколько отданных ей блоков она уже отпустила.
+    QAtomicInt detached;
+    qint64 released = 0;
+    bool readFailed = false, failed = false, flushWarn = false, syncWarn = false;
+    RingSlot::Kind failedKind = RingSlot::Data;
+    QString diag;
+};
+
+static QString fmtSecs(qint64 ns) { return QString::number(ns/1e9, 'f', 1) + " с"; }
+static QString fmtSpeed(qint64 bytes, qint64 ns) {
+    return QString::number(ns>0 ? bytes/1024.0/1024.0/(ns/1e9) : 0.0, 'f', 2) + " MiB/s";
+}
+static QString durabilityName(const CopyOptions &opt) {
+    switch (opt.durability) {
+    case CopyOptions::Durability::Final:    return "сброс в конце";
+    case CopyOptions::Durability::Periodic: return "порциями по " + DiskIO::humanSize(quint64(opt.syncEvery));
+    default:                                return opt.writeThroughOpened ? "сквозная запись" : "сброс после каждого блока";
+    }
+}
+
+// Сброс на носитель с замером для телеметрии
+static bool timedFlush(QFile &f, TelemetrySide *tel) {
+    if (!tel) return DiskIO::flushToDisk(f);
+    QElapsedTimer t; t.start();
+    const bool ok = DiskIO::flushToDisk(f);
+    tel->flush.record(t.nsecsElapsed());
+    return ok;
+}
+
+static std::unique_ptr<IoEngine> makeEngine(const CopyOptions &opt, QTextStream &err) {
+    QString diag;
+    std::unique_ptr<IoEngine> e = IoEngine::create(opt.ioEngine, opt.queueDepth, diag);
+    if (!e) {
+        err << "Движок ввода-вывода '" << opt.ioEngine << "' недоступен (" << diag << "), используется sync.\n";
+        e = IoEngine::create("sync", 1, diag);
+    }
+    return e;
+}
+
+bool DiskIO::copyAlignedWithPadding(QFile &src, QFile &dst, qint64 totalTarget, qint64 blockSize, qint64 sectorAlign, bool padUp, QTextStream &out, QTextStream &err,
+                                    const CopyOptions &opt) {
+    QVector<CopyTarget> targets(1);
+    targets[0].file = &dst;
+    return copyToMany(src, targets, totalTarget, blockSize, sectorAlign, padUp, out, err, opt);
+}
+
+bool DiskIO::copyToMany(QFile &src, QVector<CopyTarget> &targets, qint64 totalTarget, qint64 blockSize, qint64 sectorAlign, bool padUp, QTextStream &out, QTextStream &err,
+                        const CopyOptions &opt) {
+    const int nw = targets.size();
+    if (nw == 0) return false;
+    const bool fanOut = nw > 1;
+
+    // У каждого потока свой движок: экземпляры не потокобезопасны.
+    // Готовый движок из opt (например, сжатый образ) подменяет обычный на своей стороне.
+    std::unique_ptr<IoEngine> ownRd;
+    IoEngine *rdEngine = opt.sourceEngine;
+    if (!rdEngine) { ownRd = makeEngine(opt, err); rdEngine = ownRd.get(); }
+    std::vector<std::unique_ptr<WriteSide>> sides;
+    for (CopyTarget &t : targets) {
+        sides.emplace_back(new WriteSide);
+        WriteSide &w = *sides.back();
+        w.target = &t;
+        w.engine = fanOut ? nullptr : opt.destEngine;
+        if (!w.engine) { w.own = makeEngine(opt, err); w.engine = w.own.get(); }
+        t.ok = false;
+        t.written = 0;
+        t.error.clear();
+    }
+    Telemetry *tel = opt.telemetry;
+    if (tel) {
+        QStringList names;
+        for (const CopyTarget &t : targets) names << t.name;
+        tel->begin(names);
+        for (int i=0;i<nw;++i) sides[i]->tel = &tel->target(i);
+    }
+    const int qdR = rdEngine->queueDepth();
+    int qdW = 1;
+    for (const auto &w : sides) qdW = std::max(qdW, w->engine->queueDepth());
+
+    // Чтобы обе стороны держали все свои запросы в полёте, буферов нужно хотя бы qdR+qdW.
+    // Буферы общие для всех устройств: быстрые обгоняют медленное не больше чем на кольцо.
+    const int nbuf = std::max({2, opt.bufferCount, qdR + qdW});
+    // Буферы выровнены по физическому сектору — годятся и для O_DIRECT
+    std::vector<RingSlot> ring(nbuf);
+    QVector<char*> bases;
+    for (RingSlot &s : ring) {
+        s.buf = AlignedBuffer(blockSize, opt.bufferAlign);
+        if (s.buf.isNull()) { err << "Не удалось выделить " << nbuf << " буферов по " << DiskIO::humanSize(blockSize) << ".\n"; return false; }
+        bases.push_back(s.buf.data());
+    }
+    // Сравнение перед записью: второй буфер на слот под текущее содержимое устройства
+    const int cmpFd = opt.compareWith && !fanOut ? opt.compareWith->handle() : -1;
+    if (cmpFd >= 0) {
+        for (RingSlot &s : ring) {
+            s.cur = AlignedBuffer(blockSize, opt.bufferAlign);
+            if (s.cur.isNull()) { err << "Не удалось выделить буферы сравнения по " << DiskIO::humanSize(blockSize) << ".\n"; return false; }
+        }
+    }
+    RingSlot *slots = ring.data();
+    {
+        QString diag;
+        bool fixed = qdR <= 1 || rdEngine->registerBuffers(bases, blockSize, diag);
+        for (const auto &w : sides) fixed = fixed && (w->engine->queueDepth() <= 1 || w->engine->registerBuffers(bases, blockSize, diag));
+        if (!fixed) err << "Буферы не зарегистрированы в движке (" << diag << "), работаем без fixed buffers.\n";
+    }
+
+    const int srcFd = src.handle();
+    const qint64 srcStart = src.pos();
+
+    bool detectZeros = false;
+    for (const auto &w : sides) {
+        w->fd = w->target->file->handle();
+        w->start = w->pos = w->target->file->pos();
+        w->st.resize(nbuf);
+        // Образ сам решает, как хранить нули
+        w->sparse.open(w->fd, opt.destEngine && !fanOut ? CopyOptions::ZeroBlocks::Write : opt.zeroBlocks);
+        detectZeros = detectZeros || w->sparse.enabled();
+    }
+
+    // freeSlots — сколько буферов может занять читатель; отданный блок ждёт в очереди ready каждой стороны записи
+    QSemaphore freeSlots(nbuf);
+    QAtomicInt stop(0);
+    QAtomicInt alive(nw);      // стороны записи, которые ещё пишут
+    QAtomicInt readerWaiting(0);  // читатель ждёт свободный буфер
+    // Передача блоков сторонам и их освобождение: отцепление стороны не должно разойтись с этим
+    QMutex handMx;
+    qint64 handed = 0;         // блоков данных отдано сторонам
+    QAtomicInteger<qint64> readStallNs(0), unreadBytes(0), compareNs(0), readThrottleNs(0), writeThrottleNs(0);
+    IoThrottle *throttle = opt.throttle;
+    // Ещё один потребитель кольца: хэширование идёт параллельно с записью
+    const bool hashing = opt.manifest || opt.streamHash;
+    QSemaphore hashSlots(0);
+    auto handOver = [&](RingSlot &s) {
+        QMutexLocker lock(&handMx);
+        int n = hashing ? 1 : 0;
+        for (const auto &w : sides) n += w->detached.loadRelaxed() ? 0 : 1;
+        s.holders.storeRelaxed(n);
+        if (s.kind != RingSlot::End && s.kind != RingSlot::ReadError) ++handed;
+        for (const auto &w : sides) {
+            if (!w->detached.loadRelaxed()) w->ready.release();
+        }
+        if (hashing) hashSlots.release();
+    };
+    auto stopAll = [&] {
+        // Разбудить всех, кто ждёт буфер или блок, и дать им завершиться
+        stop.storeRelease(1);
+        freeSlots.release(nbuf);
+        hashSlots.release();
+        for (const auto &w : sides) w->ready.release(nbuf);
+    };
+    // Сторона отпустила свой следующий блок; отцепленную уже отпустил detach
+    auto releaseNext = [&](WriteSide &ws) {
+        QMutexLocker lock(&handMx);
+        if (ws.detached.loadRelaxed()) return;
+        if (!slots[ws.released % nbuf].holders.deref()) freeSlots.release();
+        ++ws.released;
+    };
+    // Отцепить сторону: отпустить все отданные ей блоки, включая те, что она ещё пишет или не взяла из очереди.
+    // Новых блоков она не получает, её поток, проснувшись, завершается с ошибкой. Последняя — останавливает всех.
+    auto detach = [&](WriteSide &ws) {
+        bool last = false;
+        {
+            QMutexLocker lock(&handMx);
+            if (ws.detached.loadRelaxed()) return;
+            ws.detached.storeRelease(1);
+            for (; ws.released < handed; ++ws.released) {
+                if (!slots[ws.released % nbuf].holders.deref()) freeSlots.release();
+            }
+            last = alive.fetchAndAddOrdered(-1) == 1;
+        }
+        ws.ready.release();
+        if (last) stopAll();
+    };
+    QString readDiag;
+
+    // Поток чтения: держит до qdR чтений в полёте, а отдаёт блоки строго по порядку.
+    // Логика добивки та же, что при последовательном чтении: короткое чтение отменяет
+    // запросы после него, и следующее чтение идёт с позиции сразу за прочитанным.
+    QThread *reader = QThread::create([&] {
+        QVector<IoCompletion> comps;
+        QElapsedTimer w;
+        qint64 srcPos = srcStart;
+        qint64 assigned = 0;       // байт результата уже запрошено
+        qint64 queued = 0;         // байт результата отдано потоку записи
+        qint64 subSeq = 0, delSeq = 0;
+        int inFlight = 0, reserved = 0;
+
+        // Слот под следующий запрос: сначала уже занятые после отмены, потом из свободных
+        auto takeSlot = [&]() -> bool {
+            if (reserved > 0) { --reserved; return true; }
+            if (freeSlots.tryAcquire()) return true;
+            if (inFlight > 0 || delSeq < subSeq) return false;
+            w.start();
+            readerWaiting.storeRelease(1);
+            freeSlots.acquire();
+            readerWaiting.storeRelease(0);
+            const qint64 ns = w.nsecsElapsed();
+            readStallNs.fetchAndAddRelaxed(ns);
+            if (tel) tel->source().stalled(ns);
+            return true;
+        };
+        auto drain = [&] {
+            while (inFlight > 0) {
+                comps.clear();
+                if (!rdEngine->wait(comps, inFlight, readDiag)) return;
+                inFlight -= comps.size();
+            }
+        };
+        auto finish = [&](RingSlot &s, RingSlot::Kind kind) {
+            s.kind = kind;
+            drain();
+            handOver(s);
+        };
+
+        for (;;) {
+            while (inFlight < qdR && assigned < totalTarget) {
+                if (!takeSlot()) break;
+                if (stop.loadAcquire()) { drain(); return; }
+                RingSlot &s = slots[subSeq % nbuf];
+                s.want = std::min<qint64>(blockSize, totalTarget - assigned);
+                s.srcOff = srcPos;
+                s.readDone = false;
+                s.unread = !opt.readRanges.isEmpty() && !UsedBlocks::intersects(opt.readRanges, srcPos, s.want);
+                if (s.unread) {
+                    // Свободное место источника: не читаем, отдаём нули
+                    std::memset(s.buf.data(), 0, size_t(s.want));
+                    s.rd = s.want;
+                    s.readDone = true;
+                    unreadBytes.fetchAndAddRelaxed(s.want);
+                    srcPos += s.want; assigned += s.want;
+                    ++subSeq;
+                    continue;
+                }
+                if (throttle) readThrottleNs.fetchAndAddRelaxed(throttle->acquire(IoThrottle::Read, s.want));
+                IoRequest r;
+                r.fd = srcFd; r.buf = s.buf.data(); r.len = s.want; r.offset = srcPos;
+                r.bufIndex = int(subSeq % nbuf); r.tag = quint64(subSeq);
+                if (tel) s.submitNs = tel->now();
+                if (!rdEngine->submit(r)) {
+                    readDiag = "движок " + rdEngine->name() + " отклонил запрос чтения";
+                    finish(slots[delSeq % nbuf], RingSlot::ReadError);
+                    return;
+                }
+                srcPos += s.want; assigned += s.want;
+                ++subSeq; ++inFlight;
+            }
+
+            if (inFlight == 0 && delSeq == subSeq) {
+                // Всё запрошенное отдано — пометить конец
+                takeSlot();
+                if (stop.loadAcquire()) return;
+                finish(slots[subSeq % nbuf], RingSlot::End);
+                return;
+            }
+
+            comps.clear();
+            if (inFlight > 0 && !rdEngine->wait(comps, 1, readDiag)) {
+                finish(slots[delSeq % nbuf], RingSlot::ReadError);
+                return;
+            }
+            for (const IoCompletion &c : comps) {
+                RingSlot &s = slots[c.tag % nbuf];
+                s.rd = c.result;
+                s.readDone = true;
+                if (tel) tel->source().done(tel->now() - s.submitNs, c.result);
+                --inFlight;
+            }
+
+            while (delSeq < subSeq && slots[delSeq % nbuf].readDone) {
+                RingSlot &s = slots[delSeq % nbuf];
+                if (s.rd < 0) {
+                    readDiag = IoEngine::errorText(s.rd);
+                    finish(s, RingSlot::ReadError);
+                    return;
+                }
+                if (s.rd == 0 && !padUp) { finish(s, RingSlot::End); return; }
+                if (s.rd == 0) {
+                    std::memset(s.buf.data(), 0, int(s.want));
+                    s.kind = RingSlot::Zeros; s.len = s.want;
+                } else if (s.rd < s.want && padUp) {
+                    std::memset(s.buf.data()+s.rd, 0, int(s.want - s.rd));
+                    s.kind = RingSlot::Padded; s.len = s.want;
+                } else {
+                    s.kind = RingSlot::Data; s.len = s.rd;
+                }
+                s.zero = detectZeros && (s.kind == RingSlot::Zeros || s.unread || ZeroBlock::isAllZero(s.buf.constData(), s.len));
+                s.same = false;
+                if (cmpFd >= 0) {
+                    // Устройство читается здесь же, пока поток записи пишет предыдущие блоки.
+                    // Не прочиталось целиком — блок просто пишется.
+                    if (throttle) readThrottleNs.fetchAndAddRelaxed(throttle->acquire(IoThrottle::Read, s.len));
+                    w.start();
+                    IoRequest r;
+                    r.fd = cmpFd; r.buf = s.cur.data(); r.len = s.len; r.offset = sides[0]->start + queued;
+                    s.same = IoEngine::execute(r) == s.len && ZeroBlock::isEqual(s.buf.constData(), s.cur.constData(), s.len);
+                    compareNs.fetchAndAddRelaxed(w.nsecsElapsed());
+                }
+                queued += s.len;
+                const bool shortRead = s.rd > 0 && s.rd < s.want;
+                const qint64 resumeAt = s.srcOff + std::max<qint64>(s.rd, 0);
+                ++delSeq;
+                handOver(s);
+
+                if (shortRead && delSeq < subSeq) {
+                    // Запросы после короткого чтения шли не с той позиции — дождаться и переиспользовать слоты
+                    drain();
+                    reserved += int(subSeq - delSeq);
+                    subSeq = delSeq;
+                    srcPos = resumeAt;
+                    assigned = queued;
+                } else if (shortRead) {
+                    srcPos = resumeAt;
+                    assigned = queued;
+                }
+            }
+        }
+    });
+    reader->start();
+
+    qint64 hashNs = 0;
+    QThread *hasher = !hashing ? nullptr : QThread::create([&] {
+        QElapsedTimer busy;
+        for (qint64 seq=0;; ++seq) {
+            hashSlots.acquire();
+            if (stop.loadAcquire()) return;
+            RingSlot &s = slots[seq % nbuf];
+            if (s.kind == RingSlot::End || s.kind == RingSlot::ReadError) return;
+            busy.start();
+            if (opt.manifest) opt.manifest->feed(s.buf.constData(), s.len);
+            if (opt.streamHash) opt.streamHash->add(s.buf.constData(), s.len);
+            hashNs += busy.nsecsElapsed();
+            if (!s.holders.deref()) freeSlots.release();
+        }
+    });
+    if (hasher) hasher->start();
+
     QElapsedTimer t; t.start();
-    qint64 done=0;
-
-    while (done < totalTarget) {
-        qint64 remaining = totalTarget - done;
-        qint64 want = std::min<qint64>(buf.size(), remaining);
-
-        qint64 rd = src.read(buf.data(), want);
-        if (rd < 0) { err << "\nОшибка чтения источника.\n"; return false; }
-        if (rd == 0) {
-            if (padUp) {
-                std::memset(buf.data(), 0, int(want));
-                qint64 off=0;
-                while (off < want) {
-                    qint64 wr = dst.write(buf.constData()+off, want-off);
-                    if (wr <= 0) { err << "\nОшибка записи при добивке нулями: " << dst.errorString() << "\n"; return false; }
-                    off += wr;
+    // Со сбросом по ходу скорость считается по тому, что уже на носителе, — это скорость устройства, а не кэша
+    const bool writable = targets[0].file->openMode() & QIODevice::WriteOnly;
+    const bool syncing = writable && opt.durability != CopyOptions::Durability::Final;
+    auto printProgress = [&](qint64 done, qint64 durable, qint64 writeStallNs) {
+        double secs = t.elapsed()/1000.0;
+        double mb = (syncing ? durable : done)/1024.0/1024.0;
+        double spd = secs>0 ? mb/secs : 0.0;
+        out << "\rПередано: " << DiskIO::humanSize(done)
+            << " / " << DiskIO::humanSize(totalTarget);
+        if (syncing) out << ", на носителе " << DiskIO::humanSize(durable);
+        out << "  (" << QString::number(spd, 'f', 2) << " MiB/s"
+            << ", простой чтения " << fmtSecs(readStallNs.loadRelaxed())
+            << ", записи " << fmtSecs(writeStallNs) << ")" << Qt::flush;
+    };
+
+    // Одна сторона записи. При нескольких устройствах каждая работает в своём потоке;
+    // отказавшее устройство отцепляется и дальше только отпускает свои блоки, не задерживая остальных.
+    auto runWriter = [&](WriteSide &ws) {
+        IoEngine *wrEngine = ws.engine;
+        const int qd = wrEngine->queueDepth();
+        QElapsedTimer w;
+        QVector<IoCompletion> comps;
+        qint64 done=0, writeStallNs=0, checkpointed=0, shown=0;
+        qint64 subSeq=0, doneSeq=0;
+        int inFlight=0;
+        bool endSeen=false;
+        // На носителе — [0, durable), запись ядром запущена для [durable, kicked)
+        CopyOptions::Durability durability = writable ? opt.durability : CopyOptions::Durability::Final;
+        qint64 durable=0, kicked=0;
+        // Свой движок пишет по смещениям назначения; образ и хранилище — в свой файл, его и сбрасываем целиком
+        const bool rawOffsets = ws.own != nullptr;
+        QFile &dstFile = *ws.target->file;
+        // Отцеплена из-за отставания: блоки уже отпущены, дальше только дождаться своих запросов
+        auto lagged = [&]() -> bool {
+            if (ws.failed || !ws.detached.loadAcquire()) return false;
+            ws.failed = true;
+            ws.failedKind = RingSlot::Data;
+            ws.diag = "устройство отстало от остальных, читатель ждал буфер дольше " + fmtSecs(qint64(opt.lagTimeoutMs) * 1000000) + ", отцеплено";
+            return true;
+        };
+        auto syncWait = [&](qint64 from, qint64 to) -> bool {
+            QElapsedTimer st; st.start();
+            const bool ok = durability == CopyOptions::Durability::WriteThrough ? DiskIO::flushToDisk(dstFile)
+                          : rawOffsets ? DiskIO::syncRange(dstFile, ws.start + from, to - from, true)
+                                       : DiskIO::syncRange(dstFile, 0, 0, true);
+            const qint64 ns = st.nsecsElapsed();
+            ws.syncNs += ns;
+            if (ws.tel) ws.tel->flush.record(ns);
+            return ok;
+        };
+
+        for (;;) {
+            while (!endSeen && !ws.failed && inFlight < qd) {
+                if (!ws.ready.tryAcquire()) {
+                    // Сначала отдать уже записанные (и пропущенные) блоки, иначе читатель не получит буферов
+                    if (inFlight > 0 || doneSeq < subSeq) break;
+                    w.start();
+                    ws.ready.acquire();
+                    const qint64 ns = w.nsecsElapsed();
+                    writeStallNs += ns;
+                    ws.stallNs.storeRelaxed(writeStallNs);
+                    if (ws.tel) ws.tel->stalled(ns);
                 }
-                done += want;
-            } else {
-                break;
+                if (stop.loadAcquire()) { endSeen = true; break; }
+                if (lagged()) break;
+                RingSlot &s = slots[subSeq % nbuf];
+                WriteSide::SlotState &ss = ws.st[subSeq % nbuf];
+                if (s.kind == RingSlot::End) { endSeen = true; break; }
+                if (s.kind == RingSlot::ReadError) { endSeen = ws.readFailed = true; break; }
+                ss.dstOff = ws.pos; ss.len = s.len; ss.kind = s.kind; ss.written = 0; ss.done = false;
+                if (s.same) {
+                    // На устройстве уже то же самое
+                    ss.done = true;
+                    ws.sameBytes += s.len;
+                    ++ws.sameBlocks;
+                    ws.pos += s.len;
+                    ++subSeq;
+                    continue;
+                }
+                if (s.zero && ws.sparse.zeroRange(ws.pos, s.len)) {
+                    // Нули не пишем: дырка в файле или zeroout/discard на устройстве
+                    ss.done = true;
+                    ws.zeroBytes += s.len;
+                    ws.pos += s.len;
+                    ++subSeq;
+                    continue;
+                }
+                if (throttle) writeThrottleNs.fetchAndAddRelaxed(throttle->acquire(IoThrottle::Write, s.len));
+                IoRequest r;
+                r.fd = ws.fd; r.buf = s.buf.data(); r.len = ss.len; r.offset = ws.pos; r.write = true;
+                r.bufIndex = int(subSeq % nbuf); r.tag = quint64(subSeq);
+                if (ws.tel) ss.submitNs = tel->now();
+                if (!wrEngine->submit(r)) {
+                    ws.failed = true;
+                    ws.failedKind = s.kind;
+                    ws.diag = "движок " + wrEngine->name() + " отклонил запрос записи";
+                    ++subSeq;
+                    break;
+                }
+                ws.pos += s.len;
+                ++ws.writtenBlocks;
+                ++subSeq; ++inFlight;
             }
-        } else {
-            if (rd < want && padUp) {
-                std::memset(buf.data()+rd, 0, int(want - rd));
-                qint64 off=0;
-                while (off < want) {
-                    qint64 wr = dst.write(buf.constData()+off, want-off);
-                    if (wr <= 0) { err << "\nОшибка записи при копировании (добивка): " << dst.errorString() << "\n"; return false; }
-                    off += wr;
+            comps.clear();
+            if (inFlight > 0 && !wrEngine->wait(comps, 1, ws.diag)) {
+                // Завершений больше не дождаться: запросы брошены, буферы отпускаются остальным
+                ws.failed = true;
+                inFlight = 0;
+            }
+            // Буферы отцепленной стороны читатель уже переиспользует: не дописывать и не смотреть в слоты
+            lagged();
+            for (const IoCompletion &c : comps) {
+                RingSlot &s = slots[c.tag % nbuf];
+                WriteSide::SlotState &ss = ws.st[c.tag % nbuf];
+                if (c.result <= 0) {
+                    if (!ws.failed) {
+                        ws.failed = true;
+                        ws.failedKind = ss.kind;
+                        ws.diag = c.result < 0 ? IoEngine::errorText(c.result) : QString("записано 0 байт");
+                    }
+                    if (ws.tel) ws.tel->done(tel->now() - ss.submitNs, 0);
+                    ss.done = true;
+                    --inFlight;
+                    continue;
+                }
+                ss.written += c.result;
+                if (ss.written < ss.len && !ws.failed && !lagged()) {
+                    // Короткая запись — дописать остаток тем же слотом
+                    IoRequest r;
+                    r.fd = ws.fd; r.buf = s.buf.data()+ss.written; r.len = ss.len-ss.written; r.offset = ss.dstOff+ss.written; r.write = true;
+                    r.bufIndex = int(c.tag % nbuf); r.tag = c.tag;
+                    if (wrEngine->submit(r)) continue;
+                    ws.failed = true;
+                    ws.failedKind = ss.kind;
+                    ws.diag = "движок " + wrEngine->name() + " отклонил запрос записи";
+                }
+                // Задержка блока — от первой постановки до последней дописанной части
+                if (ws.tel) ws.tel->done(tel->now() - ss.submitNs, ss.written);
+                ss.done = true;
+                --inFlight;
+            }
+
+            while (doneSeq < subSeq && (ws.st[doneSeq % nbuf].done || (ws.failed && inFlight == 0))) {
+                if (!ws.failed) done += ws.st[doneSeq % nbuf].len;
+                ++doneSeq;
+                releaseNext(ws);
+
+                if (!ws.failed) ws.done.storeRelaxed(done);
+            }
+            if (!ws.failed && done > durable && durability != CopyOptions::Durability::Final) {
+                bool ok = true;
+                if (durability == CopyOptions::Durability::WriteThrough) {
+                    // Назначение со сквозной записью: завершённая запись уже на носителе
+                    if (!opt.writeThroughOpened) ok = syncWait(durable, done);
+                    if (ok) durable = done;
+                } else if (done - kicked >= opt.syncEvery) {
+                    // Запустить запись новой порции и дождаться предыдущей: грязных страниц в кэше
+                    // не больше двух порций, а финальный сброс не ждёт минутами
+                    ok = (rawOffsets ? DiskIO::syncRange(dstFile, ws.start + kicked, done - kicked, false) : DiskIO::syncRange(dstFile, 0, 0, false))
+                         && (kicked == durable || syncWait(durable, kicked));
+                    if (ok) { durable = kicked; kicked = done; }
                 }
-                done += want;
+                if (!ok) {
+                    // Сброс по ходу не поддерживается или не удался: остаётся финальный сброс, он и покажет ошибку
+                    ws.syncWarn = true;
+                    durability = CopyOptions::Durability::Final;
+                }
+                ws.durable.storeRelaxed(durable);
+            }
+            // После короткого чтения done уже не кратен блоку — считаем от прошлого показа
+            if (!fanOut && !ws.failed && done > shown && (done - shown >= blockSize*32 || done == totalTarget)) {
+                shown = done;
+                printProgress(done, durable, writeStallNs);
+            }
+            if (opt.checkpoint && !fanOut && !ws.failed && done - checkpointed >= opt.checkpointEvery) {
+                // В журнал — только то, что уже сброшено на носитель
+                QString cdiag;
+                checkpointed = done;
+                if (!timedFlush(*ws.target->file, ws.tel)) {
+                    err << "\nПредупреждение: не удалось сбросить буферы, отметка в журнале пропущена.\n";
+                } else {
+                    durable = kicked = done;
+                    ws.durable.storeRelaxed(done);
+                    if (!opt.checkpoint->commit(done, cdiag)) err << "\nПредупреждение: не записать журнал " << opt.checkpoint->path() << ": " << cdiag << "\n";
+                }
+            }
+            if (inFlight == 0 && (endSeen || ws.failed)) break;
+        }
+
+        // Завершение стороны здесь же, в её потоке: хвост образа, размер файла, сброс на носитель
+        CopyTarget &tg = *ws.target;
+        QFile &dst = *tg.file;
+        tg.written = done;
+        if (ws.failed) {
+            if (ws.failedKind == RingSlot::Zeros)       tg.error = "Ошибка записи при добивке нулями: " + ws.diag;
+            else if (ws.failedKind == RingSlot::Padded) tg.error = "Ошибка записи при копировании (добивка): " + ws.diag;
+            else                                        tg.error = "Ошибка записи при копировании: " + ws.diag;
+        } else if (ws.readFailed) {
+            // Источник не дочитан — сторону не завершаем
+        } else if (!wrEngine->finish(ws.diag)) {
+            tg.error = "Ошибка записи при завершении: " + ws.diag;
+        } else if (!ws.sparse.finish(dst, ws.pos)) {
+            tg.error = "Не удалось установить размер выходного файла: " + dst.errorString();
+        } else {
+            QElapsedTimer ft; ft.start();
+            ws.flushWarn = (dst.openMode() & QIODevice::WriteOnly) && !timedFlush(dst, ws.tel);
+            ws.finalFlushNs = ft.nsecsElapsed();
+            if (!ws.flushWarn) ws.durable.storeRelaxed(done);
+            tg.ok = true;
+        }
+        ws.elapsedNs.storeRelaxed(t.nsecsElapsed());
+
+        // Отцепиться: отпустить отданные блоки, новых не брать, пока остальные пишут
+        if (ws.failed && !endSeen) detach(ws);
+        ws.finished.storeRelease(1);
+    };
+
+    if (!fanOut) {
+        runWriter(*sides[0]);
+    } else {
+        std::vector<QThread*> writers;
+        for (const auto &w : sides) {
+            WriteSide *ws = w.get();
+            writers.push_back(QThread::create([&runWriter, ws] { runWriter(*ws); }));
+            writers.back()->start();
+        }
+        // Ход по каждому устройству; медленное видно сразу
+        QElapsedTimer tick; tick.start();
+        const qint64 lagNs = qint64(opt.lagTimeoutMs) * 1000000;
+        qint64 waitSince = -1;
+        for (;;) {
+            bool all = true;
+            for (const auto &w : sides) all = all && (w->finished.loadAcquire() || w->detached.loadAcquire());
+            if (all) break;
+            QThread::msleep(100);
+            // Читатель долго ждёт буфер, а все буферы держит сторона, отставшая от остальных, — отцепить её.
+            // Если отстают все одинаково (медленный источник или общая шина), ждём дальше.
+            if (lagNs > 0 && readerWaiting.loadAcquire()) {
+                if (waitSince < 0) waitSince = t.nsecsElapsed();
             } else {
-                qint64 off=0;
-                while (off < rd) {
-                    qint64 wr = dst.write(buf.constData()+off, rd-off);
-                    if (wr <= 0) { err << "\nОшибка записи при копировании: " << dst.errorString() << "\n"; return false; }
-                    off += wr;
+                waitSince = -1;
+            }
+            if (waitSince >= 0 && t.nsecsElapsed() - waitSince >= lagNs) {
+                waitSince = -1;
+                std::vector<WriteSide*> behind;
+                {
+                    QMutexLocker lock(&handMx);
+                    qint64 lo = std::numeric_limits<qint64>::max(), hi = -1;
+                    for (const auto &w : sides) {
+                        if (w->detached.loadRelaxed()) continue;
+                        lo = std::min(lo, w->released);
+                        hi = std::max(hi, w->released);
+                    }
+                    for (const auto &w : sides) {
+                        if (!w->detached.loadRelaxed() && w->released == lo && lo < hi) behind.push_back(w.get());
+                    }
+                }
+                for (WriteSide *w : behind) {
+                    out << "\n" << w->target->name << ": отстаёт от остальных, читатель ждал буфер дольше " << fmtSecs(lagNs)
+                        << " — устройство отцеплено.\n" << Qt::flush;
+                    detach(*w);
                 }
-                done += rd;
             }
+            if (tick.elapsed() < 5000) continue;
+            tick.restart();
+            const qint64 ns = t.nsecsElapsed();
+            out << "Передано за " << fmtSecs(ns) << ":\n";
+            for (int i=0;i<nw;++i) {
+                const WriteSide &w = *sides[i];
+                out << " [" << i << "] " << w.target->name << ": ";
+                const qint64 d = w.done.loadRelaxed(), dd = w.durable.loadRelaxed();
+                out << DiskIO::humanSize(d) << " / " << DiskIO::humanSize(totalTarget);
+                if (syncing) out << ", на носителе " << DiskIO::humanSize(dd);
+                out << "  (" << fmtSpeed(syncing ? dd : d, w.finished.loadAcquire() ? w.elapsedNs.loadRelaxed() : ns)
+                    << ", простой записи " << fmtSecs(w.stallNs.loadRelaxed()) << ")\n";
+            }
+            out << Qt::flush;
         }
+        for (size_t i=0;i<writers.size();++i) {
+            // Отцепленное за отставание может ещё висеть в записи: остальные уже записаны и сброшены
+            if (!sides[i]->finished.loadAcquire()) out << "Ожидание завершения записи на отцепленное " << sides[i]->target->name << "...\n" << Qt::flush;
+            writers[i]->wait();
+            delete writers[i];
+        }
+    }
+
+    bool readFailed = false;
+    for (const auto &w : sides) readFailed = readFailed || w->readFailed;
+    if (readFailed) stopAll();
+    reader->wait();
+    delete reader;
+    if (hasher) {
+        hasher->wait();
+        delete hasher;
+    }
+
+    if (readFailed) {
+        err << "\nОшибка чтения источника" << (readDiag.isEmpty() ? QString(".") : ": " + readDiag) << "\n";
+        return false;
+    }
 
-        if ((done % (blockSize*32)) == 0 || done == totalTarget) {
-            double secs = t.elapsed()/1000.0;
-            double mb = done/1024.0/1024.0;
-            double spd = secs>0 ? mb/secs : 0.0;
-            out << "\rПередано: " << DiskIO::humanSize(done)
-                << " / " << DiskIO::humanSize(totalTarget)
-                << "  (" << QString::number(spd, 'f', 2) << " MiB/s)" << Qt::flush;
+    if (opt.manifest) opt.manifest->finish();
+    for (const auto &w : sides) {
+        if (w->syncWarn) err << "\nПредупреждение: " << (fanOut ? w->target->name + ": " : QString()) << "сброс на носитель по ходу не удался, данные сброшены только в конце.\n";
+        if (w->flushWarn) err << "\nПредупреждение: " << (fanOut ? w->target->name + ": " : QString()) << "не удалось гарантированно сбросить буферы на устройство.\n";
+        if (w->sparse.discardFellBack()) err << "\nПредупреждение: " << (fanOut ? w->target->name + ": " : QString())
+                                             << "устройство не гарантирует нули после discard, нулевые блоки обнулены через BLKZEROOUT.\n";
+    }
+    if (!fanOut && !targets[0].ok) {
+        err << "\n" << targets[0].error << "\n";
+        return false;
+    }
+
+    const WriteSide &w0 = *sides[0];
+    bool allOk = true;
+    if (!fanOut) {
+        out << "\nГотово. Итого: " << DiskIO::humanSize(targets[0].written) << "\n";
+        // Время — до конца финального сброса: скорость записи на носитель, а не в кэш
+        if (writable) out << "На носителе (" << durabilityName(opt) << "): " << fmtSpeed(targets[0].written, w0.elapsedNs.loadRelaxed())
+            << " с учётом сброса, ожидание записи по ходу " << fmtSecs(w0.syncNs) << ", финальный сброс " << fmtSecs(w0.finalFlushNs) << "\n";
+    } else {
+        out << "\nГотово:\n";
+        for (int i=0;i<nw;++i) {
+            const WriteSide &w = *sides[i];
+            const CopyTarget &tg = targets[i];
+            out << " [" << i << "] " << tg.name << ": " << DiskIO::humanSize(tg.written);
+            if (!tg.ok) {
+                out << ", ОШИБКА\n";
+                err << tg.name << ": " << tg.error << "\n";
+                allOk = false;
+                continue;
+            }
+            out << " за " << fmtSecs(w.elapsedNs.loadRelaxed()) << " (" << fmtSpeed(tg.written, w.elapsedNs.loadRelaxed())
+                << ", простой записи " << fmtSecs(w.stallNs.loadRelaxed());
+            if (w.sparse.enabled()) out << ", нулей не записано " << DiskIO::humanSize(w.zeroBytes);
+            out << ")\n";
         }
     }
+    if (!fanOut && w0.sparse.enabled()) {
+        out << "Нулевые блоки: " << DiskIO::humanSize(w0.zeroBytes) << " не записано ("
+            << (w0.sparse.isFile() ? "дырки в файле" : "zeroout/discard/пропуск на устройстве")
+            << ", проверка " << ZeroBlock::simdName() << ")\n";
+    }
+    if (cmpFd >= 0) {
+        out << "Сравнение с устройством: записано блоков " << w0.writtenBlocks << " (" << DiskIO::humanSize(targets[0].written - w0.sameBytes - w0.zeroBytes)
+            << "), без изменений " << w0.sameBlocks << " (" << DiskIO::humanSize(w0.sameBytes) << "), чтение и сравнение "
+            << fmtSecs(compareNs.loadRelaxed()) << " (" << ZeroBlock::simdName() << ")\n";
+    }
+    if (hashing) {
+        out << "Хэширование в отдельном потоке: " << fmtSecs(hashNs) << "\n";
+    }
+    if (!opt.readRanges.isEmpty()) {
+        out << "Не прочитано (свободное место источника): " << DiskIO::humanSize(unreadBytes.loadRelaxed()) << "\n";
+    }
+    if (throttle) {
+        out << "Ограничение скорости (" << throttle->describe() << "): чтение ждало " << fmtSecs(readThrottleNs.loadRelaxed())
+            << ", запись " << fmtSecs(writeThrottleNs.loadRelaxed()) << "\n";
+    }
+    out << "Простой: чтение ждало запись " << fmtSecs(readStallNs.loadRelaxed());
+    if (!fanOut) out << ", запись ждала чтение " << fmtSecs(w0.stallNs.loadRelaxed());
+    out << " (движок " << rdEngine->name();
+    if (w0.engine->name() != rdEngine->name()) out << "/" << w0.engine->name();
+    out << ", глубина очереди " << qdR;
+    if (qdW != qdR) out << "/" << qdW;
+    out << ", буферов " << nbuf;
+    if (fanOut) out << ", устройств " << nw;
+    out << ")\n";
+    if (tel) tel->printSummary(out);
+    return allOk;
+}
+
+bool DiskIO::copyStriped(QFile &src, QFile &dst, qint64 totalTarget, qint64 blockSize, bool padUp, QTextStream &out, QTextStream &err,
+                         const CopyOptions &opt) {
+    const int nthreads = std::max(1, opt.stripes);
+    // Полоса — целое число блоков, чтобы границы запросов совпадали с однопоточным копированием
+    const qint64 stripe = std::max<qint64>(1, opt.stripeSize / blockSize) * blockSize;
+    const qint64 nstripes = (totalTarget + stripe - 1) / stripe;
+    const int srcFd = src.handle(), dstFd = dst.handle();
+    const qint64 srcStart = src.pos(), dstStart = dst.pos();
 
-    if (!DiskIO::flushToDisk(dst)) {
+    SparseTarget sparse;
+    sparse.open(dstFd, opt.zeroBlocks);
+    QMutex sparseLock;           // SparseTarget может переключиться на обычную запись — не из двух потоков сразу
+
+    QAtomicInteger<qint64> nextStripe(0), done(0), durable(0), zeroBytes(0), unreadBytes(0);
+    // Сброс по ходу — после каждой полосы (полосы завершаются не по порядку, на носителе — их сумма)
+    const bool syncing = (dst.openMode() & QIODevice::WriteOnly) && opt.durability != CopyOptions::Durability::Final;
+    QAtomicInt syncFailed(0);
+    // Linux: sync_file_range только по своей полосе, потоки сбрасывают параллельно.
+    // Вне Linux сброс — flushToDisk через общий QFile, по одному.
+#ifdef Q_OS_LINUX
+    QMutex *syncLock = nullptr;
+#else
+    QMutex syncMutex;
+    QMutex *syncLock = &syncMutex;
+#endif
+    QAtomicInteger<qint64> srcEnd(std::numeric_limits<qint64>::max());   // где источник кончился раньше totalTarget
+    QAtomicInteger<qint64> dstEnd(0);
+    QAtomicInt stop(0);
+    QMutex diagLock;
+    QString failDiag;
+    auto fail = [&](const QString &what) {
+        QMutexLocker lock(&diagLock);
+        if (failDiag.isEmpty()) failDiag = what;
+        stop.storeRelease(1);
+    };
+    auto raiseTo = [](QAtomicInteger<qint64> &a, qint64 v) {
+        for (qint64 cur = a.loadRelaxed(); v > cur && !a.testAndSetOrdered(cur, v); cur = a.loadRelaxed()) {}
+    };
+    auto lowerTo = [](QAtomicInteger<qint64> &a, qint64 v) {
+        for (qint64 cur = a.loadRelaxed(); v < cur && !a.testAndSetOrdered(cur, v); cur = a.loadRelaxed()) {}
+    };
+
+    Telemetry *tel = opt.telemetry;
+    if (tel) tel->begin(QStringList{ QString() });
+
+    // Каждый поток берёт следующую полосу и копирует её блоками позиционными pread/pwrite
+    auto worker = [&] {
+        AlignedBuffer buf(blockSize, opt.bufferAlign);
+        if (buf.isNull()) { fail("не удалось выделить буфер " + DiskIO::humanSize(blockSize)); return; }
+        for (;;) {
+            const qint64 si = nextStripe.fetchAndAddRelaxed(1);
+            if (si >= nstripes || stop.loadAcquire()) return;
+            const qint64 sEnd = std::min(totalTarget, (si + 1) * stripe);
+            qint64 stripeLen = 0;
+            for (qint64 off = si * stripe; off < sEnd && !stop.loadAcquire(); off += blockSize) {
+                const qint64 want = std::min(blockSize, sEnd - off);
+                if (!padUp && off >= srcEnd.loadAcquire()) break;
+                qint64 got = 0;
+                if (!opt.readRanges.isEmpty() && !UsedBlocks::intersects(opt.readRanges, srcStart + off, want)) {
+                    // Свободное место источника: не читаем, отдаём нули
+                    std::memset(buf.data(), 0, size_t(want));
+                    unreadBytes.fetchAndAddRelaxed(want);
+                    got = want;
+                }
+                if (opt.throttle && got < want) opt.throttle->acquire(IoThrottle::Read, want);
+                while (got < want) {
+                    IoRequest r;
+                    r.fd = srcFd; r.buf = buf.data() + got; r.len = want - got; r.offset = srcStart + off + got;
+                    const qint64 t0 = tel ? tel->now() : 0;
+                    const qint64 n = IoEngine::execute(r);
+                    if (tel) tel->source().done(tel->now() - t0, n);
+                    if (n < 0) { fail("ошибка чтения источника на смещении " + QString::number(r.offset) + ": " + IoEngine::errorText(n)); return; }
+                    if (n == 0) { lowerTo(srcEnd, off + got); break; }
+                    got += n;
+                }
+                qint64 len = got;
+                if (got < want && padUp) {
+                    std::memset(buf.data() + got, 0, size_t(want - got));
+                    len = want;
+                }
+                if (len == 0) break;
+                bool zeroed = false;
+                if (sparse.enabled() && ZeroBlock::isAllZero(buf.constData(), len)) {
+                    QMutexLocker lock(&sparseLock);
+                    zeroed = sparse.zeroRange(dstStart + off, len);
+                }
+                if (zeroed) {
+                    zeroBytes.fetchAndAddRelaxed(len);
+                } else {
+                    if (opt.throttle) opt.throttle->acquire(IoThrottle::Write, len);
+                    for (qint64 put = 0; put < len; ) {
+                        IoRequest r;
+                        r.fd = dstFd; r.buf = buf.data() + put; r.len = len - put; r.offset = dstStart + off + put; r.write = true;
+                        const qint64 t0 = tel ? tel->now() : 0;
+                        const qint64 n = IoEngine::execute(r);
+                        if (tel) tel->target(0).done(tel->now() - t0, n);
+                        if (n <= 0) { fail("ошибка записи на смещении " + QString::number(r.offset) + ": " + (n < 0 ? IoEngine::errorText(n) : QString("записано 0 байт"))); return; }
+                        put += n;
+                    }
+                }
+                raiseTo(dstEnd, dstStart + off + len);
+                done.fetchAndAddRelaxed(len);
+                stripeLen += len;
+                if (len < want) break;
+            }
+            if (syncing && stripeLen > 0 && !stop.loadAcquire() && !syncFailed.loadRelaxed()) {
+                bool ok = opt.writeThroughOpened && opt.durability == CopyOptions::Durability::WriteThrough;
+                if (!ok) {
+                    const qint64 t0 = tel ? tel->now() : 0;
+                    QMutexLocker lock(syncLock);
+                    ok = DiskIO::syncRange(dst, dstStart + si * stripe, stripeLen, true);
+                    if (tel) tel->target(0).flush.record(tel->now() - t0);
+                }
+                if (ok) durable.fetchAndAddRelaxed(stripeLen);
+                else syncFailed.storeRelaxed(1);
+            }
+        }
+    };
+
+    QElapsedTimer t; t.start();
+    std::vector<QThread*> workers;
+    for (int i=0; i<nthreads; ++i) {
+        workers.push_back(QThread::create(worker));
+        workers.back()->start();
+    }
+    const qint64 expected = padUp ? totalTarget : -1;
+    for (bool running = true; running; ) {
+        QThread::msleep(200);
+        running = false;
+        for (QThread *th : workers) running = running || !th->isFinished();
+        const qint64 d = done.loadRelaxed();
+        const double secs = t.elapsed()/1000.0;
+        const qint64 dd = durable.loadRelaxed();
+        out << "\rПередано: " << DiskIO::humanSize(d);
+        if (expected > 0) out << " / " << DiskIO::humanSize(expected);
+        if (syncing) out << ", на носителе " << DiskIO::humanSize(dd);
+        out << "  (" << QString::number(secs>0 ? (syncing ? dd : d)/1024.0/1024.0/secs : 0.0, 'f', 2) << " MiB/s)" << Qt::flush;
+    }
+    for (QThread *th : workers) {
+        th->wait();
+        delete th;
+    }
+
+    if (!failDiag.isEmpty()) {
+        err << "\nОшибка при копировании полосами: " << failDiag << "\n";
+        return false;
+    }
+    if (!sparse.finish(dst, dstEnd.loadRelaxed())) {
+        err << "\nНе удалось установить размер выходного файла: " << dst.errorString() << "\n";
+        return false;
+    }
+    if (syncFailed.loadRelaxed()) err << "\nПредупреждение: сброс на носитель по ходу не удался, данные сброшены только в конце.\n";
+    if ((dst.openMode() & QIODevice::WriteOnly) && !timedFlush(dst, tel ? &tel->target(0) : nullptr)) {
+        err << "\nПредупреждение: не удалось гарантированно сбросить буферы на устройство.\n";
+    }
+    out << "\nГотово. Итого: " << DiskIO::humanSize(done.loadRelaxed()) << "\n";
+    if (dst.openMode() & QIODevice::WriteOnly) {
+        const bool perStripe = syncing && !(opt.writeThroughOpened && opt.durability == CopyOptions::Durability::WriteThrough);
+        out << "На носителе (" << (perStripe ? QString("сброс после каждой полосы") : durabilityName(opt)) << "): "
+            << fmtSpeed(done.loadRelaxed(), t.nsecsElapsed()) << " с учётом сброса\n";
+    }
+    if (sparse.enabled()) {
+        out << "Нулевые блоки: " << DiskIO::humanSize(zeroBytes.loadRelaxed()) << " не записано ("
+            << (sparse.isFile() ? "дырки в файле" : "zeroout/discard/пропуск на устройстве")
+            << ", проверка " << ZeroBlock::simdName() << ")\n";
+        if (sparse.discardFellBack()) err << "Предупреждение: устройство не гарантирует нули после discard, нулевые блоки обнулены через BLKZEROOUT.\n";
+    }
+    if (!opt.readRanges.isEmpty()) {
+        out << "Не прочитано (свободное место источника): " << DiskIO::humanSize(unreadBytes.loadRelaxed()) << "\n";
+    }
+    out << "Полосы: " << nstripes << " по " << DiskIO::humanSize(stripe) << ", потоков " << nthreads << "\n";
+    if (tel) tel->printSummary(out);
+    return true;
+}
+
+qint64 DiskIO::cpuTimeNs() {
+#ifdef Q_OS_WIN
+    FILETIME created, exited, kernel, user;
+    if (!GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel, &user)) return 0;
+    auto ticks = [](const FILETIME &f) { return (qint64(f.dwHighDateTime) << 32) | f.dwLowDateTime; };
+    return (ticks(kernel) + ticks(user)) * 100;
+#else
+    struct rusage ru;
+    if (::getrusage(RUSAGE_SELF, &ru) != 0) return 0;
+    return (qint64(ru.ru_utime.tv_sec) + ru.ru_stime.tv_sec) * 1000000000LL + (qint64(ru.ru_utime.tv_usec) + ru.ru_stime.tv_usec) * 1000;
+#endif
+}
+
+bool DiskIO::copyInKernel(QFile &src, QFile &dst, qint64 totalTarget, qint64 blockSize, qint64 sectorAlign, bool padUp,
+                          QTextStream &out, QTextStream &err, const CopyOptions &opt) {
+#ifdef Q_OS_LINUX
+    const int srcFd = src.handle(), dstFd = dst.handle();
+    const qint64 srcStart = src.pos(), dstStart = dst.pos();
+    // С дописыванием нулями ядру отдаются только целые блоки источника, хвост дописывает конвейер
+    qint64 kernelBytes = totalTarget;
+    if (padUp) kernelBytes = std::min(totalTarget, std::max<qint64>(0, src.size() - srcStart)) / blockSize * blockSize;
+
+    Telemetry *tel = opt.telemetry;
+    if (tel) tel->begin(QStringList{ dst.fileName() });
+    enum { CopyRange, Splice, Unsupported } method = CopyRange;
+    const char *methodName[] = { "copy_file_range", "splice" };
+    QString why;                 // почему ядро не справилось и дальше идёт конвейер
+    int pipeFd[2] = { -1, -1 };
+    qint64 done = 0, shown = 0;
+    bool eof = false;
+    // Сохранность по ходу, как в конвейере: на носителе [0, durable), запись запущена для [durable, kicked)
+    const bool syncing = (dst.openMode() & QIODevice::WriteOnly) && opt.durability != CopyOptions::Durability::Final;
+    const bool perCall = opt.durability == CopyOptions::Durability::WriteThrough;
+    qint64 durable = 0, kicked = 0, syncNs = 0;
+    bool syncFailed = false;
+    QElapsedTimer t; t.start();
+    const qint64 cpu0 = cpuTimeNs();
+    auto ioFailed = [](const char *what, qint64 off) {
+        return QString("ошибка %1 на смещении %2: %3").arg(what).arg(off).arg(QString::fromLocal8Bit(strerror(errno)));
+    };
+
+    while (done < kernelBytes && method != Unsupported) {
+        const size_t want = size_t(std::min(blockSize, kernelBytes - done));
+        loff_t so = srcStart + done, doff = dstStart + done;
+        if (opt.throttle) {
+            // Ядро и читает, и пишет за один вызов
+            opt.throttle->acquire(IoThrottle::Read, qint64(want));
+            opt.throttle->acquire(IoThrottle::Write, qint64(want));
+        }
+        const qint64 t0 = tel ? tel->now() : 0;
+        qint64 n = 0;
+        if (method == CopyRange) {
+            n = ::copy_file_range(srcFd, &so, dstFd, &doff, want, 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP || errno == EBADF)) {
+                // Не обычные файлы (устройство) или разные ФС на старом ядре — через канал
+                method = Splice;
+                continue;
+            }
+            if (n < 0) { err << "\nОшибка копирования ядром: " << ioFailed("copy_file_range", so) << "\n"; break; }
+        } else {
+            if (pipeFd[0] < 0) {
+                if (::pipe2(pipeFd, O_CLOEXEC) != 0) { why = ioFailed("pipe2", 0); method = Unsupported; break; }
+                // Больше канал — меньше вызовов; сверх /proc/sys/fs/pipe-max-size не дадут, тогда остаётся как есть
+                ::fcntl(pipeFd[1], F_SETPIPE_SZ, int(std::min<qint64>(blockSize, 1 << 30)));
+            }
+            n = ::splice(srcFd, &so, pipeFd[1], nullptr, want, SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && errno == EINVAL) { why = ioFailed("splice", so); method = Unsupported; break; }
+            if (n < 0) { err << "\nОшибка копирования ядром: " << ioFailed("splice", so) << "\n"; break; }
+            qint64 put = 0;
+            while (put < n) {
+                const qint64 m = ::splice(pipeFd[0], nullptr, dstFd, &doff, size_t(n - put), SPLICE_F_MOVE | SPLICE_F_MORE);
+                if (m < 0 && errno == EINTR) continue;
+                if (m <= 0) break;
+                put += m;
+            }
+            if (put < n) {
+                // Недописанное осталось в канале: канал закрывается, эти байты источника перечитает конвейер
+                const bool unsupported = errno == EINVAL;
+                if (unsupported) why = ioFailed("splice", doff);
+                else err << "\nОшибка копирования ядром: " << ioFailed("splice", doff) << "\n";
+                done += put;
+                if (tel) tel->target(0).done(tel->now() - t0, put);
+                if (unsupported) method = Unsupported;
+                else n = -1;
+                break;
+            }
+        }
+        if (n == 0) { eof = true; break; }
+        done += n;
+        if (tel) {
+            // Одна операция и читает, и пишет
+            const qint64 ns = tel->now() - t0;
+            tel->source().done(ns, n);
+            tel->target(0).done(ns, n);
+        }
+        if (syncing && !syncFailed) {
+            if (perCall && opt.writeThroughOpened) {
+                durable = done;
+            } else if (perCall || done - kicked >= opt.syncEvery) {
+                const qint64 s0 = t.nsecsElapsed();
+                // Сквозная запись без O_DSYNC — дождаться только что переданного; иначе запустить новую порцию и дождаться предыдущей
+                const qint64 waitTo = perCall ? done : kicked;
+                bool ok = perCall || DiskIO::syncRange(dst, dstStart + kicked, done - kicked, false);
+                if (ok && waitTo > durable) ok = DiskIO::syncRange(dst, dstStart + durable, waitTo - durable, true);
+                syncNs += t.nsecsElapsed() - s0;
+                if (tel) tel->target(0).flush.record(t.nsecsElapsed() - s0);
+                if (ok) { durable = waitTo; kicked = done; }
+                else syncFailed = true;
+            }
+        }
+        if (done - shown >= blockSize * 32 || done == kernelBytes) {
+            shown = done;
+            const double secs = t.elapsed()/1000.0;
+            out << "\rПередано: " << DiskIO::humanSize(done);
+            if (padUp) out << " / " << DiskIO::humanSize(totalTarget);
+            if (syncing) out << ", на носителе " << DiskIO::humanSize(durable);
+            out << "  (" << QString::number(secs>0 ? (syncing ? durable : done)/1024.0/1024.0/secs : 0.0, 'f', 2) << " MiB/s, " << methodName[method] << ")" << Qt::flush;
+        }
+    }
+    if (pipeFd[0] >= 0) { ::close(pipeFd[0]); ::close(pipeFd[1]); }
+    const qint64 ns = t.nsecsElapsed(), cpuNs = cpuTimeNs() - cpu0;
+    if (done < kernelBytes && method != Unsupported && !eof) return false;
+
+    const qint64 kernelDone = done;
+    if (syncFailed) err << "\nПредупреждение: сброс на носитель по ходу не удался, данные сброшены только в конце.\n";
+    if (!why.isEmpty()) out << "\nЯдро не передаёт эти данные (" << why << "), дальше обычным конвейером.\n";
+    if (!eof && done < totalTarget) {
+        // Хвост с дописыванием нулями или то, что ядро не взяло, — обычным конвейером с того же места
+        if (!src.seek(srcStart + done) || !dst.seek(dstStart + done)) { err << "\nНе удалось перейти к смещению " << done << " для конвейера.\n"; return false; }
+        CopyOptions rest = opt;
+        // Телеметрия уже собрана по работе ядра, конвейер начал бы её заново
+        if (kernelDone > 0) rest.telemetry = nullptr;
+        QVector<CopyTarget> targets(1);
+        targets[0].file = &dst;
+        // Отчёт конвейера о хвосте не нужен, итог печатается ниже
+        QString log;
+        QTextStream quiet(&log);
+        const bool ok = copyToMany(src, targets, totalTarget - done, blockSize, sectorAlign, padUp, kernelDone > 0 ? quiet : out, err, rest);
+        done += targets[0].written;
+        if (!ok) return false;
+    } else if ((dst.openMode() & QIODevice::WriteOnly) && !timedFlush(dst, tel ? &tel->target(0) : nullptr)) {
         err << "\nПредупреждение: не удалось гарантированно сбросить буферы на устройство.\n";
     }
+    // Если ядро ничего не передало, отчёт уже напечатал конвейер
+    if (kernelDone == 0 && done > 0) return true;
     out << "\nГотово. Итого: " << DiskIO::humanSize(done) << "\n";
+    if (kernelDone > 0) out << "Ядром (" << methodName[method == Unsupported ? Splice : method] << "): " << DiskIO::humanSize(kernelDone) << " за " << fmtSecs(ns)
+        << " (" << fmtSpeed(kernelDone, ns) << "), время ЦП " << QString::number(cpuNs/1e9, 'f', 2) << " с ("
+        << QString::number(cpuNs/1e9/(kernelDone/1073741824.0), 'f', 2) << " с на ГиБ)\n";
+    if (kernelDone > 0 && syncing) out << "На носителе (" << durabilityName(opt) << "): ожидание записи по ходу " << fmtSecs(syncNs) << "\n";
+    if (done > kernelDone) out << "Конвейером: " << DiskIO::humanSize(done - kernelDone) << "\n";
+    if (tel) tel->printSummary(out);
+    return true;
+#else
+    return copyAlignedWithPadding(src, dst, totalTarget, blockSize, sectorAlign, padUp, out, err, opt);
+#endif
+}
+
+bool DiskIO::verifyWritten(const QString &devicePath, qint64 offset, qint64 total, qint64 sectorAlign, const BlockManifest &expected,
+                           QTextStream &out, QTextStream &err, const CopyOptions &opt) {
+    // Всегда мимо кэша: иначе прочитаем то, что ещё лежит в памяти, а не на носителе
+    QFile dev;
+    QString diag;
+    quint32 l=0, p=0;
+    if (!DiskIO::openRead(devicePath, dev, diag, l, p, true)) {
+        err << "Проверка: не открыть устройство для чтения. " << diag << "\n";
+        return false;
+    }
+    if (offset>0 && !dev.seek(offset)) { err << "Проверка: не удалось перейти на смещение " << offset << ".\n"; return false; }
+
+    std::unique_ptr<IoEngine> sink = IoEngine::create("null", 1, diag);
+    BlockManifest actual(expected.blockSize());
+    CopyOptions vopt;
+    vopt.bufferCount = opt.bufferCount;
+    vopt.directIo = true;
+    vopt.bufferAlign = std::max<quint32>(p, opt.bufferAlign);
+    vopt.ioEngine = opt.ioEngine;
+    vopt.queueDepth = opt.queueDepth;
+    vopt.destEngine = sink.get();
+    vopt.manifest = &actual;
+    vopt.throttle = opt.throttle;
+
+    out << "\nПроверка записанного (чтение мимо кэша)...\n";
+    if (!copyAlignedWithPadding(dev, dev, total, expected.blockSize(), sectorAlign, false, out, err, vopt)) return false;
+
+    const qint64 bs = expected.blockSize();
+    qint64 bad = 0;
+    const int n = std::max(expected.count(), actual.count());
+    for (int i=0; i<n; ++i) {
+        if (i < expected.count() && i < actual.count() && expected.hash(i) == actual.hash(i)) continue;
+        if (bad < 20) {
+            err << "Несовпадение: блок " << i << ", смещение на устройстве " << (offset + i*bs)
+                << ", длина " << std::min(bs, total - i*bs) << "\n";
+        }
+        ++bad;
+    }
+    if (bad > 20) err << "... и ещё " << (bad - 20) << " блоков\n";
+    if (bad > 0 || actual.totalSize() != expected.totalSize()) {
+        err << "Проверка НЕ пройдена: " << bad << " из " << n << " блоков отличаются.\n";
+        return false;
+    }
+    out << "Проверка пройдена: " << n << " блоков по " << DiskIO::humanSize(bs) << " совпадают.\n";
     return true;
 }
@@ -3,6 +3,14 @@
 #include <QVector>
 #include <QFile>
 #include <QTextStream>
+#include <QStringList>
+
+class IoEngine;
+class BlockManifest;
+class StreamHash;
+class Checkpoint;
+class Telemetry;
+class IoThrottle;
 
 struct DiskInfo {
     QString path;
@@ -13,18 +21,152 @@ struct DiskInfo {
     quint32 physicalSector = 512;
 };
 
+// Диапазон байт [offset, offset+length)
+struct ByteRange {
+    qint64 offset = 0;
+    qint64 length = 0;
+};
+
+// Параметры конвейера копирования (задаются из командной строки)
+struct CopyOptions {
+    // Что делать с блоками из одних нулей на стороне записи
+    enum class ZeroBlocks {
+        Write,     // писать как есть
+        Skip,      // не писать: в файле — дырка, на устройстве остаётся старое содержимое
+        ZeroOut,   // устройство: BLKZEROOUT; файл: дырка
+        Discard    // устройство: discard, если оно гарантирует нули после него (fallocate PUNCH_HOLE), иначе BLKZEROOUT; файл: дырка
+    };
+    // Когда записанное попадает на носитель
+    enum class Durability {
+        Final,         // один сброс на носитель в конце
+        Periodic,      // каждые syncEvery байт запустить запись порции ядром и дождаться предыдущей (sync_file_range)
+        WriteThrough   // каждая запись синхронная: назначение открыто со сквозной записью, иначе сброс после каждого блока
+    };
+
+    int bufferCount = 4;      // буферов в кольце между потоком чтения и потоком записи, >= 2
+    bool directIo = false;    // открывать устройство мимо кэша (O_DIRECT / FILE_FLAG_NO_BUFFERING)
+    quint32 bufferAlign = 4096; // выравнивание буферов; после открытия устройства — его физический сектор
+    QString ioEngine = "sync";  // движок ввода-вывода: sync или uring (см. IoEngine::available())
+    int queueDepth = 8;         // запросов в полёте на каждую сторону (для sync всегда 1)
+    ZeroBlocks zeroBlocks = ZeroBlocks::Write;
+    Durability durability = Durability::Periodic;
+    qint64 syncEvery = 64 * 1024 * 1024;  // порция для Periodic
+    bool writeThroughOpened = false;      // назначения открыты DiskIO::openWrite(..., writeThrough): сбрасывать после блока не нужно
+    QString compress;           // чтение в сжатый образ RWI: "zstd[:уровень]", "lz4", "zlib"; пусто — сырой образ
+    int threads = 4;            // потоков сжатия/распаковки образа RWI и загрузки чанков хранилища
+    QString chunkStore;         // каталог хранилища чанков: образ — рецепт из ссылок на чанки (см. ChunkStore)
+    QString chunking = "cdc:1048576"; // нарезка на чанки при чтении в хранилище: fixed:размер или cdc:средний размер
+    // Читать только эти диапазоны источника (абсолютные смещения, см. UsedBlocks).
+    // Блоки целиком вне диапазонов не читаются и отдаются на запись как нули. Пусто — читать всё.
+    QVector<ByteRange> readRanges;
+    bool usedOnly = false;      // заполнить readRanges по разделам и битмапам ФС источника
+    // Запись части образа: раздел из его таблицы разделов (номер по UsedBlocks::partitions) или диапазон байт образа.
+    // Чтение начинается сразу с этого места; -1 / длина 0 — весь образ.
+    int sourcePart = -1;
+    ByteRange sourceRange;
+    QString manifestPath;       // сохранить манифест XXH64 переданных данных
+    QString baseManifestPath;   // чтение: писать дельта-образ относительно образа с этим манифестом
+    QStringList deltas;         // запись: дельта-образы поверх входного образа, по порядку
+    QString hashAlgo;           // сумма всего потока: "sha256" или "xxh64"; пусто — не считать
+    bool verify = false;        // запись: перечитать записанное мимо кэша и сравнить поблочные хэши
+    int stripes = 0;            // > 1 — копировать полосами в столько потоков (DiskIO::copyStriped)
+    qint64 stripeSize = 64 * 1024 * 1024; // размер полосы, округляется вниз до целого числа блоков
+    bool zeroCopy = false;      // копировать средствами ядра, без буферов в памяти процесса (DiskIO::copyInKernel)
+    bool skipSame = false;      // запись: сначала читать устройство и не писать блоки, которые уже совпадают (ключ --skip-same)
+    // Запись на несколько устройств: если отставшее держит все буферы кольца и читатель ждёт дольше этого,
+    // устройство отцепляется с ошибкой, остальные пишут дальше. 0 — ждать сколько угодно.
+    int lagTimeoutMs = 30000;
+    QString rescueMap;          // чтение: спасение проходами с картой в этом файле (см. Rescue)
+    int rescueRetries = 1;      // сколько раз перечитывать плохие сектора
+    int rescueSlowMs = 1000;    // блок, читавшийся дольше, на первом проходе считается плохим местом; 0 — не следить
+    // Готовые движки вместо opt.ioEngine (не владеет), например образ RWI на одной из сторон
+    IoEngine *sourceEngine = nullptr;
+    IoEngine *destEngine = nullptr;
+    // Назначение, открытое на чтение (не владеет): поток чтения читает те же блоки устройства
+    // и сравнивает с источником, совпавшие не пишутся. Только при одном назначении.
+    QFile *compareWith = nullptr;
+    // Хэши переданных данных (не владеет). Считаются в отдельном потоке параллельно с записью:
+    // буфер возвращается читателю, когда его и записали, и захэшировали.
+    BlockManifest *manifest = nullptr;    // XXH64 по сетке его blockSize
+    StreamHash *streamHash = nullptr;     // сумма всего потока
+    // Журнал возобновления (не владеет): каждые checkpointEvery байт запись сбрасывается на носитель
+    // и в журнал попадает, сколько уже точно записано. Только при одном назначении.
+    Checkpoint *checkpoint = nullptr;
+    qint64 checkpointEvery = qint64(1024) * 1024 * 1024;
+    QString checkpointPath;     // файл журнала (ключ --checkpoint)
+    bool resume = false;        // продолжить задание из журнала
+    // Телеметрия (не владеет): задержки каждого чтения, записи и сброса, простой сторон
+    Telemetry *telemetry = nullptr;
+    // Ограничение скорости (не владеет): каждое чтение и каждая запись берут токены из его корзин
+    IoThrottle *throttle = nullptr;
+};
+
+// Назначение при записи одного источника сразу на несколько устройств
+struct CopyTarget {
+    QFile *file = nullptr;   // открыт и спозиционирован вызывающим
+    QString name;            // для отчёта
+    // результат
+    bool ok = false;
+    qint64 written = 0;
+    QString error;
+};
+
 class DiskIO {
 public:
     static QVector<DiskInfo> enumerate(QTextStream &err);
     static QString humanSize(quint64 b);
 
     // Открытие устройства для записи/чтения (raw). На Windows — CreateFileW + wrap в QFile.
-    static bool openWrite(const QString &devicePath, QFile &outFile, QString &diag, quint32 &logicalSector, quint32 &physicalSector);
-    static bool openRead (const QString &devicePath, QFile &outFile, QString &diag, quint32 &logicalSector, quint32 &physicalSector);
+    // direct — без кэша ОС: O_DIRECT на Linux, F_NOCACHE на macOS, FILE_FLAG_NO_BUFFERING на Windows.
+    // Тогда буферы, длины и смещения должны быть кратны сектору.
+    // writeThrough — сквозная запись: O_DSYNC / FILE_FLAG_WRITE_THROUGH, запись завершается, когда данные на носителе.
+    // Обычный файл (образ диска на месте устройства) не обрезается ни в одном режиме, как и устройство.
+    static bool openWrite(const QString &devicePath, QFile &outFile, QString &diag, quint32 &logicalSector, quint32 &physicalSector, bool direct = false,
+                          bool writeThrough = false);
+    static bool openRead (const QString &devicePath, QFile &outFile, QString &diag, quint32 &logicalSector, quint32 &physicalSector, bool direct = false);
 
     // Принудительный сброс буферов на устройство
     static bool flushToDisk(QFile &f);
+    // Записать на носитель [offset, offset+len) (len 0 — до конца файла); wait=false — только запустить запись.
+    // Linux: sync_file_range — без метаданных и без сброса кэша самого диска (это flushToDisk в конце).
+    // В других ОС: wait — flushToDisk, без wait — ничего.
+    static bool syncRange(QFile &f, qint64 offset, qint64 len, bool wait);
+
+    // Копирование с выравниванием и дописыванием нулями (на write-пути).
+    // Чтение и запись идут в отдельных потоках через кольцо из opt.bufferCount буферов,
+    // каждая сторона держит до opt.queueDepth позиционных запросов через движок opt.ioEngine.
+    static bool copyAlignedWithPadding(QFile &src, QFile &dst, qint64 totalTarget, qint64 blockSize, qint64 sectorAlign, bool padUp, QTextStream &out, QTextStream &err,
+                                       const CopyOptions &opt = CopyOptions());
+
+    // То же для нескольких назначений: источник читается один раз в общее кольцо буферов,
+    // на каждое назначение пишет свой поток со своим движком. Отказ одного устройства
+    // не останавливает остальные. Медленное отстаёт не больше чем на кольцо буферов, а если
+    // из-за него читатель ждёт буфер дольше opt.lagTimeoutMs, оно отцепляется с ошибкой.
+    // Результат по каждому — в targets; true, если записаны все. opt.destEngine — только при одном назначении.
+    static bool copyToMany(QFile &src, QVector<CopyTarget> &targets, qint64 totalTarget, qint64 blockSize, qint64 sectorAlign, bool padUp, QTextStream &out, QTextStream &err,
+                           const CopyOptions &opt = CopyOptions());
+
+    // Копирование полосами: [0, totalTarget) режется на полосы по opt.stripeSize, opt.stripes потоков
+    // копируют их позиционными pread/pwrite на те же смещения назначения (от src.pos()/dst.pos()).
+    // Результат тот же, что у copyAlignedWithPadding. Без образов RWI, хэшей и нескольких назначений:
+    // им нужен порядок блоков. totalTarget должен быть конечным.
+    static bool copyStriped(QFile &src, QFile &dst, qint64 totalTarget, qint64 blockSize, bool padUp, QTextStream &out, QTextStream &err,
+                            const CopyOptions &opt = CopyOptions());
+
+    // Копирование без участия процесса в переносе данных (Linux): copy_file_range между обычными файлами,
+    // иначе splice через канал (устройство <-> файл). Данные не попадают в память процесса и не проверяются,
+    // поэтому только сырой образ без хэшей, сжатия и пропуска нулей. Хвост с дописыванием нулями и всё,
+    // что ядро не смогло передать (например, O_DIRECT), идёт обычным конвейером (copyAlignedWithPadding)
+    // с того же места. На других ОС — сразу конвейер. Результат тот же, что у copyAlignedWithPadding.
+    static bool copyInKernel(QFile &src, QFile &dst, qint64 totalTarget, qint64 blockSize, qint64 sectorAlign, bool padUp,
+                             QTextStream &out, QTextStream &err, const CopyOptions &opt = CopyOptions());
+
+    // Процессорное время процесса (пользовательское + системное), нс; 0 — не удалось узнать
+    static qint64 cpuTimeNs();
 
-    // Копирование с выравниванием и дописыванием нулями (на write-пути)
-    static bool copyAlignedWithPadding(QFile &src, QFile &dst, qint64 totalTarget, qint64 blockSize, qint64 sectorAlign, bool padUp, QTextStream &out, QTextStream &err);
+    // Проверка после записи: перечитать [offset, offset+total) устройства мимо кэша ОС
+    // и сравнить XXH64 каждого блока с expected (манифест того, что записывали).
+    // Несовпавшие блоки печатаются в err; false — если они есть или чтение не удалось.
+    static bool verifyWritten(const QString &devicePath, qint64 offset, qint64 total, qint64 sectorAlign, const BlockManifest &expected,
+                              QTextStream &out, QTextStream &err, const CopyOptions &opt = CopyOptions());
 };
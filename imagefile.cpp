@@ -0,0 +1,493 @@
+#include "imagefile.h"
+#include "zeroblock.h"
+#include "manifest.h"
+#include <QtEndian>
+#include <QStringList>
+#include <algorithm>
+#include <cstring>
+
+#ifdef Q_OS_WIN
+#  include <windows.h>
+#else
+#  include <errno.h>
+#endif
+
+#ifdef RAWWRITER_HAVE_ZSTD
+#  include <zstd.h>
+#endif
+#ifdef RAWWRITER_HAVE_LZ4
+#  include <lz4.h>
+#  include <lz4hc.h>
+#endif
+
+static const char kHeaderMagic[8] = {'R','W','I','M','A','G','E','1'};
+static const char kFooterMagic[8] = {'R','W','I','N','D','E','X','1'};
+static const int kHeaderSize = 32;
+static const int kFooterSize = 32;
+static const int kEntrySize = 32;
+static const quint32 kVersion = 1;
+
+// Код ошибки для повреждённого образа в том же виде, что и ошибки ОС (см. IoEngine::errorText)
+#ifdef Q_OS_WIN
+static const qint64 kCorrupt = -qint64(ERROR_INVALID_DATA);
+#else
+static const qint64 kCorrupt = -qint64(EIO);
+#endif
+
+static qint64 readAt(int fd, char *buf, qint64 len, qint64 off) {
+    qint64 done=0;
+    while (done < len) {
+        IoRequest r;
+        r.fd = fd; r.buf = buf+done; r.len = len-done; r.offset = off+done;
+        qint64 n = IoEngine::execute(r);
+        if (n < 0) return n;
+        if (n == 0) break;
+        done += n;
+    }
+    return done;
+}
+
+static qint64 writeAt(int fd, const char *buf, qint64 len, qint64 off) {
+    qint64 done=0;
+    while (done < len) {
+        IoRequest r;
+        r.fd = fd; r.buf = const_cast<char*>(buf)+done; r.len = len-done; r.offset = off+done; r.write = true;
+        qint64 n = IoEngine::execute(r);
+        if (n <= 0) return n < 0 ? n : kCorrupt;
+        done += n;
+    }
+    return done;
+}
+
+// Сжать блок; если выигрыша нет — сохранить как есть
+static quint32 compressChunk(const char *src, qint64 n, int codec, int level, QByteArray &out) {
+    switch (codec) {
+#ifdef RAWWRITER_HAVE_ZSTD
+    case ImageFile::Zstd: {
+        out.resize(int(ZSTD_compressBound(size_t(n))));
+        size_t r = ZSTD_compress(out.data(), size_t(out.size()), src, size_t(n), level);
+        if (ZSTD_isError(r) || qint64(r) >= n) break;
+        out.resize(int(r));
+        return ImageFile::Zstd;
+    }
+#endif
+#ifdef RAWWRITER_HAVE_LZ4
+    case ImageFile::Lz4: {
+        out.resize(LZ4_compressBound(int(n)));
+        int r = level > 1 ? LZ4_compress_HC(src, out.data(), int(n), out.size(), level)
+                          : LZ4_compress_default(src, out.data(), int(n), out.size());
+        if (r <= 0 || r >= n) break;
+        out.resize(r);
+        return ImageFile::Lz4;
+    }
+#endif
+    case ImageFile::Zlib: {
+        QByteArray z = qCompress(reinterpret_cast<const uchar*>(src), int(n), level);
+        if (z.isEmpty() || z.size() >= n) break;
+        out = z;
+        return ImageFile::Zlib;
+    }
+    default:
+        break;
+    }
+    out = QByteArray(src, int(n));
+    return ImageFile::Stored;
+}
+
+static bool codecSupported(quint32 codec) {
+    switch (codec) {
+    case ImageFile::Stored:
+    case ImageFile::Zlib:
+    case ImageFile::Zeros:
+        return true;
+#ifdef RAWWRITER_HAVE_ZSTD
+    case ImageFile::Zstd:
+        return true;
+#endif
+#ifdef RAWWRITER_HAVE_LZ4
+    case ImageFile::Lz4:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+static bool decompressChunk(const char *src, qint64 n, quint32 codec, char *dst, qint64 rawSize) {
+    switch (codec) {
+    case ImageFile::Stored:
+        if (n != rawSize) return false;
+        std::memcpy(dst, src, size_t(n));
+        return true;
+    case ImageFile::Zeros:
+        std::memset(dst, 0, size_t(rawSize));
+        return n == 0;
+#ifdef RAWWRITER_HAVE_ZSTD
+    case ImageFile::Zstd: {
+        size_t r = ZSTD_decompress(dst, size_t(rawSize), src, size_t(n));
+        return !ZSTD_isError(r) && qint64(r) == rawSize;
+    }
+#endif
+#ifdef RAWWRITER_HAVE_LZ4
+    case ImageFile::Lz4:
+        return LZ4_decompress_safe(src, dst, int(n), int(rawSize)) == rawSize;
+#endif
+    case ImageFile::Zlib: {
+        QByteArray r = qUncompress(reinterpret_cast<const uchar*>(src), int(n));
+        if (r.size() != rawSize) return false;
+        std::memcpy(dst, r.constData(), size_t(rawSize));
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+bool ImageFile::parseCodec(const QString &spec, int &codec, int &level, QString &diag) {
+    const QString name = spec.section(':', 0, 0).trimmed().toLower();
+    const QString lvl = spec.section(':', 1, 1).trimmed();
+    int minLevel = 1, maxLevel = 1;
+    if (name == "zstd")      { codec = Zstd; level = 3; maxLevel = 19; }
+    else if (name == "lz4")  { codec = Lz4;  level = 1; maxLevel = 12; }
+    else if (name == "zlib") { codec = Zlib; level = 6; maxLevel = 9; }
+    else { diag = QString("неизвестный кодек '%1'").arg(name); return false; }
+    if (!availableCodecs().contains(name)) { diag = QString("кодек %1 недоступен в этой сборке").arg(name); return false; }
+    if (!lvl.isEmpty()) {
+        bool ok=false;
+        level = lvl.toInt(&ok);
+        if (!ok || level < minLevel || level > maxLevel) {
+            diag = QString("уровень %1 для %2 должен быть от %3 до %4").arg(lvl, name).arg(minLevel).arg(maxLevel);
+            return false;
+        }
+    }
+    return true;
+}
+
+QString ImageFile::codecName(int codec) {
+    switch (codec) {
+    case Stored: return "none";
+    case Zstd:   return "zstd";
+    case Lz4:    return "lz4";
+    case Zlib:   return "zlib";
+    case Zeros:  return "zero";
+    default:     return QString("#%1").arg(codec);
+    }
+}
+
+QStringList ImageFile::availableCodecs() {
+    QStringList l;
+#ifdef RAWWRITER_HAVE_ZSTD
+    l << "zstd";
+#endif
+#ifdef RAWWRITER_HAVE_LZ4
+    l << "lz4";
+#endif
+    l << "zlib";
+    return l;
+}
+
+quint32 ImageFile::compressBlock(const char *src, qint64 n, int codec, int level, QByteArray &out) {
+    return compressChunk(src, n, codec, level, out);
+}
+
+bool ImageFile::decompressBlock(const char *src, qint64 n, quint32 codec, char *dst, qint64 rawSize) {
+    return codecSupported(codec) && decompressChunk(src, n, codec, dst, rawSize);
+}
+
+bool ImageFile::probe(QFile &f, qint64 &rawSize, int &codec) {
+    const qint64 size = f.size();
+    if (size < kHeaderSize + kFooterSize) return false;
+    char head[kHeaderSize], foot[kFooterSize];
+    if (readAt(f.handle(), head, kHeaderSize, 0) != kHeaderSize) return false;
+    if (readAt(f.handle(), foot, kFooterSize, size - kFooterSize) != kFooterSize) return false;
+    if (std::memcmp(head, kHeaderMagic, 8) != 0 || std::memcmp(foot, kFooterMagic, 8) != 0) return false;
+    codec = int(qFromLittleEndian<quint32>(head + 12));
+    rawSize = qint64(qFromLittleEndian<quint64>(foot + 24));
+    return true;
+}
+
+// ---------- запись ----------
+
+ImageWriterEngine::ImageWriterEngine(QFile &file, int codec, int level, int threads)
+    : m_file(file), m_codec(codec), m_level(level), m_threads(std::max(1, threads)) {
+    m_pool.setMaxThreadCount(m_threads);
+}
+
+ImageWriterEngine::~ImageWriterEngine() {
+    m_pool.waitForDone();
+}
+
+QString ImageWriterEngine::name() const {
+    return "rwi-" + ImageFile::codecName(m_codec);
+}
+
+bool ImageWriterEngine::begin(quint32 chunkSize, QString &diag) {
+    char head[kHeaderSize] = {};
+    std::memcpy(head, kHeaderMagic, 8);
+    qToLittleEndian<quint32>(kVersion, head + 8);
+    qToLittleEndian<quint32>(quint32(m_codec), head + 12);
+    qToLittleEndian<quint32>(chunkSize, head + 16);
+    qToLittleEndian<quint32>(m_base ? quint32(ImageFile::Delta) : 0u, head + 20);
+    qint64 r = writeAt(m_file.handle(), head, kHeaderSize, 0);
+    if (r < 0) { diag = IoEngine::errorText(r); return false; }
+    m_filePos = kHeaderSize;
+    return true;
+}
+
+bool ImageWriterEngine::submit(const IoRequest &r) {
+    QMutexLocker lock(&m_mutex);
+    if (r.offset < m_lastEnd) return false;
+    m_lastEnd = r.offset + r.len;
+    const quint64 seq = m_nextSeq++;
+    Job &j = m_jobs[seq];
+    j.rawOffset = r.offset;
+    j.rawSize = r.len;
+    ++m_inFlight;
+    lock.unlock();
+
+    const char *buf = r.buf;
+    const qint64 off = r.offset, len = r.len;
+    const quint64 tag = r.tag;
+    m_pool.start([this, seq, buf, off, len, tag] {
+        // Нулевой блок в полном образе не сохраняем вовсе: непокрытый индексом участок читается как нули.
+        // В дельте непокрытый участок означает «без изменений», поэтому нули записываются явно.
+        QByteArray out;
+        quint32 used = ImageFile::Zeros;
+        bool store = true, unchanged = false;
+        if (m_base && m_base->sameBlock(off, buf, len)) { store = false; unchanged = true; }
+        else if (ZeroBlock::isAllZero(buf, len)) store = m_base != nullptr;
+        else used = compressChunk(buf, len, m_codec, m_level, out);
+
+        QMutexLocker l(&m_mutex);
+        Job &j = m_jobs[seq];
+        j.out = out;
+        j.codec = used;
+        j.store = store;
+        j.done = true;
+        if (unchanged) m_unchangedBytes += len;
+        IoCompletion c;
+        c.tag = tag;
+        c.result = len;
+        m_ready.push_back(c);
+        m_cond.wakeAll();
+    });
+    return true;
+}
+
+bool ImageWriterEngine::wait(QVector<IoCompletion> &done, int minCount, QString &diag) {
+    {
+        QMutexLocker lock(&m_mutex);
+        const int need = std::min(minCount, m_inFlight);
+        while (m_ready.size() < need) m_cond.wait(&m_mutex);
+        m_inFlight -= m_ready.size();
+        done += m_ready;
+        m_ready.clear();
+    }
+    return appendReady(diag);
+}
+
+// Дописать в образ все готовые блоки, идущие подряд по порядку постановки
+bool ImageWriterEngine::appendReady(QString &diag) {
+    for (;;) {
+        Job j;
+        {
+            QMutexLocker lock(&m_mutex);
+            auto it = m_jobs.find(m_nextAppend);
+            if (it == m_jobs.end() || !it.value().done) return true;
+            j = it.value();
+            m_jobs.erase(it);
+            ++m_nextAppend;
+        }
+        m_rawBytes += j.rawSize;
+        if (!j.store) continue;
+
+        if (!j.out.isEmpty()) {
+            qint64 r = writeAt(m_file.handle(), j.out.constData(), j.out.size(), m_filePos);
+            if (r < 0) { diag = IoEngine::errorText(r); return false; }
+        }
+        ImageChunk c;
+        c.rawOffset = quint64(j.rawOffset);
+        c.fileOffset = quint64(m_filePos);
+        c.storedSize = quint32(j.out.size());
+        c.rawSize = quint32(j.rawSize);
+        c.codec = j.codec;
+        m_index.push_back(c);
+        m_filePos += j.out.size();
+    }
+}
+
+bool ImageWriterEngine::finish(QString &diag) {
+    m_pool.waitForDone();
+    if (!appendReady(diag)) return false;
+    if (!m_jobs.isEmpty()) { diag = "не все блоки образа записаны"; return false; }
+
+    QByteArray tail(m_index.size() * kEntrySize + kFooterSize, '\0');
+    char *p = tail.data();
+    for (const ImageChunk &c : m_index) {
+        qToLittleEndian<quint64>(c.rawOffset, p);
+        qToLittleEndian<quint64>(c.fileOffset, p + 8);
+        qToLittleEndian<quint32>(c.storedSize, p + 16);
+        qToLittleEndian<quint32>(c.rawSize, p + 20);
+        qToLittleEndian<quint32>(c.codec, p + 24);
+        p += kEntrySize;
+    }
+    std::memcpy(p, kFooterMagic, 8);
+    qToLittleEndian<quint64>(quint64(m_filePos), p + 8);
+    qToLittleEndian<quint64>(quint64(m_index.size()), p + 16);
+    qToLittleEndian<quint64>(quint64(std::max(m_lastEnd, m_rawBytes)), p + 24);
+
+    qint64 r = writeAt(m_file.handle(), tail.constData(), tail.size(), m_filePos);
+    if (r < 0) { diag = IoEngine::errorText(r); return false; }
+    m_filePos += tail.size();
+    if (!m_file.resize(m_filePos)) { diag = m_file.errorString(); return false; }
+    return true;
+}
+
+// ---------- чтение ----------
+
+ImageReaderEngine::ImageReaderEngine(QFile &file, int threads)
+    : m_file(file), m_threads(std::max(1, threads)) {
+    m_pool.setMaxThreadCount(m_threads);
+}
+
+ImageReaderEngine::~ImageReaderEngine() {
+    m_pool.waitForDone();
+}
+
+QString ImageReaderEngine::name() const {
+    return "rwi-" + ImageFile::codecName(m_codec);
+}
+
+bool ImageReaderEngine::open(QString &diag) {
+    if (!ImageFile::probe(m_file, m_rawSize, m_codec)) { diag = "файл не является образом RWI"; return false; }
+    const qint64 size = m_file.size();
+    char head[kHeaderSize], foot[kFooterSize];
+    readAt(m_file.handle(), head, kHeaderSize, 0);
+    readAt(m_file.handle(), foot, kFooterSize, size - kFooterSize);
+    m_flags = qFromLittleEndian<quint32>(head + 20);
+    const qint64 indexOff = qint64(qFromLittleEndian<quint64>(foot + 8));
+    const qint64 count = qint64(qFromLittleEndian<quint64>(foot + 16));
+    if (indexOff < kHeaderSize || count < 0 || indexOff + count * kEntrySize != size - kFooterSize) {
+        diag = "повреждён индекс образа";
+        return false;
+    }
+
+    QByteArray idx(int(count * kEntrySize), '\0');
+    if (readAt(m_file.handle(), idx.data(), idx.size(), indexOff) != idx.size()) { diag = "не удалось прочитать индекс образа"; return false; }
+    m_index.resize(int(count));
+    quint64 prevEnd = 0;
+    for (int i=0; i<count; ++i) {
+        const char *p = idx.constData() + i * kEntrySize;
+        ImageChunk &c = m_index[i];
+        c.rawOffset  = qFromLittleEndian<quint64>(p);
+        c.fileOffset = qFromLittleEndian<quint64>(p + 8);
+        c.storedSize = qFromLittleEndian<quint32>(p + 16);
+        c.rawSize    = qFromLittleEndian<quint32>(p + 20);
+        c.codec      = qFromLittleEndian<quint32>(p + 24);
+        if (c.rawOffset < prevEnd || c.rawOffset + c.rawSize > quint64(m_rawSize) ||
+            c.fileOffset + c.storedSize > quint64(indexOff)) {
+            diag = QString("повреждён индекс образа (блок %1)").arg(i);
+            return false;
+        }
+        if (!codecSupported(c.codec)) {
+            diag = QString("образ сжат кодеком %1, он недоступен в этой сборке").arg(ImageFile::codecName(int(c.codec)));
+            return false;
+        }
+        prevEnd = c.rawOffset + c.rawSize;
+    }
+    return true;
+}
+
+bool ImageReaderEngine::openRaw(QString &diag) {
+    m_raw = true;
+    m_rawSize = m_file.size();
+    if (m_rawSize < 0) { diag = m_file.errorString(); return false; }
+    return true;
+}
+
+bool ImageReaderEngine::submit(const IoRequest &r) {
+    {
+        QMutexLocker lock(&m_mutex);
+        ++m_inFlight;
+    }
+    char *buf = r.buf;
+    const qint64 off = r.offset, len = r.len;
+    const quint64 tag = r.tag;
+    m_pool.start([this, buf, off, len, tag] {
+        IoCompletion c;
+        c.tag = tag;
+        c.result = readRange(buf, off, len);
+        QMutexLocker l(&m_mutex);
+        m_ready.push_back(c);
+        m_cond.wakeAll();
+    });
+    return true;
+}
+
+bool ImageReaderEngine::wait(QVector<IoCompletion> &done, int minCount, QString &diag) {
+    Q_UNUSED(diag);
+    QMutexLocker lock(&m_mutex);
+    const int need = std::min(minCount, m_inFlight);
+    while (m_ready.size() < need) m_cond.wait(&m_mutex);
+    m_inFlight -= m_ready.size();
+    done += m_ready;
+    m_ready.clear();
+    return true;
+}
+
+// Собрать [off, off+len) исходных данных: распаковать нужные блоки, промежутки — нулями.
+// Как и обычный файл, возвращает меньше len у конца данных и 0 за концом.
+qint64 ImageReaderEngine::readRange(char *buf, qint64 off, qint64 len) const {
+    if (off >= m_rawSize) return 0;
+    len = std::min(len, m_rawSize - off);
+    const qint64 end = off + len;
+    if (m_raw) {
+        const qint64 r = readAt(m_file.handle(), buf, len, off);
+        if (r >= 0 && r < len) std::memset(buf + r, 0, size_t(len - r));
+        return r < 0 ? r : len;
+    }
+
+    // Первый блок, который заканчивается после off
+    auto it = std::upper_bound(m_index.begin(), m_index.end(), off,
+                               [](qint64 v, const ImageChunk &c) { return v < qint64(c.rawOffset + c.rawSize); });
+    QByteArray blob, raw;
+    qint64 pos = off;
+    while (pos < end) {
+        if (it == m_index.end() || qint64(it->rawOffset) >= end) {
+            const qint64 r = fillGap(buf + (pos - off), pos, end - pos);
+            if (r < 0) return r;
+            break;
+        }
+        if (qint64(it->rawOffset) > pos) {
+            const qint64 r = fillGap(buf + (pos - off), pos, qint64(it->rawOffset) - pos);
+            if (r < 0) return r;
+            pos = qint64(it->rawOffset);
+        }
+        blob.resize(int(it->storedSize));
+        if (readAt(m_file.handle(), blob.data(), blob.size(), qint64(it->fileOffset)) != blob.size()) return kCorrupt;
+
+        const qint64 from = pos - qint64(it->rawOffset);
+        const qint64 n = std::min<qint64>(qint64(it->rawSize) - from, end - pos);
+        if (from == 0 && n == qint64(it->rawSize)) {
+            if (!decompressChunk(blob.constData(), blob.size(), it->codec, buf + (pos - off), n)) return kCorrupt;
+        } else {
+            raw.resize(int(it->rawSize));
+            if (!decompressChunk(blob.constData(), blob.size(), it->codec, raw.data(), raw.size())) return kCorrupt;
+            std::memcpy(buf + (pos - off), raw.constData() + from, size_t(n));
+        }
+        pos += n;
+        ++it;
+    }
+    return len;
+}
+
+// Участок без блоков: нули, а в дельте — данные предыдущего образа цепочки
+qint64 ImageReaderEngine::fillGap(char *buf, qint64 off, qint64 len) const {
+    qint64 r = 0;
+    if (m_base && isDelta()) {
+        r = m_base->readRange(buf, off, len);
+        if (r < 0) return r;
+    }
+    std::memset(buf + r, 0, size_t(len - r));
+    return len;
+}
@@ -0,0 +1,134 @@
+#pragma once
+#include "ioengine.h"
+#include <QFile>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QThreadPool>
+#include <QMap>
+#include <QStringList>
+
+class BlockManifest;
+
+// Сжатый образ RWI. Каждый блок сжимается независимо, в конце файла лежит индекс,
+// поэтому любой диапазон читается без распаковки всего образа:
+//   [заголовок 32 байта][сжатые блоки...][индекс: 32 байта на блок][хвост 32 байта]
+// Все числа little-endian. Участки, не покрытые ни одним блоком, читаются как нули,
+// а в дельта-образе (флаг Delta в заголовке) — берутся из предыдущего образа цепочки.
+struct ImageChunk {
+    quint64 rawOffset = 0;     // смещение в исходных данных
+    quint64 fileOffset = 0;    // смещение сжатых данных в файле образа
+    quint32 storedSize = 0;
+    quint32 rawSize = 0;
+    quint32 codec = 0;
+};
+
+class ImageFile {
+public:
+    enum Codec { Stored = 0, Zstd = 1, Lz4 = 2, Zlib = 3, Zeros = 4 /* блок из нулей, данных нет */ };
+    enum Flags { Delta = 1 };
+
+    // "zstd", "zstd:9", "lz4:1", "zlib:6"
+    static bool parseCodec(const QString &spec, int &codec, int &level, QString &diag);
+    static QString codecName(int codec);
+    static QStringList availableCodecs();
+    // Сжать блок кодеком образа (без выигрыша — Stored, возвращается использованный кодек) и распаковать обратно.
+    // Те же кодеки служат и хранилищу чанков.
+    static quint32 compressBlock(const char *src, qint64 n, int codec, int level, QByteArray &out);
+    static bool decompressBlock(const char *src, qint64 n, quint32 codec, char *dst, qint64 rawSize);
+
+    // Это образ RWI? Тогда rawSize — размер исходных данных, codec — кодек из заголовка
+    static bool probe(QFile &f, qint64 &rawSize, int &codec);
+};
+
+// Сторона записи конвейера: блоки сжимаются на пуле потоков и дописываются в образ строго по порядку.
+// Смещения запросов — в исходных данных, должны возрастать.
+class ImageWriterEngine : public IoEngine {
+public:
+    ImageWriterEngine(QFile &file, int codec, int level, int threads);
+    ~ImageWriterEngine() override;
+
+    // Дельта относительно образа с манифестом base: блоки с тем же XXH64 не сохраняются,
+    // нулевые сохраняются явно. Вызывать до begin().
+    void setDeltaBase(const BlockManifest *base) { m_base = base; }
+
+    // Записать заголовок; chunkSize — номинальный размер блока
+    bool begin(quint32 chunkSize, QString &diag);
+
+    QString name() const override;
+    int queueDepth() const override { return m_threads * 2; }
+    bool submit(const IoRequest &r) override;
+    bool wait(QVector<IoCompletion> &done, int minCount, QString &diag) override;
+    bool finish(QString &diag) override;
+
+    qint64 rawBytes() const { return m_rawBytes; }
+    qint64 storedBytes() const { return m_filePos; }
+    qint64 unchangedBytes() const { return m_unchangedBytes; }
+
+private:
+    struct Job {
+        qint64 rawOffset = 0;
+        qint64 rawSize = 0;
+        QByteArray out;
+        quint32 codec = 0;
+        bool store = false;   // попадает в индекс
+        bool done = false;
+    };
+    bool appendReady(QString &diag);
+
+    QFile &m_file;
+    int m_codec, m_level, m_threads;
+    const BlockManifest *m_base = nullptr;
+    QThreadPool m_pool;
+    QMutex m_mutex;
+    QWaitCondition m_cond;
+    QMap<quint64, Job> m_jobs;          // по порядку постановки
+    QVector<IoCompletion> m_ready;
+    quint64 m_nextSeq = 0, m_nextAppend = 0;
+    int m_inFlight = 0;
+    qint64 m_lastEnd = 0;
+    QVector<ImageChunk> m_index;
+    qint64 m_filePos = 0;
+    qint64 m_rawBytes = 0;
+    qint64 m_unchangedBytes = 0;
+};
+
+// Сторона чтения конвейера: блоки образа распаковываются параллельно на пуле потоков,
+// запрос может начинаться с любого смещения исходных данных
+class ImageReaderEngine : public IoEngine {
+public:
+    ImageReaderEngine(QFile &file, int threads);
+    ~ImageReaderEngine() override;
+
+    // Прочитать хвост и индекс образа RWI
+    bool open(QString &diag);
+    // Читать файл как сырой образ (основание цепочки дельт)
+    bool openRaw(QString &diag);
+    // Откуда брать участки, не покрытые блоками дельта-образа
+    void setBase(const ImageReaderEngine *base) { m_base = base; }
+
+    qint64 rawSize() const { return m_rawSize; }
+    bool isDelta() const { return m_flags & ImageFile::Delta; }
+
+    QString name() const override;
+    int queueDepth() const override { return m_threads * 2; }
+    bool submit(const IoRequest &r) override;
+    bool wait(QVector<IoCompletion> &done, int minCount, QString &diag) override;
+
+private:
+    qint64 readRange(char *buf, qint64 off, qint64 len) const;
+    qint64 fillGap(char *buf, qint64 off, qint64 len) const;
+
+    QFile &m_file;
+    int m_threads;
+    QThreadPool m_pool;
+    QMutex m_mutex;
+    QWaitCondition m_cond;
+    QVector<IoCompletion> m_ready;
+    int m_inFlight = 0;
+    QVector<ImageChunk> m_index;   // по возрастанию rawOffset
+    qint64 m_rawSize = 0;
+    int m_codec = 0;
+    quint32 m_flags = 0;
+    bool m_raw = false;
+    const ImageReaderEngine *m_base = nullptr;
+};
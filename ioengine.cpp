@@ -0,0 +1,238 @@
+#include "ioengine.h"
+#include <QStringList>
+#include <QHash>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#ifdef Q_OS_WIN
+#  include <windows.h>
+#  include <io.h>
+#else
+#  include <unistd.h>
+#  include <errno.h>
+#endif
+
+#ifdef RAWWRITER_HAVE_URING
+#  include <liburing.h>
+#  include <sys/uio.h>
+#endif
+
+bool IoEngine::registerBuffers(const QVector<char*> &bufs, qint64 bufSize, QString &diag) {
+    Q_UNUSED(bufs); Q_UNUSED(bufSize); Q_UNUSED(diag);
+    return true;
+}
+
+bool IoEngine::finish(QString &diag) {
+    Q_UNUSED(diag);
+    return true;
+}
+
+QString IoEngine::errorText(qint64 result) {
+    return qt_error_string(int(-result));
+}
+
+qint64 IoEngine::execute(const IoRequest &r) {
+#ifdef Q_OS_WIN
+    HANDLE h = (HANDLE)_get_osfhandle(r.fd);
+    OVERLAPPED ov{};
+    ov.Offset     = DWORD(quint64(r.offset) & 0xffffffffu);
+    ov.OffsetHigh = DWORD(quint64(r.offset) >> 32);
+    DWORD n = 0;
+    BOOL ok = r.write ? WriteFile(h, r.buf, DWORD(r.len), &n, &ov)
+                      : ReadFile (h, r.buf, DWORD(r.len), &n, &ov);
+    if (!ok) {
+        DWORD e = GetLastError();
+        if (!r.write && e == ERROR_HANDLE_EOF) return 0;
+        return -qint64(e ? e : ERROR_GEN_FAILURE);
+    }
+    return qint64(n);
+#else
+    ssize_t n;
+    do {
+        n = r.write ? ::pwrite(r.fd, r.buf, size_t(r.len), off_t(r.offset))
+                    : ::pread (r.fd, r.buf, size_t(r.len), off_t(r.offset));
+    } while (n < 0 && errno == EINTR);
+    return n < 0 ? -qint64(errno) : qint64(n);
+#endif
+}
+
+// Синхронный движок: по одному запросу за раз, как обычный read/write
+class SyncIoEngine : public IoEngine {
+public:
+    QString name() const override { return "sync"; }
+    int queueDepth() const override { return 1; }
+
+    bool submit(const IoRequest &r) override {
+        if (m_pending.size() >= 1) return false;
+        m_pending.push_back(r);
+        return true;
+    }
+
+    bool wait(QVector<IoCompletion> &done, int minCount, QString &diag) override {
+        Q_UNUSED(minCount); Q_UNUSED(diag);
+        for (const IoRequest &r : m_pending) {
+            IoCompletion c;
+            c.tag = r.tag;
+            c.result = execute(r);
+            done.push_back(c);
+        }
+        m_pending.clear();
+        return true;
+    }
+
+private:
+    QVector<IoRequest> m_pending;
+};
+
+// Приёмник без записи: запросы сразу завершаются успешно. Для проверочного чтения,
+// когда нужны только данные, прошедшие через конвейер (хэши).
+// Как источник (замер записи) отдаёт неповторяющиеся данные: каждый буфер заполняется один раз,
+// при первом чтении в него, — на устройство не попадает неинициализированная память процесса.
+class NullIoEngine : public IoEngine {
+public:
+    QString name() const override { return "null"; }
+    int queueDepth() const override { return 1; }
+
+    bool submit(const IoRequest &r) override {
+        if (!r.write && m_filled.value(r.buf, 0) < r.len) {
+            // xorshift64, своё начальное значение у каждого буфера
+            quint64 x = 0x9E3779B97F4A7C15ULL * quint64(m_filled.size() + 1);
+            for (qint64 i = 0; i + 8 <= r.len; i += 8) {
+                x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+                std::memcpy(r.buf + i, &x, 8);
+            }
+            std::memset(r.buf + (r.len & ~qint64(7)), 0x5A, size_t(r.len & 7));
+            m_filled[r.buf] = r.len;
+        }
+        IoCompletion c;
+        c.tag = r.tag;
+        c.result = r.len;
+        m_done.push_back(c);
+        return true;
+    }
+
+    bool wait(QVector<IoCompletion> &done, int minCount, QString &diag) override {
+        Q_UNUSED(minCount); Q_UNUSED(diag);
+        done += m_done;
+        m_done.clear();
+        return true;
+    }
+
+private:
+    QVector<IoCompletion> m_done;
+    QHash<const char*, qint64> m_filled;   // буфер источника -> сколько байт в нём уже заполнено
+};
+
+#ifdef RAWWRITER_HAVE_URING
+// io_uring: до queueDepth запросов в полёте, буферы кольца можно зарегистрировать как fixed
+class UringIoEngine : public IoEngine {
+public:
+    ~UringIoEngine() override {
+        if (m_ready) io_uring_queue_exit(&m_ring);
+    }
+
+    bool init(int queueDepth, QString &diag) {
+        int ret = io_uring_queue_init(unsigned(queueDepth), &m_ring, 0);
+        if (ret < 0) {
+            diag = QString("io_uring_queue_init: %1").arg(errorText(ret));
+            return false;
+        }
+        m_ready = true;
+        m_depth = queueDepth;
+        return true;
+    }
+
+    QString name() const override { return "uring"; }
+    int queueDepth() const override { return m_depth; }
+
+    bool registerBuffers(const QVector<char*> &bufs, qint64 bufSize, QString &diag) override {
+        QVector<iovec> iov(bufs.size());
+        for (int i=0; i<bufs.size(); ++i) {
+            iov[i].iov_base = bufs[i];
+            iov[i].iov_len  = size_t(bufSize);
+        }
+        int ret = io_uring_register_buffers(&m_ring, iov.constData(), unsigned(iov.size()));
+        if (ret < 0) {
+            // Чаще всего не хватает RLIMIT_MEMLOCK — работаем с обычными буферами
+            diag = QString("io_uring_register_buffers: %1").arg(errorText(ret));
+            return false;
+        }
+        m_fixed = true;
+        return true;
+    }
+
+    bool submit(const IoRequest &r) override {
+        if (m_inFlight >= m_depth) return false;
+        io_uring_sqe *sqe = io_uring_get_sqe(&m_ring);
+        if (!sqe) return false;
+        if (m_fixed && r.bufIndex >= 0) {
+            if (r.write) io_uring_prep_write_fixed(sqe, r.fd, r.buf, unsigned(r.len), quint64(r.offset), r.bufIndex);
+            else         io_uring_prep_read_fixed (sqe, r.fd, r.buf, unsigned(r.len), quint64(r.offset), r.bufIndex);
+        } else {
+            if (r.write) io_uring_prep_write(sqe, r.fd, r.buf, unsigned(r.len), quint64(r.offset));
+            else         io_uring_prep_read (sqe, r.fd, r.buf, unsigned(r.len), quint64(r.offset));
+        }
+        io_uring_sqe_set_data(sqe, reinterpret_cast<void*>(uintptr_t(r.tag)));
+        ++m_inFlight;
+        return true;
+    }
+
+    bool wait(QVector<IoCompletion> &done, int minCount, QString &diag) override {
+        minCount = std::min(minCount, m_inFlight);
+        int ret;
+        do {
+            ret = io_uring_submit_and_wait(&m_ring, unsigned(minCount));
+        } while (ret == -EINTR);
+        if (ret < 0) {
+            diag = QString("io_uring_submit_and_wait: %1").arg(errorText(ret));
+            return false;
+        }
+        io_uring_cqe *cqe = nullptr;
+        while (io_uring_peek_cqe(&m_ring, &cqe) == 0 && cqe) {
+            IoCompletion c;
+            c.tag = quint64(reinterpret_cast<uintptr_t>(io_uring_cqe_get_data(cqe)));
+            c.result = cqe->res;
+            done.push_back(c);
+            io_uring_cqe_seen(&m_ring, cqe);
+            --m_inFlight;
+        }
+        return true;
+    }
+
+private:
+    io_uring m_ring{};
+    bool m_ready = false;
+    bool m_fixed = false;
+    int m_depth = 1;
+    int m_inFlight = 0;
+};
+#endif
+
+QStringList IoEngine::available() {
+    QStringList l{"sync"};
+#ifdef RAWWRITER_HAVE_URING
+    l << "uring";
+#endif
+    return l;
+}
+
+std::unique_ptr<IoEngine> IoEngine::create(const QString &name, int queueDepth, QString &diag) {
+    if (name == "sync") return std::unique_ptr<IoEngine>(new SyncIoEngine);
+    if (name == "null") return std::unique_ptr<IoEngine>(new NullIoEngine);
+#ifdef RAWWRITER_HAVE_URING
+    if (name == "uring") {
+        std::unique_ptr<UringIoEngine> e(new UringIoEngine);
+        if (!e->init(std::max(1, queueDepth), diag)) return nullptr;
+        return std::unique_ptr<IoEngine>(e.release());
+    }
+#else
+    Q_UNUSED(queueDepth);
+    if (name == "uring") {
+        diag = "сборка без liburing";
+        return nullptr;
+    }
+#endif
+    diag = QString("неизвестный движок '%1'").arg(name);
+    return nullptr;
+}
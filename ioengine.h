@@ -0,0 +1,53 @@
+#pragma once
+#include <QString>
+#include <QVector>
+#include <memory>
+
+// Один запрос позиционного ввода-вывода. tag возвращается в завершении как есть.
+struct IoRequest {
+    int fd = -1;
+    char *buf = nullptr;
+    qint64 len = 0;
+    qint64 offset = 0;
+    bool write = false;
+    int bufIndex = -1;     // индекс зарегистрированного буфера (io_uring fixed buffers), -1 — обычный
+    quint64 tag = 0;
+};
+
+// result — число байт или -код ошибки (errno / GetLastError)
+struct IoCompletion {
+    quint64 tag = 0;
+    qint64 result = 0;
+};
+
+// Движок ввода-вывода: копирование ставит запросы в очередь и забирает завершения.
+// Экземпляр не потокобезопасный — у потока чтения и потока записи свои движки.
+class IoEngine {
+public:
+    virtual ~IoEngine() = default;
+
+    virtual QString name() const = 0;
+    virtual int queueDepth() const = 0;
+
+    // Зарегистрировать буферы кольца заранее (для io_uring — fixed buffers).
+    // false — регистрация не удалась, работаем с обычными буферами.
+    virtual bool registerBuffers(const QVector<char*> &bufs, qint64 bufSize, QString &diag);
+
+    // Поставить запрос в очередь. Не больше queueDepth() одновременно.
+    virtual bool submit(const IoRequest &r) = 0;
+    // Отправить очередь и дождаться хотя бы minCount завершений, результаты дописываются в done
+    virtual bool wait(QVector<IoCompletion> &done, int minCount, QString &diag) = 0;
+    // Вызывается стороной записи после последнего завершения (например, дописать индекс образа)
+    virtual bool finish(QString &diag);
+
+    // Выполнить запрос сразу, в вызывающем потоке: pread/pwrite, на Windows — ReadFile/WriteFile с позицией
+    static qint64 execute(const IoRequest &r);
+
+    // Доступные движки: "sync" есть всегда, "uring" — если собрано с liburing
+    static QStringList available();
+    // nullptr, если движок недоступен (в diag — почему). Служебный "null" только завершает запросы, ничего не записывая;
+    // при чтении из него буферы заполняются неповторяющимися данными.
+    static std::unique_ptr<IoEngine> create(const QString &name, int queueDepth, QString &diag);
+
+    static QString errorText(qint64 result);
+};
@@ -2,13 +2,647 @@
 #include <QTextStream>
 #include <QFile>
 #include <QFileInfo>
+#include <QDir>
+#include <QCommandLineParser>
 #include "diskio.h"
+#include "ioengine.h"
+#include "imagefile.h"
+#include "chunkstore.h"
+#include "usedblocks.h"
+#include "xxh64.h"
+#include "manifest.h"
+#include "streamhash.h"
+#include "rescue.h"
+#include "checkpoint.h"
+#include "diskbench.h"
+#include "telemetry.h"
+#include "throttle.h"
+#include "batch.h"
+#include <QThread>
+#include <memory>
+#include <vector>
 
 static qint64 ceilTo(qint64 v, qint64 a) { return (a>0)? ((v + a - 1) / a) * a : v; }
 static qint64 floorTo(qint64 v, qint64 a) { return (a>0)? (v - (v % a)) : v; }
 
+// Разобрать разделы источника и оставить в копии только занятые блоки. sector — логический сектор носителя источника
+static bool scanUsedBlocks(QFile &src, qint64 size, qint64 sector, CopyOptions &copyOpts, QTextStream &out, QTextStream &err) {
+    QVector<UsedBlocks::Partition> parts;
+    QString scheme, diag;
+    if (!UsedBlocks::scan(src, size, sector, copyOpts.readRanges, parts, scheme, diag)) {
+        err << "Не удалось разобрать разделы: " << diag << "\n";
+        return false;
+    }
+    out << "Разметка: " << scheme << "\n";
+    for (int i=0;i<parts.size();++i) {
+        const auto &pt = parts[i];
+        out << " [" << i << "] смещение " << pt.offset << " | " << DiskIO::humanSize(pt.size)
+            << " | " << (pt.fs.isEmpty() ? QString("?") : pt.fs)
+            << " | читается " << DiskIO::humanSize(pt.used)
+            << (pt.note.isEmpty() ? QString() : " (целиком: " + pt.note + ")") << "\n";
+    }
+    out << "Будет прочитано " << DiskIO::humanSize(UsedBlocks::totalBytes(copyOpts.readRanges))
+        << " из " << DiskIO::humanSize(size) << "\n";
+    return true;
+}
+
+static void printPartitions(const QVector<UsedBlocks::Partition> &parts, QTextStream &out) {
+    for (int i=0;i<parts.size();++i) {
+        const auto &pt = parts[i];
+        out << " [" << i << "] смещение " << pt.offset << " | " << DiskIO::humanSize(pt.size)
+            << " | " << (pt.fs.isEmpty() ? QString("?") : pt.fs) << "\n";
+    }
+}
+
+// Часть образа для записи: раздел из таблицы разделов образа или диапазон байт.
+// Часть должна лежать внутри образа, её смещение и длина — быть кратными сектору, а с devOffset она должна помещаться на каждое устройство.
+static bool selectSource(QFile &image, qint64 imageSize, bool packed, const QVector<DiskInfo> &targets, qint64 devOffset, qint64 sector,
+                         const CopyOptions &opts, qint64 &offset, qint64 &length, QTextStream &out, QTextStream &err) {
+    if (opts.sourcePart >= 0) {
+        // Таблица разделов читается прямо из файла — только у сырого образа
+        if (packed) { err << "Раздел по номеру берётся только из сырого образа; для образа RWI, дельт и рецепта укажите --source-range.\n"; return false; }
+        QVector<UsedBlocks::Partition> parts;
+        QString scheme, diag;
+        if (!UsedBlocks::partitions(image, imageSize, sector, parts, scheme, diag)) { err << "Не разобрать разделы образа: " << diag << "\n"; return false; }
+        if (opts.sourcePart >= parts.size()) {
+            err << "В образе нет раздела " << opts.sourcePart << ". Разметка: " << scheme << "\n";
+            printPartitions(parts, err);
+            return false;
+        }
+        const UsedBlocks::Partition &pt = parts[opts.sourcePart];
+        offset = pt.offset;
+        length = pt.size;
+        out << "Раздел образа [" << opts.sourcePart << "] (" << scheme << ", " << (pt.fs.isEmpty() ? QString("ФС не распознана") : pt.fs)
+            << "): смещение " << offset << ", " << DiskIO::humanSize(quint64(length)) << "\n";
+    } else {
+        offset = opts.sourceRange.offset;
+        length = opts.sourceRange.length;
+        // Без сложения: у больших значений из --source-range сумма переполнилась бы
+        if (offset > imageSize || length > imageSize - offset) {
+            err << "Диапазон " << offset << ":" << length << " выходит за конец образа (" << imageSize << " байт).\n";
+            return false;
+        }
+        out << "Диапазон образа: смещение " << offset << ", " << DiskIO::humanSize(quint64(length)) << "\n";
+    }
+    if (offset % sector != 0) {
+        // Иначе чтение с --direct оборвалось бы посреди записи, когда устройство уже частично перезаписано
+        err << "Смещение части образа (" << offset << " байт) не кратно сектору устройства (" << sector << " байт).\n";
+        return false;
+    }
+    if (length % sector != 0) {
+        err << "Длина части образа (" << length << " байт) не кратна сектору устройства (" << sector << " байт).\n";
+        return false;
+    }
+    for (const DiskInfo &d : targets) {
+        // Обычный файл растёт при записи
+        if (d.size == 0 || QFileInfo(d.path).isFile()) continue;
+        if (quint64(devOffset) > d.size || quint64(length) > d.size - quint64(devOffset)) {
+            err << "Не помещается на " << d.path << ": нужно " << DiskIO::humanSize(quint64(devOffset) + quint64(length)) << " со смещением "
+                << devOffset << ", а устройство — " << DiskIO::humanSize(d.size) << ".\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+// Весь образ или один его раздел: спросить, если образ сырой и размечен, а часть не задана ключом.
+// sector — логический сектор устройств записи: образ для диска 4Kn размечен в секторах по 4096
+static bool askSourcePart(const QString &path, qint64 sector, CopyOptions &opts, QTextStream &out, QTextStream &err) {
+    if (opts.sourcePart >= 0 || opts.sourceRange.length > 0 || !opts.chunkStore.isEmpty() || !opts.deltas.isEmpty()) return true;
+    QFile f(path);
+    qint64 rawSize = 0;
+    int codec = 0;
+    if (!f.open(QIODevice::ReadOnly) || ImageFile::probe(f, rawSize, codec) || ChunkStore::isRecipe(f, rawSize)) return true;
+    QVector<UsedBlocks::Partition> parts;
+    QString scheme, diag;
+    if (!UsedBlocks::partitions(f, f.size(), sector, parts, scheme, diag) || scheme == "нет") return true;
+    out << "Разметка образа: " << scheme << "\n";
+    printPartitions(parts, out);
+    out << "Раздел для записи (пусто — весь образ): " << Qt::flush;
+    const QString answer = QTextStream(stdin).readLine().trimmed();
+    if (answer.isEmpty()) return true;
+    bool ok = false;
+    const int n = answer.toInt(&ok);
+    if (!ok || n < 0 || n >= parts.size()) { err << "Некорректный номер раздела.\n"; return false; }
+    opts.sourcePart = n;
+    return true;
+}
+
+// Ключи, от которых зависят записанные данные: при возобновлении они должны совпасть
+static QString jobOptions(const CopyOptions &o) {
+    static const char *zero[] = { "write", "skip", "zeroout", "discard" };
+    QString s = QString("zero-blocks=") + zero[int(o.zeroBlocks)];
+    if (o.usedOnly) s += " used-only";
+    if (!o.deltas.isEmpty()) s += " delta=" + o.deltas.join(",");
+    if (o.sourcePart >= 0) s += " source-part=" + QString::number(o.sourcePart);
+    if (o.sourceRange.length > 0) s += " source-range=" + QString::number(o.sourceRange.offset) + ":" + QString::number(o.sourceRange.length);
+    return s;
+}
+
+// Начать журнал задания или, с --resume, продолжить прошлый. from — сколько байт уже на носителе
+static bool openCheckpoint(const CopyOptions &opts, Checkpoint &job, qint64 &from, QTextStream &out, QTextStream &err) {
+    QString diag;
+    from = 0;
+    if (opts.resume) {
+        Checkpoint prev;
+        if (!prev.load(opts.checkpointPath, diag)) { err << "Не прочитать журнал " << opts.checkpointPath << ": " << diag << "\n"; return false; }
+        if (!job.sameJob(prev, diag)) { err << diag << "\n"; return false; }
+        if (prev.fingerprint != job.fingerprint) {
+            err << "Источник изменился с прошлого запуска (отпечаток " << prev.fingerprint << ", сейчас " << job.fingerprint << "), продолжать нельзя.\n";
+            return false;
+        }
+        from = prev.done;
+        out << "Продолжение по журналу: уже записано " << DiskIO::humanSize(from) << " из " << DiskIO::humanSize(job.total) << "\n";
+    }
+    job.done = from;
+    job.bind(opts.checkpointPath, from);
+    if (!job.save(opts.checkpointPath, diag)) { err << "Не записать журнал " << opts.checkpointPath << ": " << diag << "\n"; return false; }
+    return true;
+}
+
+// Размер блока auto: замер в начале диапазона, который сейчас будет прочитан или перезаписан.
+// Выбранные размер блока и глубина очереди — в blockSize и copyOpts.
+static void tuneBlockSize(const QString &path, bool write, qint64 offset, qint64 span, qint64 sector,
+                          qint64 &blockSize, CopyOptions &copyOpts, QTextStream &out) {
+    const qint64 probe = floorTo(std::min<qint64>(span, 32 * 1024 * 1024), sector);
+    if (probe < 1024 * 1024) {
+        out << "Объём слишком мал для замера, размер блока " << DiskIO::humanSize(quint64(blockSize)) << ".\n";
+        return;
+    }
+    BenchPoint best;
+    if (!DiskBench::autoTune(path, write, offset, probe, sector, copyOpts, best, out)) {
+        out << "Замер не удался, размер блока " << DiskIO::humanSize(quint64(blockSize)) << ".\n";
+        return;
+    }
+    blockSize = best.blockSize;
+    copyOpts.queueDepth = best.queueDepth;
+}
+
+// Сочетания ключей, которые не работают вместе. В пакетном режиме проверяются для каждого задания:
+// пути (--manifest, --checkpoint, --rescue и т.п.) там свои у каждого.
+static bool checkOptions(const CopyOptions &opts, QTextStream &err) {
+    if (opts.stripes > 1 && (!opts.manifestPath.isEmpty() || !opts.baseManifestPath.isEmpty() || !opts.deltas.isEmpty() || !opts.hashAlgo.isEmpty()
+                             || opts.verify || !opts.compress.isEmpty())) {
+        err << "--stripes несовместим с --compress, --manifest, --base-manifest, --delta, --hash и --verify.\n";
+        return false;
+    }
+    if (opts.zeroCopy && (opts.stripes > 1 || opts.usedOnly || opts.zeroBlocks != CopyOptions::ZeroBlocks::Write || !opts.manifestPath.isEmpty()
+                          || !opts.baseManifestPath.isEmpty() || !opts.deltas.isEmpty() || !opts.hashAlgo.isEmpty() || opts.verify
+                          || !opts.compress.isEmpty() || !opts.rescueMap.isEmpty() || !opts.checkpointPath.isEmpty())) {
+        // Данные не проходят через процесс: ни посмотреть на них, ни пропустить, ни отметить в журнале
+        err << "--zero-copy несовместим с --stripes, --used-only, --zero-blocks, --compress, --manifest, --base-manifest, "
+               "--delta, --hash, --verify, --rescue и --checkpoint.\n";
+        return false;
+    }
+    if (opts.skipSame && (opts.stripes > 1 || opts.zeroCopy)) {
+        // Сравнивает поток чтения обычного конвейера
+        err << "--skip-same несовместим с --stripes и --zero-copy.\n";
+        return false;
+    }
+    if (!opts.rescueMap.isEmpty() && (opts.stripes > 1 || opts.usedOnly || !opts.manifestPath.isEmpty() || !opts.baseManifestPath.isEmpty()
+                                      || !opts.hashAlgo.isEmpty() || !opts.compress.isEmpty())) {
+        err << "--rescue несовместим с --stripes, --used-only, --compress, --manifest, --base-manifest и --hash.\n";
+        return false;
+    }
+    if (!opts.chunkStore.isEmpty() && (opts.stripes > 1 || opts.zeroCopy || !opts.rescueMap.isEmpty() || !opts.checkpointPath.isEmpty()
+                                       || !opts.baseManifestPath.isEmpty() || !opts.deltas.isEmpty())) {
+        // Повторы убирает само хранилище, а рецепт пишется целиком в конце передачи
+        err << "--chunk-store несовместим с --stripes, --zero-copy, --rescue, --checkpoint, --base-manifest и --delta.\n";
+        return false;
+    }
+    if (opts.resume && opts.checkpointPath.isEmpty()) { err << "--resume требует --checkpoint.\n"; return false; }
+    if (!opts.checkpointPath.isEmpty() && (opts.stripes > 1 || !opts.rescueMap.isEmpty() || !opts.baseManifestPath.isEmpty() || !opts.compress.isEmpty())) {
+        err << "--checkpoint несовместим с --stripes, --rescue, --compress и --base-manifest.\n";
+        return false;
+    }
+    if (opts.resume && (!opts.manifestPath.isEmpty() || !opts.hashAlgo.isEmpty() || opts.verify)) {
+        // Хэши считаются по всему потоку, а продолжение передаёт только его хвост
+        err << "--resume несовместим с --manifest, --hash и --verify.\n";
+        return false;
+    }
+    return true;
+}
+
+// Проверить параметры передачи до вопросов о файле и подтверждения
+static bool checkJob(const QVector<DiskInfo> &targets, bool isWrite, bool autoBlock, qint64 blockSize, qint64 devOffset,
+                     const CopyOptions &opts, QTextStream &err) {
+    if (!isWrite && targets.size() > 1) { err << "Чтение возможно только с одного диска.\n"; return false; }
+    if (isWrite && !opts.rescueMap.isEmpty()) { err << "--rescue работает только в режиме чтения.\n"; return false; }
+    if (!isWrite && (opts.sourcePart >= 0 || opts.sourceRange.length > 0)) { err << "--source-part и --source-range работают только в режиме записи.\n"; return false; }
+    if (!isWrite && opts.skipSame) { err << "--skip-same работает только в режиме записи.\n"; return false; }
+    if (targets.size() > 1 && opts.skipSame) { err << "--skip-same — только при записи на один диск.\n"; return false; }
+    if (autoBlock && (!opts.baseManifestPath.isEmpty() || !opts.checkpointPath.isEmpty() || !opts.rescueMap.isEmpty())) {
+        // Манифесту прошлого прогона и журналу нужен тот же размер блока, а умирающий диск лишний раз не читаем
+        err << "auto несовместим с --base-manifest, --checkpoint и --rescue: укажите размер блока явно.\n";
+        return false;
+    }
+    if (autoBlock && isWrite && opts.zeroBlocks == CopyOptions::ZeroBlocks::Skip) {
+        // Замер записи портит место, которое при skip не перезаписывается
+        err << "auto при записи несовместим с --zero-blocks skip: укажите размер блока явно.\n";
+        return false;
+    }
+    qint64 sector = 512;
+    for (const DiskInfo &d : targets) sector = std::max<qint64>(sector, d.logicalSector);
+    if ((devOffset % sector) != 0) {
+        err << "Смещение должно быть кратно размеру логического сектора (" << sector << " байт). Сейчас: " << devOffset << ".\n";
+        return false;
+    }
+    if ((blockSize % sector) != 0) {
+        err << "Размер блока должен быть кратен " << sector << " байт. Сейчас: " << blockSize << ".\n";
+        return false;
+    }
+    return true;
+}
+
+// Передача после подтверждения: запись образа path на targets или чтение targets[0] в path.
+// Возвращает код возврата программы.
+static int runTransfer(const QVector<DiskInfo> &targets, bool isWrite, bool autoBlock, qint64 blockSize, qint64 devOffset, qint64 limit,
+                       const QString &path, const CopyOptions &opts, QTextStream &out, QTextStream &err) {
+    const DiskInfo target = targets[0];
+    qint64 sector = 512;
+    for (const DiskInfo &d : targets) sector = std::max<qint64>(sector, d.logicalSector);
+
+    if (isWrite) {
+        QFile inFile(path);
+        if (!inFile.open(QIODevice::ReadOnly)) { err << "Не открыть входной файл: " << inFile.errorString() << "\n"; return 1; }
+
+        // Все устройства открываются до начала записи: если какое-то недоступно, не пишем ни на одно
+        std::vector<std::unique_ptr<QFile>> devs;
+        QVector<CopyTarget> copyTargets;
+        QString diag;
+        quint32 p = 0;
+        for (const DiskInfo &d : targets) {
+            devs.emplace_back(new QFile);
+            QFile &dev = *devs.back();
+            quint32 l=d.logicalSector, pd=d.physicalSector;
+            if (!DiskIO::openWrite(d.path, dev, diag, l, pd, opts.directIo, opts.durability == CopyOptions::Durability::WriteThrough)) {
+                err << "Не открыть устройство " << d.path << " для записи. " << diag << "\n";
+#ifdef Q_OS_WIN
+                err << "Подсказки: Админ-права, размонтировать том (mountvol/diskpart), закрыть Проводник/антивирус, выбрать именно \\\\.\\PhysicalDriveN.\n";
+#else
+                err << "Подсказки: sudo/root; umount всех разделов устройства; убедитесь, что это весь диск (/dev/sdX).\n";
+#endif
+                return 1;
+            }
+            if (devOffset>0 && !dev.seek(devOffset)) { err << "Не удалось перейти на указанное смещение устройства " << d.path << ".\n"; return 1; }
+            p = std::max(p, pd);
+            CopyTarget t;
+            t.file = &dev;
+            t.name = d.path;
+            copyTargets.push_back(t);
+        }
+
+        // Сжатый образ RWI распаковывается параллельно прямо в конвейер записи
+        qint64 srcSize = inFile.size();
+        std::unique_ptr<ImageReaderEngine> image;
+        qint64 rawSize = 0;
+        int codec = 0;
+        std::unique_ptr<ChunkStore> store;
+        std::unique_ptr<ChunkStoreReaderEngine> recipe;
+        if (!opts.chunkStore.isEmpty()) {
+            // Образ — рецепт: чанки грузятся из хранилища параллельно и с упреждением
+            store.reset(new ChunkStore(opts.chunkStore));
+            recipe.reset(new ChunkStoreReaderEngine(*store, inFile, opts.threads));
+            if (!store->open(false, diag) || !recipe->open(diag)) { err << "Не прочитать рецепт: " << diag << "\n"; return 1; }
+            out << "Рецепт хранилища " << opts.chunkStore << ": " << recipe->chunkCount() << " чанков, исходный размер " << DiskIO::humanSize(recipe->rawSize()) << "\n";
+            srcSize = recipe->rawSize();
+        } else if (ImageFile::probe(inFile, rawSize, codec)) {
+            image.reset(new ImageReaderEngine(inFile, opts.threads));
+            if (!image->open(diag)) { err << "Не прочитать образ: " << diag << "\n"; return 1; }
+            out << "Образ RWI (" << ImageFile::codecName(codec) << "), исходный размер " << DiskIO::humanSize(rawSize) << "\n";
+            srcSize = rawSize;
+        } else if (!opts.deltas.isEmpty()) {
+            image.reset(new ImageReaderEngine(inFile, opts.threads));
+            if (!image->openRaw(diag)) { err << "Не прочитать образ: " << diag << "\n"; return 1; }
+        }
+
+        // Цепочка дельт: каждая берёт неизменённые блоки у предыдущей, данные читаются через последнюю
+        std::vector<std::unique_ptr<QFile>> deltaFiles;
+        std::vector<std::unique_ptr<ImageReaderEngine>> deltas;
+        ImageReaderEngine *top = image.get();
+        for (const QString &path : opts.deltas) {
+            deltaFiles.emplace_back(new QFile(path));
+            if (!deltaFiles.back()->open(QIODevice::ReadOnly)) { err << "Не открыть дельту " << path << ": " << deltaFiles.back()->errorString() << "\n"; return 1; }
+            deltas.emplace_back(new ImageReaderEngine(*deltaFiles.back(), opts.threads));
+            ImageReaderEngine *d = deltas.back().get();
+            if (!d->open(diag)) { err << "Не прочитать дельту " << path << ": " << diag << "\n"; return 1; }
+            if (!d->isDelta()) { err << path << " — не дельта-образ.\n"; return 1; }
+            d->setBase(top);
+            top = d;
+            out << "Дельта: " << path << ", размер данных " << DiskIO::humanSize(d->rawSize()) << "\n";
+            srcSize = d->rawSize();
+        }
+        // Часть образа: раздел или диапазон пишется с devOffset, чтение идёт сразу с её начала, а не с начала образа
+        qint64 srcOffset = 0, srcLength = srcSize;
+        if (opts.sourcePart >= 0 || opts.sourceRange.length > 0) {
+            if (!selectSource(inFile, srcSize, top || recipe, targets, devOffset, sector, opts, srcOffset, srcLength, out, err)) return 1;
+            if (!inFile.seek(srcOffset)) { err << "Не удалось перейти к смещению " << srcOffset << " образа.\n"; return 1; }
+        }
+        qint64 base = (limit < 0) ? srcLength : std::min<qint64>(limit, srcLength);
+        qint64 targetBytes = ceilTo(base, sector);
+        if (targetBytes == 0) targetBytes = sector;
+
+        CopyOptions copyOpts = opts;
+        copyOpts.writeThroughOpened = opts.durability == CopyOptions::Durability::WriteThrough;
+        copyOpts.bufferAlign = p;
+        copyOpts.sourceEngine = top;
+        if (recipe) copyOpts.sourceEngine = recipe.get();
+        // На несколько дисков — по первому из них
+        if (autoBlock) tuneBlockSize(target.path, true, devOffset, targetBytes, sector, blockSize, copyOpts, out);
+        if (opts.usedOnly) {
+            if (top || recipe) out << "Образ RWI и рецепт хранилища и так не хранят нулевые блоки, --used-only не применяется.\n";
+            else if (!scanUsedBlocks(inFile, srcSize, sector, copyOpts, out, err)) return 1;
+        }
+        // Поблочные хэши нужны и для манифеста, и для проверки после записи
+        BlockManifest manifest(blockSize);
+        if (!opts.manifestPath.isEmpty() || opts.verify) copyOpts.manifest = &manifest;
+        StreamHash::Algo algo = StreamHash::Sha256;
+        StreamHash::parse(opts.hashAlgo, algo);
+        StreamHash streamHash(algo);
+        if (!opts.hashAlgo.isEmpty()) copyOpts.streamHash = &streamHash;
+        Checkpoint job;
+        if (!opts.checkpointPath.isEmpty()) {
+            if (copyTargets.size() > 1) { err << "Журнал возобновления — только при записи на один диск.\n"; return 1; }
+            job.mode = "write";
+            job.device = target.path;
+            job.file = QFileInfo(path).absoluteFilePath();
+            job.devOffset = devOffset;
+            job.blockSize = blockSize;
+            job.total = targetBytes;
+            job.options = jobOptions(opts);
+            job.fingerprint = Checkpoint::fingerprintOf(inFile, 0, inFile.size());
+            qint64 from = 0;
+            if (!openCheckpoint(opts, job, from, out, err)) return 1;
+            if (from >= targetBytes) { out << "Задание уже выполнено.\n"; QFile::remove(opts.checkpointPath); return 0; }
+            if (!inFile.seek(srcOffset + from) || !devs[0]->seek(devOffset + from)) { err << "Не удалось перейти к месту продолжения.\n"; return 1; }
+            targetBytes -= from;
+            copyOpts.checkpoint = &job;
+        }
+        if (opts.stripes > 1) {
+            // Полосы пишутся не по порядку — только сырой образ на одно устройство
+            if (top) { err << "Копирование полосами не работает с образом RWI и дельтами.\n"; return 1; }
+            if (copyTargets.size() > 1) { err << "Копирование полосами — только на одно устройство.\n"; return 1; }
+            return DiskIO::copyStriped(inFile, *devs[0], targetBytes, blockSize, true, out, err, copyOpts) ? 0 : 2;
+        }
+        if (opts.zeroCopy) {
+            // Ядро переносит байты как есть — только сырой образ на одно устройство
+            if (top) { err << "Копирование ядром не работает с образом RWI и дельтами.\n"; return 1; }
+            if (copyTargets.size() > 1) { err << "Копирование ядром — только на одно устройство.\n"; return 1; }
+            return DiskIO::copyInKernel(inFile, *devs[0], targetBytes, blockSize, sector, true, out, err, copyOpts) ? 0 : 2;
+        }
+        // Второй дескриптор устройства на чтение: открытый на запись читать не умеет
+        QFile current;
+        if (opts.skipSame) {
+            quint32 lc=target.logicalSector, pc=target.physicalSector;
+            if (!DiskIO::openRead(target.path, current, diag, lc, pc, opts.directIo)) { err << "Не открыть устройство " << target.path << " для сравнения. " << diag << "\n"; return 1; }
+            copyOpts.compareWith = &current;
+        }
+        bool okCopy = DiskIO::copyToMany(inFile, copyTargets, targetBytes, blockSize, sector, true, out, err, copyOpts);
+        bool anyOk = false;
+        for (const CopyTarget &t : copyTargets) anyOk = anyOk || t.ok;
+        if (!anyOk) return 2;
+        if (copyOpts.checkpoint) QFile::remove(opts.checkpointPath);
+        if (copyOpts.streamHash) out << streamHash.name() << " записанного: " << streamHash.hex() << "\n";
+        if (!opts.manifestPath.isEmpty() && !manifest.save(opts.manifestPath, diag)) {
+            err << "Не сохранить манифест: " << diag << "\n";
+            return 2;
+        }
+        // Проверяются только устройства, запись на которые прошла
+        bool okVerify = true;
+        if (opts.verify) {
+            for (int i=0;i<copyTargets.size();++i) {
+                if (!copyTargets[i].ok) continue;
+                devs[i]->close();
+                if (copyTargets.size() > 1) out << "\n" << copyTargets[i].name << ":";
+                okVerify = DiskIO::verifyWritten(copyTargets[i].name, devOffset, targetBytes, sector, manifest, out, err, copyOpts) && okVerify;
+            }
+        }
+        if (!okCopy) return 2;
+        return okVerify ? 0 : 3;
+
+    } else {
+        QFile dev;
+        QString diag;
+        quint32 l=target.logicalSector, p=target.physicalSector;
+        if (!DiskIO::openRead(target.path, dev, diag, l, p, opts.directIo)) {
+            err << "Не открыть устройство для чтения. " << diag << "\n";
+#ifdef Q_OS_WIN
+            err << "Подсказки: Админ-права, закрыть Проводник/антивирус, выбрать именно \\\\.\\PhysicalDriveN.\n";
+#else
+            err << "Подсказки: sudo/root; umount всех разделов устройства; убедитесь, что это весь диск (/dev/sdX).\n";
+#endif
+            return 1;
+        }
+        if (devOffset>0 && !dev.seek(devOffset)) { err << "Не удалось перейти на указанное смещение устройства.\n"; return 1; }
+
+        // Спасение по существующей карте дописывает уже начатый результат
+        QFile outFile(path);
+        const bool resumeRescue = !opts.rescueMap.isEmpty() && QFileInfo::exists(opts.rescueMap);
+        if (!outFile.open(resumeRescue || opts.resume ? QIODevice::ReadWrite : QIODevice::WriteOnly | QIODevice::Truncate)) { err << "Не открыть выходной файл: " << outFile.errorString() << "\n"; return 1; }
+
+        qint64 toRead = limit;
+        if (toRead > 0) {
+            toRead = floorTo(toRead, sector);
+            if (toRead == 0) { err << "Лимит меньше размера сектора. Увеличьте лимит.\n"; return 1; }
+        }
+
+        CopyOptions copyOpts = opts;
+        if (opts.usedOnly) {
+            if (target.size == 0) { err << "Размер устройства неизвестен, --used-only невозможен.\n"; return 1; }
+            if (!scanUsedBlocks(dev, qint64(target.size), target.logicalSector, copyOpts, out, err)) return 1;
+            // Свободное место не читается: в файле вместо него дырки
+            const qint64 rest = floorTo(qint64(target.size) - devOffset, sector);
+            if (toRead <= 0 || toRead > rest) toRead = rest;
+            if (copyOpts.zeroBlocks == CopyOptions::ZeroBlocks::Write) copyOpts.zeroBlocks = CopyOptions::ZeroBlocks::Skip;
+        }
+        if (autoBlock) {
+            // Размер устройства неизвестен — замер до конца устройства или 32 МиБ
+            const qint64 span = toRead > 0 ? toRead : target.size > 0 ? qint64(target.size) - devOffset : qint64(32) * 1024 * 1024;
+            tuneBlockSize(target.path, false, devOffset, span, sector, blockSize, copyOpts, out);
+        }
+
+        // Дельта сравнивает блоки с манифестом прошлого прогона, поэтому сетка блоков должна совпадать
+        BlockManifest baseManifest;
+        if (!opts.baseManifestPath.isEmpty()) {
+            if (!baseManifest.load(opts.baseManifestPath, diag)) { err << "Не прочитать манифест " << opts.baseManifestPath << ": " << diag << "\n"; return 1; }
+            if (baseManifest.blockSize() != blockSize) {
+                err << "Размер блока манифеста (" << baseManifest.blockSize() << ") не совпадает с размером блока (" << blockSize << ").\n";
+                return 1;
+            }
+        }
+
+        // В хранилище чанков --compress сжимает сами чанки
+        std::unique_ptr<ChunkStore> store;
+        std::unique_ptr<ChunkStoreWriterEngine> chunks;
+        if (!opts.chunkStore.isEmpty()) {
+            ChunkStore::Chunking mode = ChunkStore::ContentDefined;
+            quint32 chunkSize = 0;
+            int codec=ImageFile::Stored, level=0;
+            ChunkStore::parseChunking(opts.chunking, mode, chunkSize, diag);
+            if (!opts.compress.isEmpty()) ImageFile::parseCodec(opts.compress, codec, level, diag);
+            store.reset(new ChunkStore(opts.chunkStore));
+            if (!store->open(true, diag)) { err << "Не открыть хранилище чанков: " << diag << "\n"; return 1; }
+            chunks.reset(new ChunkStoreWriterEngine(*store, outFile, mode, chunkSize, codec, level, opts.threads));
+        }
+        std::unique_ptr<ImageWriterEngine> image;
+        if (!chunks && (!opts.compress.isEmpty() || !opts.baseManifestPath.isEmpty())) {
+            int codec=ImageFile::Stored, level=0;
+            if (!opts.compress.isEmpty()) ImageFile::parseCodec(opts.compress, codec, level, diag);
+            image.reset(new ImageWriterEngine(outFile, codec, level, opts.threads));
+            if (!opts.baseManifestPath.isEmpty()) image->setDeltaBase(&baseManifest);
+            if (!image->begin(quint32(blockSize), diag)) { err << "Не записать заголовок образа: " << diag << "\n"; return 1; }
+        }
+
+        BlockManifest manifest(blockSize);
+        if (!opts.manifestPath.isEmpty()) copyOpts.manifest = &manifest;
+        StreamHash::Algo algo = StreamHash::Sha256;
+        StreamHash::parse(opts.hashAlgo, algo);
+        StreamHash streamHash(algo);
+        if (!opts.hashAlgo.isEmpty()) copyOpts.streamHash = &streamHash;
+        copyOpts.bufferAlign = p;
+        copyOpts.destEngine = image.get();
+        if (chunks) copyOpts.destEngine = chunks.get();
+        Checkpoint job;
+        if (!opts.checkpointPath.isEmpty()) {
+            // Журналу нужен конечный объём
+            if (toRead <= 0) {
+                if (target.size == 0) { err << "Размер устройства неизвестен, укажите лимит для журнала возобновления.\n"; return 1; }
+                toRead = floorTo(qint64(target.size) - devOffset, sector);
+            }
+            job.mode = "read";
+            job.device = target.path;
+            job.file = QFileInfo(path).absoluteFilePath();
+            job.devOffset = devOffset;
+            job.blockSize = blockSize;
+            job.total = toRead;
+            job.options = jobOptions(opts);
+            job.fingerprint = Checkpoint::fingerprintOf(dev, devOffset, toRead);
+            qint64 from = 0;
+            if (!openCheckpoint(opts, job, from, out, err)) return 1;
+            if (from >= toRead) { out << "Задание уже выполнено.\n"; QFile::remove(opts.checkpointPath); return 0; }
+            if (!dev.seek(devOffset + from) || !outFile.seek(from)) { err << "Не удалось перейти к месту продолжения.\n"; return 1; }
+            toRead -= from;
+            copyOpts.checkpoint = &job;
+        }
+        if (!opts.rescueMap.isEmpty()) {
+            // Карте нужен конечный диапазон
+            if (toRead <= 0) {
+                if (target.size == 0) { err << "Размер устройства неизвестен, укажите лимит для спасения.\n"; return 1; }
+                toRead = floorTo(qint64(target.size) - devOffset, sector);
+            }
+            qint64 bad = 0;
+            if (!Rescue::run(dev, outFile, toRead, blockSize, sector, bad, out, err, copyOpts)) return 2;
+            return bad > 0 ? 4 : 0;
+        }
+        if (opts.stripes > 1) {
+            // Полосам нужен конечный диапазон
+            if (toRead <= 0) {
+                if (target.size == 0) { err << "Размер устройства неизвестен, укажите лимит для копирования полосами.\n"; return 1; }
+                toRead = floorTo(qint64(target.size) - devOffset, sector);
+            }
+            return DiskIO::copyStriped(dev, outFile, toRead, blockSize, false, out, err, copyOpts) ? 0 : 2;
+        }
+        if (opts.zeroCopy) {
+            return DiskIO::copyInKernel(dev, outFile, (toRead>0? toRead : 0x7fffffffffffffffLL), blockSize, sector, false, out, err, copyOpts) ? 0 : 2;
+        }
+        bool okCopy = DiskIO::copyAlignedWithPadding(dev, outFile, (toRead>0? toRead : 0x7fffffffffffffffLL), blockSize, sector, false, out, err, copyOpts);
+        if (okCopy && image) {
+            const qint64 stored = image->storedBytes(), raw = image->rawBytes();
+            out << "Образ RWI: " << DiskIO::humanSize(raw) << " -> " << DiskIO::humanSize(stored)
+                << " (" << QString::number(raw>0 ? 100.0*stored/raw : 0.0, 'f', 1) << "%, " << image->name() << ")\n";
+            if (!opts.baseManifestPath.isEmpty()) {
+                out << "Дельта: без изменений " << DiskIO::humanSize(image->unchangedBytes())
+                    << ", изменено " << DiskIO::humanSize(raw - image->unchangedBytes()) << "\n";
+            }
+        }
+        if (okCopy && chunks) {
+            const qint64 raw = chunks->rawBytes(), fresh = chunks->newBytes(), zero = chunks->zeroBytes();
+            out << "Хранилище чанков: " << chunks->chunkCount() << " чанков (" << chunks->name() << "), новых " << chunks->newChunks()
+                << " на " << DiskIO::humanSize(fresh) << " (на диске " << DiskIO::humanSize(chunks->storedBytes()) << "), уже были в хранилище "
+                << DiskIO::humanSize(raw - fresh - zero) << ", нулевые " << DiskIO::humanSize(zero) << "\n";
+        }
+        if (okCopy && copyOpts.checkpoint) QFile::remove(opts.checkpointPath);
+        if (okCopy && copyOpts.streamHash) out << streamHash.name() << " прочитанного: " << streamHash.hex() << "\n";
+        if (okCopy && copyOpts.manifest && !manifest.save(opts.manifestPath, diag)) {
+            err << "Не сохранить манифест: " << diag << "\n";
+            return 2;
+        }
+        return okCopy ? 0 : 2;
+    }
+}
+
+// Устройство задания: диск из списка (по пути или по ссылке на него) или существующий обычный файл
+static bool resolveDisk(const QVector<DiskInfo> &disks, const QString &path, DiskInfo &out, QTextStream &err) {
+    const QString canon = QFileInfo(path).canonicalFilePath();
+    for (const DiskInfo &d : disks) {
+        if (d.path == path || (!canon.isEmpty() && QFileInfo(d.path).canonicalFilePath() == canon)) { out = d; return true; }
+    }
+    const QFileInfo fi(path);
+    if (!fi.isFile()) { err << "Устройство не найдено: " << path << "\n"; return false; }
+    out = DiskInfo();
+    out.path = path;
+    out.model = "файл";
+    out.size = quint64(fi.size());
+    return true;
+}
 
-int logicExec(){
+// Пакетный режим: проверить задания и выполнить их планировщиком Batch. Возвращает код возврата программы.
+static int runBatch(QVector<BatchJob> &jobs, const CopyOptions &opts, int parallel, const QString &logDir, bool confirmed,
+                    const QString &statsSpec, int statsMs) {
+    QTextStream out(stdout), err(stderr);
+    if (jobs.isEmpty()) { err << "Нет заданий.\n"; return 1; }
+    for (int i=0;i<jobs.size();++i) {
+        for (int j=0;j<i;++j) {
+            if (jobs[i].name == jobs[j].name) { err << "Имя задания повторяется: " << jobs[i].name << "\n"; return 1; }
+        }
+        if (jobs[i].write && !confirmed) {
+            err << "Задание " << jobs[i].name << " пишет на " << jobs[i].disks.join(", ")
+                << ": запись уничтожает данные на устройствах, подтвердите ключом --yes.\n";
+            return 1;
+        }
+    }
+    const QVector<DiskInfo> disks = DiskIO::enumerate(err);
+
+    out << "=== RawWriter: пакет из " << jobs.size() << " заданий, одновременно до " << parallel << " ===\n" << Qt::flush;
+    auto runner = [&](BatchJob &job, QTextStream &jobOut, QTextStream &jobErr) -> int {
+        CopyOptions o = opts;
+        o.manifestPath = job.manifest;
+        o.baseManifestPath = job.baseManifest;
+        o.deltas = job.deltas;
+        o.checkpointPath = job.checkpoint;
+        o.rescueMap = job.rescue;
+        o.sourcePart = job.sourcePart;
+        o.sourceRange.offset = job.sourceOffset;
+        o.sourceRange.length = job.sourceLength;
+        if (!checkOptions(o, jobErr)) return 1;
+        QVector<DiskInfo> targets;
+        for (const QString &path : job.disks) {
+            DiskInfo d;
+            if (!resolveDisk(disks, path, d, jobErr)) return 1;
+            for (const DiskInfo &t : targets) {
+                if (t.path == d.path) { jobErr << "Устройство указано дважды: " << d.path << "\n"; return 1; }
+            }
+            targets.push_back(d);
+        }
+        if (!checkJob(targets, job.write, job.autoBlock, job.blockSize, job.offset, o, jobErr)) return 1;
+        if (job.write && !QFileInfo::exists(job.file)) { jobErr << "Входной файл не найден: " << job.file << "\n"; return 1; }
+
+        // У каждого задания своя телеметрия; строки всех заданий идут в один поток с меткой задания
+        Telemetry tel;
+        o.telemetry = &tel;
+        if (!statsSpec.isEmpty()) {
+            QString diag;
+            tel.setLabel(job.name);
+            if (!tel.open(statsSpec, statsMs, diag)) { jobErr << "Не открыть поток статистики " << statsSpec << ": " << diag << "\n"; return 1; }
+        }
+        const int code = runTransfer(targets, job.write, job.autoBlock, job.blockSize, job.offset, job.limit, job.file, o, jobOut, jobErr);
+        tel.stop(code);
+        return code;
+    };
+    return Batch::run(jobs, parallel, logDir, runner, out);
+}
+
+int logicExec(const CopyOptions &opts){
     QTextStream out(stdout), err(stderr);
 
     out << "=== RawWriter ===\n";
@@ -27,15 +661,24 @@ int logicExec(){
             << "\n";
     }
 
-    out << "\nВведите индекс диска для работы: " << Qt::flush;
+    // Для записи можно указать несколько дисков: образ читается один раз и пишется на все сразу
+    out << "\nВведите индекс диска для работы (для записи можно несколько через запятую): " << Qt::flush;
     bool ok=false;
-    QString sIdx = QTextStream(stdin).readLine().trimmed();
-    int idx = sIdx.toInt(&ok);
-    if (!ok || idx < 0 || idx >= disks.size()) {
-        err << "Некорректный индекс.\n";
-        return 1;
+    QVector<DiskInfo> targets;
+    const QStringList idxList = QTextStream(stdin).readLine().replace(',', ' ').split(' ', Qt::SkipEmptyParts);
+    for (const QString &sIdx : idxList) {
+        int idx = sIdx.toInt(&ok);
+        if (!ok || idx < 0 || idx >= disks.size()) {
+            err << "Некорректный индекс: " << sIdx << "\n";
+            return 1;
+        }
+        for (const DiskInfo &d : targets) {
+            if (d.path == disks[idx].path) { err << "Диск " << idx << " указан дважды.\n"; return 1; }
+        }
+        targets.push_back(disks[idx]);
     }
-    const DiskInfo target = disks[idx];
+    if (targets.isEmpty()) { err << "Некорректный индекс.\n"; return 1; }
+    const DiskInfo target = targets[0];
 
     out << "Режим (write/read) [w/r]: " << Qt::flush;
     QString mode = QTextStream(stdin).readLine().trimmed().toLower();
@@ -45,9 +688,11 @@ int logicExec(){
     }
     bool isWrite = (mode=="w" || mode=="write");
 
-    out << "Размер блока, байт [1048576]: " << Qt::flush;
-    QString bsStr = QTextStream(stdin).readLine().trimmed();
-    qint64 blockSize = bsStr.isEmpty() ? 1048576 : bsStr.toLongLong(&ok);
+    out << "Размер блока, байт [1048576, auto — подобрать замером]: " << Qt::flush;
+    QString bsStr = QTextStream(stdin).readLine().trimmed().toLower();
+    // auto: размер блока выбирается коротким замером на самом устройстве, перед копированием
+    const bool autoBlock = bsStr == "auto";
+    qint64 blockSize = bsStr.isEmpty() ? 1048576 : autoBlock ? 1048576 : bsStr.toLongLong(&ok);
     if (!ok || blockSize <= 0) { err << "Некорректный размер блока.\n"; return 1; }
 
     out << "Смещение на устройстве, байт [0]: " << Qt::flush;
@@ -60,58 +705,33 @@ int logicExec(){
     qint64 limit = -1;
     if (!limStr.isEmpty()) { limit = limStr.toLongLong(&ok); if (!ok || limit <= 0) { err<<"Некорректный лимит.\n"; return 1; } }
 
-    const qint64 sector = std::max<qint64>(target.logicalSector, 512);
-    if ((devOffset % sector) != 0) {
-        err << "Смещение должно быть кратно размеру логического сектора (" << sector << " байт). Сейчас: " << devOffset << ".\n";
-        return 1;
-    }
-    if ((blockSize % sector) != 0) {
-        err << "Размер блока должен быть кратен " << sector << " байт. Сейчас: " << blockSize << ".\n";
-        return 1;
-    }
+    if (!checkJob(targets, isWrite, autoBlock, blockSize, devOffset, opts, err)) return 1;
 
     if (isWrite) {
         out << "Путь к входному файлу-образу: " << Qt::flush;
         QString inPath = QTextStream(stdin).readLine().trimmed();
         if (inPath.isEmpty() || !QFileInfo::exists(inPath)) { err << "Входной файл не найден.\n"; return 1; }
+        CopyOptions o = opts;
+        qint64 sector = 512;
+        for (const DiskInfo &d : targets) sector = std::max<qint64>(sector, d.logicalSector);
+        if (!askSourcePart(inPath, sector, o, out, err)) return 1;
 
-        out << "\nВНИМАНИЕ! Будет перезаписано устройство: " << target.path
-            << "\nМодель: " << target.model
-            << "\nРазмер: " << DiskIO::humanSize(target.size)
-            << "\nСектор: логический " << target.logicalSector << ", физический " << target.physicalSector
-            << "\nРежим: WRITE"
+        for (const DiskInfo &d : targets) {
+            out << "\nВНИМАНИЕ! Будет перезаписано устройство: " << d.path
+                << "\nМодель: " << d.model
+                << "\nРазмер: " << DiskIO::humanSize(d.size)
+                << "\nСектор: логический " << d.logicalSector << ", физический " << d.physicalSector << "\n";
+        }
+        out << "Режим: WRITE"
             << "\nФайл: " << inPath
             << "\nСмещение: " << devOffset
-            << "\nЛимит: " << (limit<0?QString("весь файл"):QString::number(limit))
-            << "\nПродолжить? (yes/NO): " << Qt::flush;
+            << "\nЛимит: " << (limit<0?QString("весь файл"):QString::number(limit));
+        if (o.sourcePart >= 0) out << "\nЧасть образа: раздел " << o.sourcePart;
+        if (o.sourceRange.length > 0) out << "\nЧасть образа: " << o.sourceRange.offset << ":" << o.sourceRange.length;
+        out << "\nПродолжить? (yes/NO): " << Qt::flush;
         QString conf = QTextStream(stdin).readLine().trimmed().toLower();
         if (conf != "yes") { out << "Отменено пользователем.\n"; return 0; }
-
-        QFile inFile(inPath);
-        if (!inFile.open(QIODevice::ReadOnly)) { err << "Не открыть входной файл: " << inFile.errorString() << "\n"; return 1; }
-
-        QFile dev;
-        QString diag;
-        quint32 l=target.logicalSector, p=target.physicalSector;
-        if (!DiskIO::openWrite(target.path, dev, diag, l, p)) {
-            err << "Не открыть устройство для записи. " << diag << "\n";
-#ifdef Q_OS_WIN
-            err << "Подсказки: Админ-права, размонтировать том (mountvol/diskpart), закрыть Проводник/антивирус, выбрать именно \\\\.\\PhysicalDriveN.\n";
-#else
-            err << "Подсказки: sudo/root; umount всех разделов устройства; убедитесь, что это весь диск (/dev/sdX).\n";
-#endif
-            return 1;
-        }
-        if (devOffset>0 && !dev.seek(devOffset)) { err << "Не удалось перейти на указанное смещение устройства.\n"; return 1; }
-
-        qint64 srcSize = inFile.size();
-        qint64 base = (limit < 0) ? srcSize : std::min<qint64>(limit, srcSize);
-        qint64 targetBytes = ceilTo(base, sector);
-        if (targetBytes == 0) targetBytes = sector;
-
-        bool okCopy = DiskIO::copyAlignedWithPadding(inFile, dev, targetBytes, blockSize, sector, true, out, err);
-        return okCopy ? 0 : 2;
-
+        return runTransfer(targets, true, autoBlock, blockSize, devOffset, limit, inPath, o, out, err);
     } else {
         out << "Путь для выходного файла (куда читать с устройства): " << Qt::flush;
         QString outPath = QTextStream(stdin).readLine().trimmed();
@@ -128,32 +748,7 @@ int logicExec(){
             << "\nПродолжить? (yes/NO): " << Qt::flush;
         QString conf = QTextStream(stdin).readLine().trimmed().toLower();
         if (conf != "yes") { out << "Отменено пользователем.\n"; return 0; }
-
-        QFile dev;
-        QString diag;
-        quint32 l=target.logicalSector, p=target.physicalSector;
-        if (!DiskIO::openRead(target.path, dev, diag, l, p)) {
-            err << "Не открыть устройство для чтения. " << diag << "\n";
-#ifdef Q_OS_WIN
-            err << "Подсказки: Админ-права, закрыть Проводник/антивирус, выбрать именно \\\\.\\PhysicalDriveN.\n";
-#else
-            err << "Подсказки: sudo/root; umount всех разделов устройства; убедитесь, что это весь диск (/dev/sdX).\n";
-#endif
-            return 1;
-        }
-        if (devOffset>0 && !dev.seek(devOffset)) { err << "Не удалось перейти на указанное смещение устройства.\n"; return 1; }
-
-        QFile outFile(outPath);
-        if (!outFile.open(QIODevice::WriteOnly | QIODevice::Truncate)) { err << "Не открыть выходной файл: " << outFile.errorString() << "\n"; return 1; }
-
-        qint64 toRead = limit;
-        if (toRead > 0) {
-            toRead = floorTo(toRead, sector);
-            if (toRead == 0) { err << "Лимит меньше размера сектора. Увеличьте лимит.\n"; return 1; }
-        }
-
-        bool okCopy = DiskIO::copyAlignedWithPadding(dev, outFile, (toRead>0? toRead : 0x7fffffffffffffffLL), blockSize, sector, false, out, err);
-        return okCopy ? 0 : 2;
+        return runTransfer(targets, false, autoBlock, blockSize, devOffset, limit, outPath, opts, out, err);
     }
 }
 
@@ -164,7 +759,267 @@ int main(int argc, char *argv[]) {
 #ifdef Q_OS_WIN
 system("chcp 65001");
 #endif
-auto retVal=logicExec();
+QCommandLineParser parser;
+parser.setApplicationDescription("RawWriter: посекторное чтение/запись диска");
+parser.addHelpOption();
+parser.addVersionOption();
+QCommandLineOption buffersOpt("buffers", "Число буферов конвейера чтение/запись (>= 2).", "N", "4");
+parser.addOption(buffersOpt);
+QCommandLineOption directOpt("direct", "Работать с устройством мимо кэша ОС (O_DIRECT / FILE_FLAG_NO_BUFFERING).");
+parser.addOption(directOpt);
+QCommandLineOption engineOpt("engine", "Движок ввода-вывода: " + IoEngine::available().join(", ") + ".", "name", "sync");
+parser.addOption(engineOpt);
+QCommandLineOption qdOpt("queue-depth", "Запросов в полёте на чтение и на запись (для движка uring).", "N", "8");
+parser.addOption(qdOpt);
+QCommandLineOption zeroOpt("zero-blocks", "Нулевые блоки на стороне записи: write, skip, zeroout, discard. "
+                           "При чтении в файл любой режим кроме write даёт разреженный (sparse) образ.", "mode", "write");
+parser.addOption(zeroOpt);
+QCommandLineOption durabilityOpt("durability", "Когда записанное попадает на носитель: final — один сброс в конце; periodic — порциями "
+                                  "(--sync-every, Linux sync_file_range), прогресс и скорость — по тому, что уже на носителе; "
+                                  "write-through — каждая запись синхронная (O_DSYNC / FILE_FLAG_WRITE_THROUGH).", "policy", "periodic");
+parser.addOption(durabilityOpt);
+QCommandLineOption syncEveryOpt("sync-every", "Порция записи на носитель для --durability periodic, МиБ.", "MiB", "64");
+parser.addOption(syncEveryOpt);
+QCommandLineOption compressOpt("compress", "При чтении писать сжатый образ RWI с индексом: " + ImageFile::availableCodecs().join(", ") +
+                               "; уровень через двоеточие, например zstd:9. При записи образ RWI распознаётся сам.", "codec[:level]");
+parser.addOption(compressOpt);
+QCommandLineOption threadsOpt("threads", "Потоков сжатия/распаковки образа RWI и загрузки чанков хранилища.", "N", QString::number(QThread::idealThreadCount()));
+parser.addOption(threadsOpt);
+QCommandLineOption chunkStoreOpt("chunk-store", "Хранилище чанков: при чтении данные режутся на чанки и каждый уникальный чанк сохраняется "
+                                 "в каталоге один раз, а файл образа — небольшой рецепт из ссылок на чанки; при записи файл — рецепт "
+                                 "из этого хранилища. Сжатие чанков — ключом --compress.", "dir");
+parser.addOption(chunkStoreOpt);
+QCommandLineOption chunkingOpt("chunking", "Нарезка на чанки: fixed:размер или cdc:средний размер (по содержимому, "
+                               "повторы находятся и после сдвига данных).", "spec", "cdc:1048576");
+parser.addOption(chunkingOpt);
+QCommandLineOption manifestOpt("manifest", "Сохранить манифест: XXH64 каждого блока переданных данных.", "file");
+parser.addOption(manifestOpt);
+QCommandLineOption baseManifestOpt("base-manifest", "При чтении писать дельта-образ RWI: только блоки, изменившиеся "
+                                   "относительно прогона с этим манифестом (размер блока должен совпадать).", "file");
+parser.addOption(baseManifestOpt);
+QCommandLineOption deltaOpt("delta", "При записи наложить дельта-образ поверх входного образа; "
+                            "ключ повторяется для цепочки, от старой дельты к новой.", "file");
+parser.addOption(deltaOpt);
+QCommandLineOption hashOpt("hash", "Считать контрольную сумму всех переданных данных (sha256 или xxh64) "
+                           "в отдельном потоке, параллельно с записью.", "algo");
+parser.addOption(hashOpt);
+QCommandLineOption verifyOpt("verify", "После записи перечитать записанное с устройства мимо кэша и сравнить поблочные XXH64.");
+parser.addOption(verifyOpt);
+QCommandLineOption stripesOpt("stripes", "Копировать полосами в N потоков позиционными pread/pwrite (для NVMe и RAID). "
+                              "Несовместимо со сжатием, дельтами, хэшами и записью на несколько дисков.", "N", "0");
+parser.addOption(stripesOpt);
+QCommandLineOption stripeSizeOpt("stripe-size", "Размер полосы в байтах, округляется до целого числа блоков.", "bytes", "67108864");
+parser.addOption(stripeSizeOpt);
+QCommandLineOption zeroCopyOpt("zero-copy", "Копировать средствами ядра (Linux: copy_file_range, иначе splice) без буферов "
+                                "в памяти процесса: меньше нагрузка на ЦП. Только сырой образ без сжатия, дельт, хэшей, проверки "
+                                "и пропуска нулевых блоков.");
+parser.addOption(zeroCopyOpt);
+QCommandLineOption skipSameOpt("skip-same", "Запись: перед записью читать текущее содержимое устройства и писать только отличающиеся "
+                               "блоки. Быстрее при повторной прошивке почти того же образа и бережёт ресурс флеш-памяти.");
+parser.addOption(skipSameOpt);
+QCommandLineOption lagOpt("lag-timeout", "Запись на несколько дисков: если отставший диск держит все буферы и остальные ждут его "
+                          "дольше стольких секунд, он отключается с ошибкой, остальные дописываются (0 — ждать сколько угодно).", "sec", "30");
+parser.addOption(lagOpt);
+QCommandLineOption rescueOpt("rescue", "Чтение с умирающего диска проходами: сначала большими блоками в обход ошибок, "
+                             "потом по секторам, потом повторы. Карта (формат ddrescue) в файле, повторный запуск продолжает.", "mapfile");
+parser.addOption(rescueOpt);
+QCommandLineOption retriesOpt("rescue-retries", "Сколько раз перечитывать плохие сектора при --rescue.", "N", "1");
+parser.addOption(retriesOpt);
+QCommandLineOption slowOpt("rescue-slow", "При --rescue блок, читавшийся дольше стольких миллисекунд, считается плохим местом "
+                           "и первый проход перепрыгивает дальше (0 — не следить).", "ms", "1000");
+parser.addOption(slowOpt);
+QCommandLineOption checkpointOpt("checkpoint", "Вести журнал возобновления: параметры задания, отпечаток источника "
+                                 "и сколько байт уже сброшено на носитель. После успешного завершения журнал удаляется.", "file");
+parser.addOption(checkpointOpt);
+QCommandLineOption checkpointEveryOpt("checkpoint-every", "Как часто сбрасывать данные на носитель и обновлять журнал, МиБ.", "MiB", "1024");
+parser.addOption(checkpointEveryOpt);
+QCommandLineOption resumeOpt("resume", "Продолжить прерванное задание по журналу --checkpoint (параметры и источник должны совпасть).");
+parser.addOption(resumeOpt);
+QCommandLineOption usedOpt("used-only", "Читать только занятые блоки: разделы MBR/GPT, битмапы ext2/3/4, FAT16/32, NTFS. "
+                           "Неизвестные разделы и место вне разделов копируются целиком.");
+parser.addOption(usedOpt);
+QCommandLineOption sourcePartOpt("source-part", "Запись: взять из сырого образа только раздел N его таблицы MBR/GPT (номер — как в списке "
+                                 "разделов) и записать его со смещения на устройстве. Образ читается сразу с начала раздела.", "N");
+parser.addOption(sourcePartOpt);
+QCommandLineOption sourceRangeOpt("source-range", "Запись: взять из образа только диапазон байт смещение:длина (суффиксы K, M, G, T). "
+                                  "Смещение и длина должны быть кратны сектору устройства.", "off:len");
+parser.addOption(sourceRangeOpt);
+QCommandLineOption statsOpt("stats", "Писать статистику передачи строками JSON: задержки чтения/записи/сброса (p50/p99/max), "
+                            "скорость и простой каждой стороны; в конце — итоговая строка. Файл (дописывается) или fd:N.", "file|fd:N");
+parser.addOption(statsOpt);
+QCommandLineOption statsIntervalOpt("stats-interval", "Интервал строк статистики, секунд.", "sec", "1");
+parser.addOption(statsIntervalOpt);
+QCommandLineOption bwlimitOpt("bwlimit", "Ограничить скорость чтения и записи (каждой): байт/с с суффиксом K, M, G, например 50M. "
+                              "В пакетном режиме лимит общий на все задания.", "rate");
+parser.addOption(bwlimitOpt);
+QCommandLineOption iopsOpt("iops", "Ограничить число операций чтения и записи (каждых) в секунду.", "N");
+parser.addOption(iopsOpt);
+QCommandLineOption throttleFileOpt("throttle-file", "Файл управления лимитами: перечитывается раз в полсекунды, строки "
+                                   "bwlimit=50M и iops=200 (0 или off — без ограничения) меняют лимит на ходу.", "file");
+parser.addOption(throttleFileOpt);
+QCommandLineOption ioprioOpt("ioprio", "Приоритет ввода-вывода процесса: idle (только когда диск свободен) или be[:0-7] "
+                             "(обычный, 0 — высший). Linux; в Windows — idle как фоновый режим.", "class");
+parser.addOption(ioprioOpt);
+QCommandLineOption jobsOpt("jobs", "Пакетный режим: задания из файла (- — stdin), по одному в строке: "
+                           "mode=read|write disk=путь[,путь] file=образ [block=байт|auto] [offset=] [limit=] [name=] "
+                           "[manifest=] [base-manifest=] [delta=] [checkpoint=] [rescue=] [source-part=] [source-range=]. Ключ повторяется.", "file");
+parser.addOption(jobsOpt);
+QCommandLineOption jobOpt("job", "Пакетный режим: одно задание в том же формате, что строка файла --jobs. Ключ повторяется.", "spec");
+parser.addOption(jobOpt);
+QCommandLineOption parallelOpt("parallel", "Пакетный режим: сколько заданий выполнять одновременно "
+                               "(задания на одном устройстве или с одним файлом всё равно идут по очереди).", "N", "4");
+parser.addOption(parallelOpt);
+QCommandLineOption logDirOpt("log-dir", "Пакетный режим: отчёт каждого задания в файл <каталог>/<имя>.log.", "dir");
+parser.addOption(logDirOpt);
+QCommandLineOption yesOpt("yes", "Пакетный режим: подтвердить запись на устройства заранее (без этого задания записи не выполняются).");
+parser.addOption(yesOpt);
+parser.process(app);
+
+// Манифесты, дельты и хранилище чанков сравнивают XXH64 с посчитанными в прошлых прогонах и другими сборками
+if (!Xxh64::selfTest()) { QTextStream(stderr) << "XXH64 расходится с эталонными значениями xxHash: ошибка сборки.\n"; return 1; }
+
+CopyOptions opts;
+bool ok=false;
+opts.bufferCount = parser.value(buffersOpt).toInt(&ok);
+if (!ok || opts.bufferCount < 2) { QTextStream(stderr) << "Некорректное число буферов: " << parser.value(buffersOpt) << "\n"; return 1; }
+opts.directIo = parser.isSet(directOpt);
+opts.ioEngine = parser.value(engineOpt).trimmed().toLower();
+opts.queueDepth = parser.value(qdOpt).toInt(&ok);
+if (!ok || opts.queueDepth < 1) { QTextStream(stderr) << "Некорректная глубина очереди: " << parser.value(qdOpt) << "\n"; return 1; }
+const QString zeroMode = parser.value(zeroOpt).trimmed().toLower();
+if (zeroMode == "write")        opts.zeroBlocks = CopyOptions::ZeroBlocks::Write;
+else if (zeroMode == "skip")    opts.zeroBlocks = CopyOptions::ZeroBlocks::Skip;
+else if (zeroMode == "zeroout") opts.zeroBlocks = CopyOptions::ZeroBlocks::ZeroOut;
+else if (zeroMode == "discard") opts.zeroBlocks = CopyOptions::ZeroBlocks::Discard;
+else { QTextStream(stderr) << "Некорректный режим нулевых блоков: " << zeroMode << "\n"; return 1; }
+const QString durability = parser.value(durabilityOpt).trimmed().toLower();
+if (durability == "final")              opts.durability = CopyOptions::Durability::Final;
+else if (durability == "periodic")      opts.durability = CopyOptions::Durability::Periodic;
+else if (durability == "write-through") opts.durability = CopyOptions::Durability::WriteThrough;
+else { QTextStream(stderr) << "Некорректная политика сохранности: " << durability << " (final, periodic, write-through)\n"; return 1; }
+opts.syncEvery = parser.value(syncEveryOpt).toLongLong(&ok) * 1024 * 1024;
+if (!ok || opts.syncEvery <= 0) { QTextStream(stderr) << "Некорректная порция сброса: " << parser.value(syncEveryOpt) << "\n"; return 1; }
+opts.usedOnly = parser.isSet(usedOpt);
+if (parser.isSet(sourcePartOpt)) {
+    opts.sourcePart = parser.value(sourcePartOpt).toInt(&ok);
+    if (!ok || opts.sourcePart < 0) { QTextStream(stderr) << "Некорректный номер раздела: " << parser.value(sourcePartOpt) << "\n"; return 1; }
+}
+if (parser.isSet(sourceRangeOpt)) {
+    QString diag;
+    if (!UsedBlocks::parseRange(parser.value(sourceRangeOpt), opts.sourceRange, diag)) { QTextStream(stderr) << "Некорректный --source-range: " << diag << "\n"; return 1; }
+}
+if (opts.sourcePart >= 0 && opts.sourceRange.length > 0) { QTextStream(stderr) << "--source-part и --source-range — что-то одно.\n"; return 1; }
+opts.manifestPath = parser.value(manifestOpt);
+opts.baseManifestPath = parser.value(baseManifestOpt);
+opts.deltas = parser.values(deltaOpt);
+opts.verify = parser.isSet(verifyOpt);
+if (parser.isSet(hashOpt)) {
+    StreamHash::Algo algo;
+    opts.hashAlgo = parser.value(hashOpt).trimmed().toLower();
+    if (!StreamHash::parse(opts.hashAlgo, algo)) { QTextStream(stderr) << "Некорректный алгоритм суммы: " << opts.hashAlgo << "\n"; return 1; }
+}
+opts.stripes = parser.value(stripesOpt).toInt(&ok);
+if (!ok || opts.stripes < 0) { QTextStream(stderr) << "Некорректное число полос: " << parser.value(stripesOpt) << "\n"; return 1; }
+opts.stripeSize = parser.value(stripeSizeOpt).toLongLong(&ok);
+if (!ok || opts.stripeSize <= 0) { QTextStream(stderr) << "Некорректный размер полосы: " << parser.value(stripeSizeOpt) << "\n"; return 1; }
+opts.zeroCopy = parser.isSet(zeroCopyOpt);
+opts.skipSame = parser.isSet(skipSameOpt);
+const double lagSecs = parser.value(lagOpt).toDouble(&ok);
+if (!ok || lagSecs < 0) { QTextStream(stderr) << "Некорректный --lag-timeout: " << parser.value(lagOpt) << "\n"; return 1; }
+opts.lagTimeoutMs = int(lagSecs * 1000);
+opts.rescueMap = parser.value(rescueOpt);
+opts.rescueRetries = parser.value(retriesOpt).toInt(&ok);
+if (!ok || opts.rescueRetries < 0) { QTextStream(stderr) << "Некорректное число повторов: " << parser.value(retriesOpt) << "\n"; return 1; }
+opts.rescueSlowMs = parser.value(slowOpt).toInt(&ok);
+if (!ok || opts.rescueSlowMs < 0) { QTextStream(stderr) << "Некорректный порог медленного чтения: " << parser.value(slowOpt) << "\n"; return 1; }
+opts.checkpointPath = parser.value(checkpointOpt);
+opts.checkpointEvery = parser.value(checkpointEveryOpt).toLongLong(&ok) * 1024 * 1024;
+if (!ok || opts.checkpointEvery <= 0) { QTextStream(stderr) << "Некорректный интервал журнала: " << parser.value(checkpointEveryOpt) << "\n"; return 1; }
+opts.resume = parser.isSet(resumeOpt);
+opts.threads = parser.value(threadsOpt).toInt(&ok);
+if (!ok || opts.threads < 1) { QTextStream(stderr) << "Некорректное число потоков: " << parser.value(threadsOpt) << "\n"; return 1; }
+if (parser.isSet(compressOpt)) {
+    int codec=0, level=0;
+    QString diag;
+    opts.compress = parser.value(compressOpt).trimmed();
+    if (!ImageFile::parseCodec(opts.compress, codec, level, diag)) { QTextStream(stderr) << "Некорректное сжатие: " << diag << "\n"; return 1; }
+}
+opts.chunkStore = parser.value(chunkStoreOpt);
+opts.chunking = parser.value(chunkingOpt);
+{
+    ChunkStore::Chunking mode;
+    quint32 size = 0;
+    QString diag;
+    if (!ChunkStore::parseChunking(opts.chunking, mode, size, diag)) { QTextStream(stderr) << "Некорректная нарезка: " << diag << "\n"; return 1; }
+}
+
+// Приоритет ставится до запуска потоков: они его наследуют
+if (parser.isSet(ioprioOpt)) {
+    QString diag;
+    if (!IoThrottle::setIoPriority(parser.value(ioprioOpt), diag)) { QTextStream(stderr) << "Не задать приоритет ввода-вывода: " << diag << "\n"; return 1; }
+}
+// Один ограничитель на весь процесс: в пакетном режиме лимит общий
+IoThrottle throttle;
+{
+    qint64 bw = 0;
+    int iops = 0;
+    QString diag;
+    if (parser.isSet(bwlimitOpt) && !IoThrottle::parseRate(parser.value(bwlimitOpt), bw, diag)) { QTextStream(stderr) << "Некорректный --bwlimit: " << diag << "\n"; return 1; }
+    if (parser.isSet(iopsOpt)) {
+        iops = parser.value(iopsOpt).toInt(&ok);
+        if (!ok || iops < 0) { QTextStream(stderr) << "Некорректное --iops: " << parser.value(iopsOpt) << "\n"; return 1; }
+    }
+    throttle.setLimits(bw, iops);
+    if (parser.isSet(throttleFileOpt) && !throttle.watch(parser.value(throttleFileOpt), diag)) {
+        QTextStream(stderr) << "Не прочитать файл управления " << parser.value(throttleFileOpt) << ": " << diag << "\n";
+        return 1;
+    }
+    if (parser.isSet(bwlimitOpt) || parser.isSet(iopsOpt) || parser.isSet(throttleFileOpt)) opts.throttle = &throttle;
+}
+
+const double statsSecs = parser.value(statsIntervalOpt).toDouble(&ok);
+if (!ok || statsSecs < 0.1) { QTextStream(stderr) << "Некорректный интервал статистики: " << parser.value(statsIntervalOpt) << "\n"; return 1; }
+
+if (parser.isSet(jobsOpt) || parser.isSet(jobOpt)) {
+    // Пакетный режим: без вопросов и без ожидания Enter в конце
+    QTextStream err(stderr);
+    if (!opts.manifestPath.isEmpty() || !opts.baseManifestPath.isEmpty() || !opts.deltas.isEmpty() || !opts.checkpointPath.isEmpty() || !opts.rescueMap.isEmpty()
+        || opts.sourcePart >= 0 || opts.sourceRange.length > 0) {
+        err << "В пакетном режиме --manifest, --base-manifest, --delta, --checkpoint, --rescue, --source-part и --source-range задаются в строке задания "
+               "(manifest=, base-manifest=, delta=, checkpoint=, rescue=, source-part=, source-range=).\n";
+        return 1;
+    }
+    QVector<BatchJob> jobs;
+    QString diag;
+    for (const QString &path : parser.values(jobsOpt)) {
+        if (!Batch::load(path, jobs, diag)) { err << "Не прочитать задания " << path << ": " << diag << "\n"; return 1; }
+    }
+    for (const QString &line : parser.values(jobOpt)) {
+        BatchJob job;
+        if (!Batch::parse(line, jobs.size() + 1, job, diag)) { err << "Некорректное задание «" << line << "»: " << diag << "\n"; return 1; }
+        jobs.push_back(job);
+    }
+    const int parallel = parser.value(parallelOpt).toInt(&ok);
+    if (!ok || parallel < 1) { err << "Некорректное число одновременных заданий: " << parser.value(parallelOpt) << "\n"; return 1; }
+    const QString logDir = parser.value(logDirOpt);
+    if (!logDir.isEmpty() && !QDir().mkpath(logDir)) { err << "Не создать каталог журналов " << logDir << "\n"; return 1; }
+    return runBatch(jobs, opts, parallel, logDir, parser.isSet(yesOpt), parser.value(statsOpt), int(statsSecs * 1000));
+}
+{
+    QTextStream err(stderr);
+    if (!checkOptions(opts, err)) return 1;
+}
+
+// Задержки считаются всегда (итог печатается после копирования), строки JSON — только с --stats
+Telemetry telemetry;
+opts.telemetry = &telemetry;
+if (parser.isSet(statsOpt)) {
+    QString diag;
+    if (!telemetry.open(parser.value(statsOpt), int(statsSecs * 1000), diag)) { QTextStream(stderr) << "Не открыть поток статистики " << parser.value(statsOpt) << ": " << diag << "\n"; return 1; }
+}
+
+auto retVal=logicExec(opts);
+telemetry.stop(retVal);
 QTextStream(stdout)<<"\n\nНажмите Enter для завершения...\n";
 QTextStream(stdin).readLine();
 return retVal;
@@ -0,0 +1,84 @@
+#include "manifest.h"
+#include <QFile>
+#include <QSaveFile>
+#include <QtEndian>
+#include <algorithm>
+#include <cstring>
+
+static const char kMagic[8] = {'R','W','M','A','N','I','F','1'};
+static const int kHeaderSize = 40;
+static const quint32 kVersion = 1;
+static const quint32 kAlgoXxh64 = 1;
+
+void BlockManifest::feed(const char *data, qint64 len) {
+    while (len > 0) {
+        const qint64 n = std::min(len, m_blockSize - m_fill);
+        m_state.update(data, n);
+        m_fill += n; m_total += n;
+        data += n; len -= n;
+        if (m_fill == m_blockSize) {
+            m_hashes.push_back(m_state.digest());
+            m_state.reset();
+            m_fill = 0;
+        }
+    }
+}
+
+void BlockManifest::finish() {
+    if (m_fill == 0) return;
+    m_hashes.push_back(m_state.digest());
+    m_state.reset();
+    m_fill = 0;
+}
+
+bool BlockManifest::sameBlock(qint64 off, const char *data, qint64 len) const {
+    if (m_blockSize <= 0 || off % m_blockSize != 0) return false;
+    const qint64 i = off / m_blockSize;
+    if (i >= m_hashes.size() || len != std::min(m_blockSize, m_total - off)) return false;
+    return Xxh64::hash(data, len) == m_hashes[int(i)];
+}
+
+bool BlockManifest::save(const QString &path, QString &diag) const {
+    QByteArray buf(kHeaderSize + m_hashes.size() * 8, '\0');
+    char *p = buf.data();
+    std::memcpy(p, kMagic, 8);
+    qToLittleEndian<quint32>(kVersion, p + 8);
+    qToLittleEndian<quint32>(kAlgoXxh64, p + 12);
+    qToLittleEndian<quint64>(quint64(m_blockSize), p + 16);
+    qToLittleEndian<quint64>(quint64(m_total), p + 24);
+    qToLittleEndian<quint64>(quint64(m_hashes.size()), p + 32);
+    p += kHeaderSize;
+    for (quint64 h : m_hashes) { qToLittleEndian<quint64>(h, p); p += 8; }
+
+    // Пишем во временный файл и переименовываем: старый манифест не испортится при сбое
+    QSaveFile f(path);
+    if (!f.open(QIODevice::WriteOnly) || f.write(buf) != buf.size() || !f.commit()) {
+        diag = f.errorString();
+        return false;
+    }
+    return true;
+}
+
+bool BlockManifest::load(const QString &path, QString &diag) {
+    QFile f(path);
+    if (!f.open(QIODevice::ReadOnly)) { diag = f.errorString(); return false; }
+    const QByteArray buf = f.readAll();
+    const char *p = buf.constData();
+    if (buf.size() < kHeaderSize || std::memcmp(p, kMagic, 8) != 0) { diag = "файл не является манифестом"; return false; }
+    if (qFromLittleEndian<quint32>(p + 8) != kVersion || qFromLittleEndian<quint32>(p + 12) != kAlgoXxh64) {
+        diag = "неподдерживаемая версия манифеста";
+        return false;
+    }
+    const qint64 bs = qint64(qFromLittleEndian<quint64>(p + 16));
+    const qint64 total = qint64(qFromLittleEndian<quint64>(p + 24));
+    const qint64 n = qint64(qFromLittleEndian<quint64>(p + 32));
+    if (bs <= 0 || n != (total + bs - 1) / bs || buf.size() != kHeaderSize + n * 8) { diag = "повреждён манифест"; return false; }
+
+    m_blockSize = bs;
+    m_total = total;
+    m_hashes.resize(int(n));
+    for (int i=0; i<n; ++i) m_hashes[i] = qFromLittleEndian<quint64>(p + kHeaderSize + i * 8);
+    m_state.reset();
+    m_fill = 0;
+    return true;
+}
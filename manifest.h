@@ -0,0 +1,34 @@
+#pragma once
+#include "xxh64.h"
+#include <QString>
+#include <QVector>
+
+// Манифест образа: XXH64 каждого блока данных по сетке blockSize.
+// Файл: "RWMANIF1", u32 версия, u32 алгоритм (1 = XXH64), u64 blockSize, u64 размер данных,
+// u64 число блоков, затем по u64 на блок. Всё little-endian.
+class BlockManifest {
+public:
+    explicit BlockManifest(qint64 blockSize = 0) : m_blockSize(blockSize) {}
+
+    qint64 blockSize() const { return m_blockSize; }
+    qint64 totalSize() const { return m_total; }
+    int count() const { return m_hashes.size(); }
+    quint64 hash(int i) const { return m_hashes[i]; }
+
+    // Данные потока строго по порядку; последний неполный блок закрывает finish()
+    void feed(const char *data, qint64 len);
+    void finish();
+
+    // Совпадает ли [off, off+len) с блоком манифеста: off на границе блока, длина как у блока
+    bool sameBlock(qint64 off, const char *data, qint64 len) const;
+
+    bool save(const QString &path, QString &diag) const;
+    bool load(const QString &path, QString &diag);
+
+private:
+    qint64 m_blockSize;
+    qint64 m_total = 0;
+    QVector<quint64> m_hashes;
+    Xxh64 m_state;
+    qint64 m_fill = 0;     // байт текущего блока уже в m_state
+};
@@ -2,9 +2,10 @@ TEMPLATE = app
 CONFIG += console c++17
 TARGET = RawWriter
 QT += core
+include(core.pri)
 SOURCES += main.cpp\
-           diskio.cpp
-HEADERS += diskio.h
+           batch.cpp
+HEADERS += batch.h
 
 win32 {
     win32:CONFIG(release, debug|release): DESTDIR = $$OUT_PWD/release
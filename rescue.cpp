@@ -0,0 +1,321 @@
+#include "rescue.h"
+#include "alignedbuffer.h"
+#include "ioengine.h"
+#include "telemetry.h"
+#include "throttle.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QElapsedTimer>
+#include <algorithm>
+
+static const qint64 kSaveEveryMs = 30000;
+static const qint64 kProgressEveryMs = 1000;
+
+static QString hexPos(qint64 v) {
+    return "0x" + QString::number(quint64(v), 16).toUpper().rightJustified(8, '0');
+}
+
+static bool parseHex(const QString &s, qint64 &v) {
+    if (!s.startsWith("0x") && !s.startsWith("0X")) return false;
+    bool ok = false;
+    v = qint64(s.mid(2).toULongLong(&ok, 16));
+    return ok && v >= 0;
+}
+
+static QString statusText(char c) { return QString::fromLatin1(&c, 1); }
+
+static bool isStatus(char c) {
+    return c == RescueMap::Untried || c == RescueMap::NonTrimmed || c == RescueMap::NonScraped
+        || c == RescueMap::Bad || c == RescueMap::Good;
+}
+
+void RescueMap::reset(qint64 pos, qint64 size) {
+    m_extents.clear();
+    if (size > 0) {
+        Extent e;
+        e.pos = pos; e.size = size; e.status = Untried;
+        m_extents.push_back(e);
+    }
+    setCurrent(pos, Untried, 1);
+}
+
+void RescueMap::set(qint64 pos, qint64 size, Status status) {
+    qint64 stop = std::min(pos + size, end());
+    pos = std::max(pos, start());
+    if (stop <= pos) return;
+
+    // [i, j) — участки, задетые [pos, stop), плюс соседи для слияния
+    auto first = std::upper_bound(m_extents.begin(), m_extents.end(), pos,
+                                  [](qint64 p, const Extent &e) { return p < e.pos + e.size; });
+    auto last = std::lower_bound(first, m_extents.end(), stop,
+                                 [](const Extent &e, qint64 p) { return e.pos < p; });
+    int i = int(first - m_extents.begin()), j = int(last - m_extents.begin());
+    if (i > 0) --i;
+    if (j < m_extents.size()) ++j;
+
+    QVector<Extent> mid;
+    auto push = [&](qint64 p, qint64 s, Status st) {
+        if (s <= 0) return;
+        if (!mid.isEmpty() && mid.last().status == st) { mid.last().size += s; return; }
+        Extent e;
+        e.pos = p; e.size = s; e.status = st;
+        mid.push_back(e);
+    };
+    bool placed = false;
+    for (int k = i; k < j; ++k) {
+        const Extent &e = m_extents[k];
+        const qint64 eEnd = e.pos + e.size;
+        push(e.pos, std::min(eEnd, pos) - e.pos, e.status);
+        if (!placed && eEnd > pos) { push(pos, stop - pos, status); placed = true; }
+        const qint64 tail = std::max(e.pos, stop);
+        push(tail, eEnd - tail, e.status);
+    }
+
+    m_extents.erase(m_extents.begin() + i, m_extents.begin() + j);
+    for (int k = 0; k < mid.size(); ++k) m_extents.insert(i + k, mid[k]);
+}
+
+QVector<RescueMap::Extent> RescueMap::extents(Status status) const {
+    QVector<Extent> res;
+    for (const Extent &e : m_extents) if (e.status == status) res.push_back(e);
+    return res;
+}
+
+qint64 RescueMap::bytes(Status status) const {
+    qint64 n = 0;
+    for (const Extent &e : m_extents) if (e.status == status) n += e.size;
+    return n;
+}
+
+bool RescueMap::save(const QString &path, QString &diag) const {
+    QString text;
+    text += "# Карта спасения RawWriter (формат mapfile GNU ddrescue)\n";
+    text += "# current_pos  current_status  current_pass\n";
+    text += hexPos(m_curPos) + "     " + statusText(m_curStatus) + "               " + QString::number(m_pass) + "\n";
+    text += "#      pos        size  status\n";
+    for (const Extent &e : m_extents) text += hexPos(e.pos) + "  " + hexPos(e.size) + "  " + statusText(char(e.status)) + "\n";
+
+    const QByteArray buf = text.toUtf8();
+    QSaveFile f(path);
+    if (!f.open(QIODevice::WriteOnly) || f.write(buf) != buf.size() || !f.commit()) {
+        diag = f.errorString();
+        return false;
+    }
+    return true;
+}
+
+bool RescueMap::load(const QString &path, QString &diag) {
+    QFile f(path);
+    if (!f.open(QIODevice::ReadOnly)) { diag = f.errorString(); return false; }
+    const QStringList lines = QString::fromUtf8(f.readAll()).split('\n');
+    QVector<Extent> res;
+    bool haveCurrent = false;
+    for (int n = 0; n < lines.size(); ++n) {
+        const QString line = lines[n].trimmed();
+        if (line.isEmpty() || line.startsWith("#")) continue;
+        const QStringList fields = line.split(' ', Qt::SkipEmptyParts);
+        if (!haveCurrent) {
+            // Строка состояния: позиция, состояние прохода и (не всегда) номер прохода
+            qint64 pos = 0;
+            if (fields.size() < 2 || !parseHex(fields[0], pos)) { diag = "строка " + QString::number(n+1) + ": нет текущей позиции"; return false; }
+            m_curPos = pos;
+            m_curStatus = fields[1].isEmpty() ? '?' : fields[1][0].toLatin1();
+            m_pass = fields.size() > 2 ? std::max(1, fields[2].toInt()) : 1;
+            haveCurrent = true;
+            continue;
+        }
+        Extent e;
+        if (fields.size() < 3 || !parseHex(fields[0], e.pos) || !parseHex(fields[1], e.size) || e.size <= 0
+            || fields[2].size() != 1 || !isStatus(fields[2][0].toLatin1())) {
+            diag = "строка " + QString::number(n+1) + ": ожидается «позиция размер состояние»";
+            return false;
+        }
+        e.status = Status(fields[2][0].toLatin1());
+        if (!res.isEmpty() && res.last().pos + res.last().size != e.pos) {
+            diag = "строка " + QString::number(n+1) + ": участки идут не подряд";
+            return false;
+        }
+        res.push_back(e);
+    }
+    if (res.isEmpty()) { diag = "в карте нет участков"; return false; }
+    m_extents = res;
+    return true;
+}
+
+bool Rescue::run(QFile &src, QFile &dst, qint64 total, qint64 blockSize, qint64 sector, qint64 &badBytes,
+                 QTextStream &out, QTextStream &err, const CopyOptions &opt) {
+    const int srcFd = src.handle(), dstFd = dst.handle();
+    const qint64 srcStart = src.pos(), dstStart = dst.pos();
+    const qint64 srcEnd = srcStart + total;
+    QString diag;
+
+    RescueMap map;
+    if (QFile::exists(opt.rescueMap)) {
+        if (!map.load(opt.rescueMap, diag)) { err << "Не прочитать карту " << opt.rescueMap << ": " << diag << "\n"; return false; }
+        if (map.start() != srcStart || map.end() != srcEnd) {
+            err << "Карта " << opt.rescueMap << " описывает другой диапазон: " << map.start() << "–" << map.end()
+                << ", а копируется " << srcStart << "–" << srcEnd << ".\n";
+            return false;
+        }
+        out << "Продолжение по карте: спасено " << DiskIO::humanSize(map.bytes(RescueMap::Good))
+            << ", плохих " << DiskIO::humanSize(map.bytes(RescueMap::Bad))
+            << ", не пройдено " << DiskIO::humanSize(total - map.bytes(RescueMap::Good) - map.bytes(RescueMap::Bad)) << "\n";
+    } else {
+        map.reset(srcStart, total);
+    }
+
+    AlignedBuffer buf(blockSize, opt.bufferAlign);
+    if (buf.isNull()) { err << "Не удалось выделить буфер " << DiskIO::humanSize(blockSize) << ".\n"; return false; }
+
+    QElapsedTimer t, saved, shown;
+    t.start(); saved.start(); shown.start();
+    bool failed = false;
+    // Задержки чтения на умирающем диске — главное, что видно в телеметрии
+    Telemetry *tel = opt.telemetry;
+    if (tel) tel->begin(QStringList{ dst.fileName() });
+
+    // Карта не должна обгонять данные: перед сохранением сбросить записанное на носитель
+    auto saveMap = [&]() -> bool {
+        const qint64 f0 = tel ? tel->now() : 0;
+        DiskIO::flushToDisk(dst);
+        if (tel) tel->target(0).flush.record(tel->now() - f0);
+        if (!map.save(opt.rescueMap, diag)) {
+            err << "\nНе сохранить карту " << opt.rescueMap << ": " << diag << "\n";
+            failed = true;
+            return false;
+        }
+        saved.restart();
+        return true;
+    };
+    auto progress = [&](int pass, const char *name, qint64 pos) {
+        if (shown.elapsed() < kProgressEveryMs) return;
+        shown.restart();
+        out << "\rПроход " << pass << " (" << name << "): позиция " << pos
+            << ", спасено " << DiskIO::humanSize(map.bytes(RescueMap::Good))
+            << ", не прочитано " << DiskIO::humanSize(map.bytes(RescueMap::NonTrimmed) + map.bytes(RescueMap::NonScraped))
+            << ", плохих " << DiskIO::humanSize(map.bytes(RescueMap::Bad)) << "   " << Qt::flush;
+    };
+    auto step = [&](int pass, char passStatus, const char *name, qint64 pos) {
+        map.setCurrent(pos, passStatus, pass);
+        progress(pass, name, pos);
+        if (saved.elapsed() >= kSaveEveryMs) saveMap();
+    };
+
+    // Прочитать [pos, pos+len) источника и записать прочитанное на то же смещение результата.
+    // Прочитанное до ошибки (целыми секторами) тоже сохраняется, остаток получает failStatus.
+    qint64 throttledNs = 0;    // сколько последний take() ждал ограничения скорости — это не медленное место
+    auto take = [&](qint64 pos, qint64 len, RescueMap::Status failStatus) -> bool {
+        qint64 got = 0;
+        bool ok = true;
+        throttledNs = opt.throttle ? opt.throttle->acquire(IoThrottle::Read, len) : 0;
+        while (got < len) {
+            IoRequest r;
+            r.fd = srcFd; r.buf = buf.data() + got; r.len = len - got; r.offset = pos + got;
+            const qint64 t0 = tel ? tel->now() : 0;
+            const qint64 n = IoEngine::execute(r);
+            if (tel) tel->source().done(tel->now() - t0, n);
+            if (n <= 0) { ok = false; break; }
+            got += n;
+        }
+        if (!ok) got -= got % sector;
+        if (opt.throttle && got > 0) throttledNs += opt.throttle->acquire(IoThrottle::Write, got);
+        for (qint64 put = 0; put < got; ) {
+            IoRequest w;
+            w.fd = dstFd; w.buf = buf.data() + put; w.len = got - put; w.offset = dstStart + (pos - srcStart) + put; w.write = true;
+            const qint64 t0 = tel ? tel->now() : 0;
+            const qint64 n = IoEngine::execute(w);
+            if (tel) tel->target(0).done(tel->now() - t0, n);
+            if (n <= 0) {
+                err << "\nОшибка записи результата на смещении " << w.offset << ": "
+                    << (n < 0 ? IoEngine::errorText(n) : QString("записано 0 байт")) << "\n";
+                failed = true;
+                return false;
+            }
+            put += n;
+        }
+        map.set(pos, got, RescueMap::Good);
+        if (!ok) map.set(pos + got, len - got, failStatus);
+        return ok;
+    };
+
+    // Проход 1: большими блоками по сетке blockSize. Ошибка или медленное чтение — прыжок вперёд,
+    // каждый следующий подряд вдвое дальше: сначала спасаем здоровые области.
+    // Второй заход — по перепрыгнутому, уже без прыжков.
+    const qint64 maxSkip = std::max(blockSize, total / 1000 - (total / 1000) % sector);
+    for (int round = 0; round < 2 && !failed; ++round) {
+        const bool skipping = round == 0;
+        for (const RescueMap::Extent &e : map.extents(RescueMap::Untried)) {
+            qint64 skip = 0;
+            const qint64 eEnd = e.pos + e.size;
+            for (qint64 pos = e.pos; pos < eEnd && !failed; ) {
+                const qint64 len = std::min(blockSize - (pos - srcStart) % blockSize, eEnd - pos);
+                QElapsedTimer rt; rt.start();
+                const bool ok = take(pos, len, RescueMap::NonTrimmed);
+                const bool slow = opt.rescueSlowMs > 0 && (rt.nsecsElapsed() - throttledNs) / 1000000 > opt.rescueSlowMs;
+                pos += len;
+                if (skipping && (!ok || slow)) {
+                    skip = skip ? std::min(skip * 2, maxSkip) : blockSize;
+                    pos = std::min(pos + skip, eEnd);
+                } else {
+                    skip = 0;
+                }
+                step(1, RescueMap::Untried, "копирование", pos);
+            }
+        }
+    }
+    if (!failed) saveMap();
+
+    // Проход 2: непрочитанные блоки — кусками по blockSize/16
+    const qint64 piece = std::max(sector, (blockSize / 16) - (blockSize / 16) % sector);
+    for (const RescueMap::Extent &e : map.extents(RescueMap::NonTrimmed)) {
+        for (qint64 pos = e.pos; pos < e.pos + e.size && !failed; pos += piece) {
+            take(pos, std::min(piece, e.pos + e.size - pos), RescueMap::NonScraped);
+            step(2, RescueMap::NonTrimmed, "разбиение", pos);
+        }
+    }
+    if (!failed) saveMap();
+
+    // Проход 3: то, что не прочиталось кусками, — по одному сектору
+    for (const RescueMap::Extent &e : map.extents(RescueMap::NonScraped)) {
+        for (qint64 pos = e.pos; pos < e.pos + e.size && !failed; pos += sector) {
+            take(pos, std::min(sector, e.pos + e.size - pos), RescueMap::Bad);
+            step(3, RescueMap::NonScraped, "по секторам", pos);
+        }
+    }
+    if (!failed) saveMap();
+
+    // Проходы 4...: повторы плохих секторов
+    for (int retry = 0; retry < opt.rescueRetries && !failed && map.bytes(RescueMap::Bad) > 0; ++retry) {
+        for (const RescueMap::Extent &e : map.extents(RescueMap::Bad)) {
+            for (qint64 pos = e.pos; pos < e.pos + e.size && !failed; pos += sector) {
+                take(pos, std::min(sector, e.pos + e.size - pos), RescueMap::Bad);
+                step(4 + retry, RescueMap::Bad, "повтор", pos);
+            }
+        }
+        if (!failed) saveMap();
+    }
+    if (failed) return false;
+
+    // Результат — того же размера, что и диапазон источника; плохие места остаются нулями
+    if (QFileInfo(dst.fileName()).isFile() && dst.size() < dstStart + total && !dst.resize(dstStart + total)) {
+        err << "\nНе удалось установить размер выходного файла: " << dst.errorString() << "\n";
+        return false;
+    }
+    map.setCurrent(srcEnd, RescueMap::Good, 4 + opt.rescueRetries);
+    if (!saveMap()) return false;
+
+    const QVector<RescueMap::Extent> bad = map.extents(RescueMap::Bad);
+    badBytes = map.bytes(RescueMap::Bad);
+    out << "\nГотово за " << QString::number(t.elapsed() / 1000.0, 'f', 1) << " с. Спасено "
+        << DiskIO::humanSize(map.bytes(RescueMap::Good)) << " из " << DiskIO::humanSize(total)
+        << " (" << QString::number(total > 0 ? 100.0 * map.bytes(RescueMap::Good) / total : 100.0, 'f', 3) << "%)\n";
+    if (!bad.isEmpty()) {
+        err << "Плохих: " << DiskIO::humanSize(badBytes) << " в " << bad.size() << " участках (нули в результате):\n";
+        for (int i = 0; i < bad.size() && i < 20; ++i) err << "  смещение " << bad[i].pos << ", длина " << bad[i].size << "\n";
+        if (bad.size() > 20) err << "  ... и ещё " << (bad.size() - 20) << " участков\n";
+    }
+    out << "Карта: " << opt.rescueMap << "\n";
+    if (tel) tel->printSummary(out);
+    return true;
+}
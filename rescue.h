@@ -0,0 +1,62 @@
+#pragma once
+#include "diskio.h"
+
+// Карта спасения: каждый байт диапазона источника в одном из состояний.
+// Текстовый файл в формате mapfile GNU ddrescue, позиции — абсолютные смещения на устройстве:
+//   # комментарии
+//   0x<текущая позиция> <состояние прохода> <номер прохода>
+//   0x<позиция> 0x<размер> <состояние>      — участки подряд, без пропусков
+class RescueMap {
+public:
+    enum Status : char {
+        Untried   = '?',   // ещё не читали
+        NonTrimmed = '*',  // блок не прочитался на быстром проходе
+        NonScraped = '/',  // кусок не прочитался при разбиении, осталось пройти по секторам
+        Bad       = '-',   // сектор не прочитался
+        Good      = '+'
+    };
+    struct Extent {
+        qint64 pos = 0;
+        qint64 size = 0;
+        Status status = Untried;
+    };
+
+    // Весь диапазон [pos, pos+size) ещё не читали
+    void reset(qint64 pos, qint64 size);
+    // Перевести [pos, pos+size) в status, соседние участки с тем же состоянием сливаются
+    void set(qint64 pos, qint64 size, Status status);
+
+    const QVector<Extent> &extents() const { return m_extents; }
+    QVector<Extent> extents(Status status) const;
+    qint64 bytes(Status status) const;
+    qint64 start() const { return m_extents.isEmpty() ? 0 : m_extents.first().pos; }
+    qint64 end() const { return m_extents.isEmpty() ? 0 : m_extents.last().pos + m_extents.last().size; }
+
+    // Где остановились: для возобновления и для чтения человеком
+    void setCurrent(qint64 pos, char passStatus, int pass) { m_curPos = pos; m_curStatus = passStatus; m_pass = pass; }
+
+    // Запись через временный файл: при сбое остаётся прошлая карта
+    bool save(const QString &path, QString &diag) const;
+    bool load(const QString &path, QString &diag);
+
+private:
+    QVector<Extent> m_extents;     // по возрастанию pos, без пропусков
+    qint64 m_curPos = 0;
+    char m_curStatus = '?';
+    int m_pass = 1;
+};
+
+// Спасение данных с умирающего диска проходами, как в ddrescue:
+//  1. копирование большими блоками: блок с ошибкой или медленный — дальше с прыжком, прыжок растёт;
+//     затем ещё раз по пропущенному без прыжков;
+//  2. разбиение непрочитанных блоков на куски по blockSize/16;
+//  3. непрочитанные куски — по одному сектору;
+//  4. повторы плохих секторов (opt.rescueRetries раз).
+// Карта сохраняется после каждого прохода и раз в 30 секунд, повторный запуск с той же картой продолжает работу.
+class Rescue {
+public:
+    // src — с позиции src.pos(), total байт; dst — на те же смещения от dst.pos().
+    // false — только если нельзя писать результат или вести карту; плохие сектора — в badBytes.
+    static bool run(QFile &src, QFile &dst, qint64 total, qint64 blockSize, qint64 sector, qint64 &badBytes,
+                    QTextStream &out, QTextStream &err, const CopyOptions &opt);
+};
@@ -0,0 +1,28 @@
+#include "streamhash.h"
+#include <algorithm>
+
+bool StreamHash::parse(const QString &name, Algo &algo) {
+    const QString n = name.trimmed().toLower();
+    if (n == "sha256" || n == "sha-256") { algo = Sha256; return true; }
+    if (n == "xxh64") { algo = Xxh64Algo; return true; }
+    return false;
+}
+
+void StreamHash::add(const char *data, qint64 len) {
+    if (m_algo == Xxh64Algo) { m_xxh.update(data, len); return; }
+    // addData принимает int — большие буферы по частям
+    while (len > 0) {
+        const int n = int(std::min<qint64>(len, 1 << 30));
+        m_sha.addData(data, n);
+        data += n; len -= n;
+    }
+}
+
+QString StreamHash::name() const {
+    return m_algo == Xxh64Algo ? "XXH64" : "SHA-256";
+}
+
+QString StreamHash::hex() const {
+    if (m_algo == Xxh64Algo) return QString("%1").arg(m_xxh.digest(), 16, 16, QChar('0'));
+    return QString::fromLatin1(m_sha.result().toHex());
+}
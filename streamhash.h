@@ -0,0 +1,24 @@
+#pragma once
+#include "xxh64.h"
+#include <QCryptographicHash>
+#include <QString>
+
+// Контрольная сумма всего потока данных, как у sha256sum: SHA-256 или XXH64
+class StreamHash {
+public:
+    enum Algo { Sha256, Xxh64Algo };
+
+    explicit StreamHash(Algo algo = Sha256) : m_algo(algo), m_sha(QCryptographicHash::Sha256) {}
+
+    // "sha256" или "xxh64"
+    static bool parse(const QString &name, Algo &algo);
+
+    void add(const char *data, qint64 len);
+    QString name() const;
+    QString hex() const;
+
+private:
+    Algo m_algo;
+    QCryptographicHash m_sha;
+    Xxh64 m_xxh;
+};
@@ -0,0 +1,215 @@
+#include "telemetry.h"
+#include <QThread>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+// Корзина: до 8 нс — по наносекунде, дальше 8 корзин на степень двойки
+static int bucketOf(qint64 ns) {
+    if (ns < 8) return ns < 0 ? 0 : int(ns);
+    int e = 63;
+    while (!(quint64(ns) >> e)) --e;
+    return (e - 2) * 8 + int((quint64(ns) >> (e - 3)) & 7);
+}
+
+static qint64 bucketLow(int i) {
+    if (i < 8) return i;
+    const int e = i / 8 + 2, sub = i % 8;
+    return qint64(8 + sub) << (e - 3);
+}
+
+static qint64 bucketHigh(int i) {
+    return i + 1 < LatencyHistogram::kBuckets ? bucketLow(i + 1) - 1 : std::numeric_limits<qint64>::max();
+}
+
+void LatencyHistogram::record(qint64 ns) {
+    m_buckets[bucketOf(ns)].fetchAndAddRelaxed(1);
+    m_count.fetchAndAddRelaxed(1);
+    qint64 cur = m_max.loadRelaxed();
+    while (ns > cur && !m_max.testAndSetRelaxed(cur, ns)) cur = m_max.loadRelaxed();
+}
+
+LatencyHistogram::Snapshot LatencyHistogram::snapshot() const {
+    Snapshot s(kBuckets);
+    for (int i = 0; i < kBuckets; ++i) s[size_t(i)] = m_buckets[i].loadRelaxed();
+    return s;
+}
+
+qint64 LatencyHistogram::percentile(const Snapshot &s, double p) {
+    quint64 total = 0;
+    for (quint64 c : s) total += c;
+    if (total == 0) return 0;
+    const quint64 rank = std::max<quint64>(1, quint64(p * double(total) + 0.5));
+    quint64 seen = 0;
+    for (size_t i = 0; i < s.size(); ++i) {
+        seen += s[i];
+        // Середина корзины: ошибка не больше половины её ширины
+        if (seen >= rank) return (bucketLow(int(i)) + std::min(bucketHigh(int(i)), bucketLow(int(i)) * 2)) / 2;
+    }
+    return 0;
+}
+
+qint64 LatencyHistogram::upperBound(const Snapshot &s) {
+    for (size_t i = s.size(); i-- > 0;) {
+        if (s[i]) return bucketHigh(int(i));
+    }
+    return 0;
+}
+
+LatencyHistogram::Snapshot LatencyHistogram::since(const Snapshot &now, const Snapshot &before) {
+    Snapshot d(now);
+    for (size_t i = 0; i < d.size() && i < before.size(); ++i) d[i] -= std::min(d[i], before[i]);
+    return d;
+}
+
+Telemetry::~Telemetry() {
+    stop(-1);
+}
+
+bool Telemetry::open(const QString &spec, int intervalMs, QString &diag) {
+    bool ok = true;
+    if (spec.startsWith("fd:")) {
+        const int fd = spec.mid(3).toInt(&ok);
+        if (!ok || fd < 0) { diag = "некорректный дескриптор " + spec.mid(3); return false; }
+        ok = m_stream.open(fd, QIODevice::WriteOnly, QFileDevice::DontCloseHandle);
+    } else {
+        m_stream.setFileName(spec);
+        ok = m_stream.open(QIODevice::WriteOnly | QIODevice::Append);
+    }
+    if (!ok) { diag = m_stream.errorString(); return false; }
+    m_intervalMs = std::max(100, intervalMs);
+    m_emitter = QThread::create([this] {
+        for (;;) {
+            for (int slept = 0; slept < m_intervalMs; slept += 100) {
+                if (m_stop.loadAcquire()) return;
+                QThread::msleep(100);
+            }
+            emitLine(false, 0);
+        }
+    });
+    m_emitter->start();
+    return true;
+}
+
+void Telemetry::setLabel(const QString &label) {
+    QMutexLocker lock(&m_lock);
+    m_label = label;
+}
+
+void Telemetry::begin(const QStringList &targets) {
+    QMutexLocker lock(&m_lock);
+    m_source.reset(new TelemetrySide);
+    m_source->name = "source";
+    m_targets.clear();
+    for (const QString &name : targets) {
+        m_targets.emplace_back(new TelemetrySide);
+        m_targets.back()->name = name.isEmpty() ? QString("target") : name;
+    }
+    // Снимки прошлой строки: io источника, затем io и flush каждого назначения
+    m_lastHist.assign(1 + 2 * m_targets.size(), LatencyHistogram::Snapshot(LatencyHistogram::kBuckets));
+    m_lastBytes.assign(1 + m_targets.size(), 0);
+    m_lastNs = 0;
+    m_clock.start();
+    m_begun.storeRelease(1);
+}
+
+static double toUs(qint64 ns) { return std::round(ns / 100.0) / 10.0; }
+
+void Telemetry::emitLine(bool summary, int exitCode) {
+    QMutexLocker lock(&m_lock);
+    if (!m_begun.loadAcquire() || !m_stream.isOpen()) return;
+    const qint64 t = now();
+    const qint64 dt = summary ? t : t - m_lastNs;
+    size_t h = 0;
+
+    // В строке за интервал — замеры с прошлой строки, в итоге — за всю передачу
+    auto latency = [&](const LatencyHistogram &hist) {
+        const LatencyHistogram::Snapshot cur = hist.snapshot();
+        const LatencyHistogram::Snapshot part = summary ? cur : LatencyHistogram::since(cur, m_lastHist[h]);
+        if (!summary) m_lastHist[h] = cur;
+        ++h;
+        quint64 n = 0;
+        for (quint64 c : part) n += c;
+        QJsonObject o;
+        const qint64 top = summary || n == 0 ? (n ? hist.maxNs() : 0) : std::min(LatencyHistogram::upperBound(part), hist.maxNs());
+        // Середина корзины может оказаться выше точного максимума
+        o["count"] = qint64(n);
+        o["p50"] = toUs(std::min(LatencyHistogram::percentile(part, 0.50), top));
+        o["p99"] = toUs(std::min(LatencyHistogram::percentile(part, 0.99), top));
+        o["max"] = toUs(top);
+        return o;
+    };
+    auto side = [&](TelemetrySide &s, size_t i, bool isTarget) {
+        const qint64 bytes = s.bytes.loadRelaxed();
+        const qint64 db = summary ? bytes : bytes - m_lastBytes[i];
+        if (!summary) m_lastBytes[i] = bytes;
+        QJsonObject o;
+        o["name"] = s.name;
+        o["bytes"] = bytes;
+        o["mibps"] = dt > 0 ? std::round(db / 1048576.0 / (dt / 1e9) * 100) / 100.0 : 0.0;
+        o["stall_s"] = std::round(s.stallNs.loadRelaxed() / 1e6) / 1000.0;
+        o["lat_us"] = latency(s.io);
+        if (isTarget) o["flush_us"] = latency(s.flush);
+        return o;
+    };
+
+    QJsonObject root;
+    root["event"] = summary ? "summary" : "stats";
+    if (!m_label.isEmpty()) root["job"] = m_label;
+    root["t"] = std::round(t / 1e6) / 1000.0;
+    if (summary) root["exit"] = exitCode;
+    root["read"] = side(*m_source, 0, false);
+    QJsonArray writes;
+    for (size_t i = 0; i < m_targets.size(); ++i) writes.append(side(*m_targets[i], i + 1, true));
+    root["write"] = writes;
+    m_lastNs = t;
+
+    QByteArray line = QJsonDocument(root).toJson(QJsonDocument::Compact);
+    line.append('\n');
+    m_stream.write(line);
+    m_stream.flush();
+}
+
+static QString fmtLatency(qint64 ns) {
+    if (ns < 1000) return QString::number(ns) + " нс";
+    if (ns < 1000 * 1000) return QString::number(ns / 1e3, 'f', 1) + " мкс";
+    if (ns < 1000 * 1000 * 1000) return QString::number(ns / 1e6, 'f', 2) + " мс";
+    return QString::number(ns / 1e9, 'f', 2) + " с";
+}
+
+static QString fmtHistogram(const LatencyHistogram &h) {
+    const LatencyHistogram::Snapshot s = h.snapshot();
+    const qint64 top = h.maxNs();
+    return "p50 " + fmtLatency(std::min(LatencyHistogram::percentile(s, 0.50), top))
+         + ", p99 " + fmtLatency(std::min(LatencyHistogram::percentile(s, 0.99), top))
+         + ", max " + fmtLatency(h.maxNs()) + " (" + QString::number(h.count()) + " оп.)";
+}
+
+void Telemetry::printSummary(QTextStream &out) {
+    QMutexLocker lock(&m_lock);
+    if (!m_begun.loadAcquire()) return;
+    out << "Задержки: чтение " << fmtHistogram(m_source->io) << "\n";
+    for (const auto &t : m_targets) {
+        out << "          запись";
+        if (m_targets.size() > 1) out << " " << t->name;
+        out << " " << fmtHistogram(t->io);
+        if (t->flush.count()) out << "; сброс " << fmtHistogram(t->flush);
+        out << "\n";
+    }
+}
+
+void Telemetry::stop(int exitCode) {
+    if (m_stopped) return;
+    m_stopped = true;
+    if (m_emitter) {
+        m_stop.storeRelease(1);
+        m_emitter->wait();
+        delete m_emitter;
+        m_emitter = nullptr;
+    }
+    emitLine(true, exitCode);
+    m_stream.close();
+}
@@ -0,0 +1,97 @@
+#pragma once
+#include <QString>
+#include <QStringList>
+#include <QTextStream>
+#include <QFile>
+#include <QMutex>
+#include <QElapsedTimer>
+#include <QAtomicInteger>
+#include <QAtomicInt>
+#include <vector>
+#include <memory>
+
+class QThread;
+
+// Гистограмма задержек: по 8 корзин на каждую степень двойки наносекунд, погрешность до 12,5%.
+// Запись без блокировок из любого числа потоков, чтение — снимком, пока запись идёт.
+class LatencyHistogram {
+public:
+    static const int kBuckets = 496;
+    using Snapshot = std::vector<quint64>;
+
+    void record(qint64 ns);
+
+    quint64 count() const { return quint64(m_count.loadRelaxed()); }
+    qint64 maxNs() const { return m_max.loadRelaxed(); }
+    Snapshot snapshot() const;
+
+    // Значение, не больше которого доля p (0..1) замеров снимка; 0 — если замеров нет
+    static qint64 percentile(const Snapshot &s, double p);
+    // Верхняя граница последней непустой корзины: максимум за интервал между снимками
+    static qint64 upperBound(const Snapshot &s);
+    // Замеры, сделанные после снимка before
+    static Snapshot since(const Snapshot &now, const Snapshot &before);
+
+private:
+    QAtomicInteger<quint64> m_buckets[kBuckets];
+    QAtomicInteger<qint64> m_count;
+    QAtomicInteger<qint64> m_max;
+};
+
+// Одна сторона передачи: источник или одно из назначений
+struct TelemetrySide {
+    QString name;
+    LatencyHistogram io;        // чтения источника или записи назначения, от постановки в очередь до завершения
+    LatencyHistogram flush;     // сбросы на носитель (только назначения)
+    QAtomicInteger<qint64> bytes;
+    QAtomicInteger<qint64> stallNs;   // сколько сторона ждала другую
+
+    void done(qint64 ns, qint64 n) { io.record(ns); if (n > 0) bytes.fetchAndAddRelaxed(n); }
+    void stalled(qint64 ns) { stallNs.fetchAndAddRelaxed(ns); }
+};
+
+// Телеметрия передачи: гистограммы задержек чтения, записи и сброса по каждой стороне.
+// Копирование вызывает begin() и отмечает каждую операцию; поток статистики (если открыт)
+// раз в интервал пишет строку JSON с показателями за интервал, stop() дописывает итог за всю передачу.
+class Telemetry {
+public:
+    ~Telemetry();
+
+    // Куда писать строки JSON: путь (дописывается в конец) или fd:N. Поток строк запускается сразу,
+    // строки идут после begin().
+    bool open(const QString &spec, int intervalMs, QString &diag);
+    // Метка в каждой строке JSON ("job"), когда в один поток пишут несколько передач
+    void setLabel(const QString &label);
+
+    // Передача начинается: сбросить счётчики, завести источник и назначения по именам
+    void begin(const QStringList &targets);
+    bool begun() const { return m_begun.loadAcquire() != 0; }
+
+    qint64 now() const { return m_clock.nsecsElapsed(); }
+    TelemetrySide &source() { return *m_source; }
+    TelemetrySide &target(int i) { return *m_targets[size_t(i)]; }
+
+    // Итог по задержкам для человека
+    void printSummary(QTextStream &out);
+    // Дописать итоговую строку (с кодом возврата) и остановить поток статистики
+    void stop(int exitCode);
+
+private:
+    void emitLine(bool summary, int exitCode);
+
+    QElapsedTimer m_clock;
+    QMutex m_lock;                       // стороны и предыдущие снимки для строк за интервал
+    std::unique_ptr<TelemetrySide> m_source;
+    std::vector<std::unique_ptr<TelemetrySide>> m_targets;
+    QAtomicInt m_begun;
+    QFile m_stream;
+    QThread *m_emitter = nullptr;
+    QAtomicInt m_stop;
+    int m_intervalMs = 1000;
+    QString m_label;
+    bool m_stopped = false;
+    // на прошлой строке
+    qint64 m_lastNs = 0;
+    std::vector<LatencyHistogram::Snapshot> m_lastHist;
+    std::vector<qint64> m_lastBytes;
+};
@@ -0,0 +1,177 @@
+#include "throttle.h"
+#include "diskio.h"
+#include <QFile>
+#include <QThread>
+#include <QTextStream>
+#include <QStringList>
+#include <algorithm>
+
+#ifdef Q_OS_WIN
+#  include <windows.h>
+#endif
+#ifdef Q_OS_LINUX
+#  include <sys/syscall.h>
+#  include <unistd.h>
+#  include <errno.h>
+#  include <string.h>
+#endif
+
+// Сколько можно накопить за время простоя: четверть секунды лимита
+static const double kBurstSecs = 0.25;
+
+IoThrottle::IoThrottle() {
+    m_clock.start();
+}
+
+IoThrottle::~IoThrottle() {
+    if (m_watcher) {
+        m_stop.storeRelease(1);
+        m_watcher->wait();
+        delete m_watcher;
+    }
+}
+
+bool IoThrottle::parseRate(const QString &text, qint64 &bytesPerSec, QString &diag) {
+    QString t = text.trimmed().toUpper();
+    if (t == "0" || t == "OFF") { bytesPerSec = 0; return true; }
+    qint64 mul = 1;
+    if (t.endsWith("K")) mul = 1024;
+    else if (t.endsWith("M")) mul = 1024 * 1024;
+    else if (t.endsWith("G")) mul = qint64(1024) * 1024 * 1024;
+    if (mul > 1) t.chop(1);
+    bool ok = false;
+    const double v = t.toDouble(&ok);
+    if (!ok || v <= 0) { diag = "некорректная скорость: " + text; return false; }
+    bytesPerSec = std::max<qint64>(1, qint64(v * mul));
+    return true;
+}
+
+bool IoThrottle::setIoPriority(const QString &spec, QString &diag) {
+    const QString cls = spec.section(':', 0, 0).trimmed().toLower();
+    const QString lvl = spec.section(':', 1, 1).trimmed();
+    int level = 4;
+    if (!lvl.isEmpty()) {
+        bool ok = false;
+        level = lvl.toInt(&ok);
+        if (!ok || level < 0 || level > 7 || cls != "be") { diag = "уровень 0-7 задаётся только для be: " + spec; return false; }
+    }
+    if (cls != "idle" && cls != "be") { diag = "класс приоритета должен быть idle или be[:0-7]: " + spec; return false; }
+#if defined(Q_OS_LINUX)
+    // IOPRIO_WHO_PROCESS = 1; класс в старших битах: 2 — best-effort, 3 — idle
+    const int value = cls == "idle" ? (3 << 13) : ((2 << 13) | level);
+    if (::syscall(SYS_ioprio_set, 1, 0, value) != 0) { diag = QString("ioprio_set: ") + strerror(errno); return false; }
+    return true;
+#elif defined(Q_OS_WIN)
+    // Фоновый режим процесса: низкий приоритет ввода-вывода и памяти
+    if (cls == "be") return true;
+    if (!SetPriorityClass(GetCurrentProcess(), PROCESS_MODE_BACKGROUND_BEGIN)) { diag = "SetPriorityClass: ошибка " + QString::number(GetLastError()); return false; }
+    return true;
+#else
+    diag = "приоритет ввода-вывода в этой ОС не поддерживается";
+    return false;
+#endif
+}
+
+void IoThrottle::setLimits(qint64 bytesPerSec, int opsPerSec) {
+    QMutexLocker lock(&m_mutex);
+    for (Bucket &b : m_buckets) refill(b);
+    m_bw = std::max<qint64>(0, bytesPerSec);
+    m_iops = std::max(0, opsPerSec);
+}
+
+bool IoThrottle::enabled() const {
+    QMutexLocker lock(&m_mutex);
+    return m_bw > 0 || m_iops > 0;
+}
+
+QString IoThrottle::describe() const {
+    QMutexLocker lock(&m_mutex);
+    QStringList parts;
+    if (m_bw > 0) parts << DiskIO::humanSize(quint64(m_bw)) + "/с";
+    if (m_iops > 0) parts << QString::number(m_iops) + " оп/с";
+    return parts.isEmpty() ? QString("без ограничения") : parts.join(", ");
+}
+
+// Пополнить корзину за прошедшее время; без лимита долг не копится
+void IoThrottle::refill(Bucket &b) {
+    const qint64 now = m_clock.nsecsElapsed();
+    const double dt = (now - b.lastNs) / 1e9;
+    b.lastNs = now;
+    b.bytes = m_bw > 0 ? std::min(b.bytes + m_bw * dt, m_bw * kBurstSecs) : 0;
+    b.ops = m_iops > 0 ? std::min(b.ops + m_iops * dt, std::max(1.0, m_iops * kBurstSecs)) : 0;
+}
+
+qint64 IoThrottle::acquire(Side side, qint64 bytes) {
+    QMutexLocker lock(&m_mutex);
+    if (m_bw <= 0 && m_iops <= 0) return 0;
+    Bucket &b = m_buckets[side];
+    refill(b);
+    // Запрос берётся сразу, даже больше корзины, а ждать приходится, пока долг не погасится.
+    // Ждём кусками: новый лимит из файла управления подхватывается сразу.
+    b.bytes -= bytes;
+    b.ops -= 1;
+    const qint64 start = m_clock.nsecsElapsed();
+    for (;;) {
+        refill(b);
+        double wait = 0;
+        if (m_bw > 0 && b.bytes < 0) wait = -b.bytes / m_bw;
+        if (m_iops > 0 && b.ops < 0) wait = std::max(wait, -b.ops / m_iops);
+        if (wait <= 0) break;
+        lock.unlock();
+        QThread::usleep((unsigned long)(std::min(wait, 0.1) * 1e6) + 1);
+        lock.relock();
+    }
+    return m_clock.nsecsElapsed() - start;
+}
+
+bool IoThrottle::apply(const QString &text, QString &diag) {
+    qint64 bw = -1;
+    int iops = -1;
+    const QStringList lines = text.split('\n');
+    for (const QString &raw : lines) {
+        const QString line = raw.trimmed();
+        if (line.isEmpty() || line.startsWith("#")) continue;
+        const QString key = line.section('=', 0, 0).trimmed().toLower();
+        const QString value = line.section('=', 1).trimmed();
+        if (key == "bwlimit") {
+            if (!parseRate(value, bw, diag)) return false;
+        } else if (key == "iops") {
+            bool ok = false;
+            iops = value.toInt(&ok);
+            if (!ok || iops < 0) { diag = "некорректное iops: " + value; return false; }
+        } else {
+            diag = "неизвестный ключ: " + key;
+            return false;
+        }
+    }
+    QMutexLocker lock(&m_mutex);
+    for (Bucket &b : m_buckets) refill(b);
+    if (bw >= 0) m_bw = bw;
+    if (iops >= 0) m_iops = iops;
+    return true;
+}
+
+bool IoThrottle::watch(const QString &path, QString &diag) {
+    QFile f(path);
+    if (!f.open(QIODevice::ReadOnly)) { diag = f.errorString(); return false; }
+    QByteArray last = f.readAll();
+    f.close();
+    if (!apply(QString::fromUtf8(last), diag)) return false;
+    m_watcher = QThread::create([this, path, last]() mutable {
+        while (!m_stop.loadAcquire()) {
+            QThread::msleep(500);
+            QFile cf(path);
+            if (!cf.open(QIODevice::ReadOnly)) continue;
+            const QByteArray now = cf.readAll();
+            if (now == last) continue;
+            last = now;
+            QString why;
+            QTextStream err(stderr);
+            if (apply(QString::fromUtf8(now), why)) err << "\nОграничение скорости: " << describe() << "\n";
+            else err << "\nФайл управления " << path << " не применён: " << why << "\n";
+            err.flush();
+        }
+    });
+    m_watcher->start();
+    return true;
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <QString>
+#include <QMutex>
+#include <QElapsedTimer>
+#include <QAtomicInt>
+
+class QThread;
+
+// Ограничение скорости ввода-вывода: корзина токенов по байтам и по операциям,
+// отдельная для чтения и для записи, с одними и теми же лимитами. Лимиты можно менять на ходу,
+// в том числе из файла управления. Общий объект на все потоки (и задания пакета) — общий лимит.
+class IoThrottle {
+public:
+    enum Side { Read = 0, Write = 1 };
+
+    IoThrottle();
+    ~IoThrottle();
+
+    // "50M" — 50 МиБ/с; суффиксы K, M, G (степени 1024); "0" или "off" — без ограничения
+    static bool parseRate(const QString &text, qint64 &bytesPerSec, QString &diag);
+    // Приоритет ввода-вывода процесса: "idle" или "be[:0-7]" (Linux ioprio_set; Windows — фоновый режим, только idle).
+    // Ставить до запуска потоков: новые потоки наследуют приоритет.
+    static bool setIoPriority(const QString &spec, QString &diag);
+
+    // 0 — без ограничения
+    void setLimits(qint64 bytesPerSec, int opsPerSec);
+    bool enabled() const;
+    QString describe() const;
+
+    // Взять bytes байт и одну операцию со стороны side; ждёт, пока корзина не выйдет из долга.
+    // Возвращает, сколько ждал, нс.
+    qint64 acquire(Side side, qint64 bytes);
+
+    // Раз в полсекунды перечитывать файл управления: строки "bwlimit=50M" и "iops=200"
+    // (ключа нет — лимит прежний). Файл должен существовать.
+    bool watch(const QString &path, QString &diag);
+
+private:
+    struct Bucket {
+        double bytes = 0, ops = 0;
+        qint64 lastNs = 0;
+    };
+    void refill(Bucket &b);
+    bool apply(const QString &text, QString &diag);
+
+    mutable QMutex m_mutex;
+    QElapsedTimer m_clock;
+    Bucket m_buckets[2];
+    qint64 m_bw = 0;
+    int m_iops = 0;
+    QThread *m_watcher = nullptr;
+    QAtomicInt m_stop;
+};
@@ -0,0 +1,489 @@
+#include "usedblocks.h"
+#include "alignedbuffer.h"
+#include "ioengine.h"
+#include <QtEndian>
+#include <algorithm>
+#include <limits>
+#include <cstring>
+
+static quint16 le16(const uchar *p) { return qFromLittleEndian<quint16>(p); }
+static quint32 le32(const uchar *p) { return qFromLittleEndian<quint32>(p); }
+static quint64 le64(const uchar *p) { return qFromLittleEndian<quint64>(p); }
+static const uchar *u(const QByteArray &b) { return reinterpret_cast<const uchar*>(b.constData()); }
+
+// Чтение произвольного диапазона через выровненный буфер: годится и для устройства, открытого с O_DIRECT
+class SectorReader {
+public:
+    SectorReader(int fd, qint64 size) : m_fd(fd), m_size(size) {}
+
+    bool read(qint64 off, qint64 len, QByteArray &out) const {
+        if (off < 0 || len <= 0 || off + len > m_size || len > (1 << 30)) return false;
+        const qint64 a = 4096;
+        const qint64 start = off / a * a, end = (off + len + a - 1) / a * a;
+        AlignedBuffer buf(end - start, a);
+        if (buf.isNull()) return false;
+        qint64 done=0;
+        while (start + done < end) {
+            IoRequest r;
+            r.fd = m_fd; r.buf = buf.data()+done; r.len = end-start-done; r.offset = start+done;
+            qint64 n = IoEngine::execute(r);
+            if (n < 0) return false;
+            if (n == 0) break;
+            done += n;
+        }
+        if (start + done < off + len) return false;
+        out = QByteArray(buf.constData() + (off - start), int(len));
+        return true;
+    }
+
+private:
+    int m_fd;
+    qint64 m_size;
+};
+
+// Накопитель диапазонов: соседние участки, добавленные подряд, склеиваются сразу
+class RangeList {
+public:
+    void add(qint64 off, qint64 len) {
+        if (len <= 0) return;
+        if (!m_list.isEmpty() && m_list.last().offset + m_list.last().length == off) { m_list.last().length += len; return; }
+        ByteRange r;
+        r.offset = off; r.length = len;
+        m_list.push_back(r);
+    }
+    // Отсортировать и слить пересекающиеся
+    QVector<ByteRange> normalized() const {
+        QVector<ByteRange> v = m_list;
+        std::sort(v.begin(), v.end(), [](const ByteRange &a, const ByteRange &b) { return a.offset < b.offset; });
+        QVector<ByteRange> res;
+        for (const ByteRange &r : v) {
+            if (!res.isEmpty() && r.offset <= res.last().offset + res.last().length) {
+                res.last().length = std::max(res.last().length, r.offset + r.length - res.last().offset);
+            } else {
+                res.push_back(r);
+            }
+        }
+        return res;
+    }
+    qint64 total() const { return UsedBlocks::totalBytes(normalized()); }
+    void append(const RangeList &o) { m_list += o.m_list; }
+
+private:
+    QVector<ByteRange> m_list;
+};
+
+// Установленные биты битмапа -> диапазоны: бит i — единица размером unit по смещению base + i*unit
+static void addBitmap(const uchar *bits, qint64 nbits, qint64 base, qint64 unit, RangeList &out) {
+    qint64 runStart = -1;
+    for (qint64 i=0; i<nbits; ) {
+        bool set;
+        qint64 step = 1;
+        const uchar b = bits[i >> 3];
+        if ((i & 7) == 0 && i + 8 <= nbits && (b == 0 || b == 0xFF)) { set = b != 0; step = 8; }
+        else set = (b >> (i & 7)) & 1;
+        if (set && runStart < 0) runStart = i;
+        if (!set && runStart >= 0) { out.add(base + runStart*unit, (i - runStart)*unit); runStart = -1; }
+        i += step;
+    }
+    if (runStart >= 0) out.add(base + runStart*unit, (nbits - runStart)*unit);
+}
+
+// ---------- ext2/3/4 ----------
+
+static bool hasSuperBackup(qint64 g, bool sparseSuper) {
+    if (!sparseSuper || g <= 1) return true;
+    for (qint64 p : {3, 5, 7}) {
+        qint64 v = p;
+        while (v < g) v *= p;
+        if (v == g) return true;
+    }
+    return false;
+}
+
+static bool scanExt(const SectorReader &rd, qint64 base, qint64 size, RangeList &used, UsedBlocks::Partition &p) {
+    QByteArray sbBuf;
+    if (size < 2048 || !rd.read(base + 1024, 1024, sbBuf)) return false;
+    const uchar *sb = u(sbBuf);
+    if (le16(sb + 56) != 0xEF53) return false;
+
+    const quint32 compat = le32(sb + 92), incompat = le32(sb + 96), roCompat = le32(sb + 100);
+    const bool is64 = incompat & 0x80;
+    p.fs = (incompat & (0x40 | 0x80 | 0x200)) ? "ext4" : (compat & 0x4) ? "ext3" : "ext2";
+    if (incompat & 0x10) { p.note = "meta_bg не поддерживается"; return false; }
+
+    const quint32 logBs = le32(sb + 24);
+    if (logBs > 6) { p.note = "некорректный суперблок"; return false; }
+    const qint64 bs = qint64(1024) << logBs;
+    qint64 blocks = le32(sb + 4);
+    if (is64) blocks |= qint64(le32(sb + 336)) << 32;
+    const qint64 firstData = le32(sb + 20), bpg = le32(sb + 32), ipg = le32(sb + 40);
+    const qint64 inodeSize = le32(sb + 76) == 0 ? 128 : le16(sb + 88);
+    const qint64 descSize = is64 ? std::max<qint64>(32, le16(sb + 254)) : 32;
+    const qint64 resGdt = le16(sb + 206);
+    if (bpg <= 0 || bpg > bs*8 || blocks <= firstData || blocks * bs > size || inodeSize <= 0) {
+        p.note = "некорректный суперблок";
+        return false;
+    }
+
+    const qint64 groups = (blocks - firstData + bpg - 1) / bpg;
+    const qint64 gdtBlocks = (groups * descSize + bs - 1) / bs;
+    const qint64 itBlocks = (ipg * inodeSize + bs - 1) / bs;
+    const bool csum = roCompat & (0x10 | 0x400);      // GDT_CSUM / METADATA_CSUM: возможны BLOCK_UNINIT
+    const bool sparseSuper = roCompat & 0x1;
+
+    QByteArray gdt;
+    if (!rd.read(base + (firstData + 1) * bs, groups * descSize, gdt)) { p.note = "не прочитать дескрипторы групп"; return false; }
+
+    // Загрузочная область, суперблок и дескрипторы групп
+    used.add(base, (firstData + 1 + gdtBlocks + resGdt) * bs);
+    QByteArray bitmap;
+    for (qint64 g=0; g<groups; ++g) {
+        const uchar *d = u(gdt) + g * descSize;
+        qint64 blockBitmap = le32(d), inodeBitmap = le32(d + 4), inodeTable = le32(d + 8);
+        if (descSize >= 64) {
+            blockBitmap |= qint64(le32(d + 32)) << 32;
+            inodeBitmap |= qint64(le32(d + 36)) << 32;
+            inodeTable  |= qint64(le32(d + 40)) << 32;
+        }
+        const quint16 flags = le16(d + 18);
+        const qint64 groupStart = firstData + g * bpg;
+        const qint64 groupBlocks = std::min(bpg, blocks - groupStart);
+
+        // Битмапы и таблица инодов группы (при flex_bg лежат в чужих группах)
+        used.add(base + blockBitmap * bs, bs);
+        used.add(base + inodeBitmap * bs, bs);
+        used.add(base + inodeTable * bs, itBlocks * bs);
+
+        if (csum && (flags & 0x2)) {
+            // BLOCK_UNINIT: битмап не инициализирован, в группе только копия суперблока и дескрипторов
+            if (hasSuperBackup(g, sparseSuper)) used.add(base + groupStart * bs, (1 + gdtBlocks + resGdt) * bs);
+            continue;
+        }
+        if (blockBitmap <= 0 || blockBitmap >= blocks || !rd.read(base + blockBitmap * bs, (groupBlocks + 7) / 8, bitmap)) {
+            p.note = QString("не прочитать битмап группы %1").arg(g);
+            return false;
+        }
+        addBitmap(u(bitmap), groupBlocks, base + groupStart * bs, bs, used);
+    }
+    return true;
+}
+
+// ---------- FAT ----------
+
+static bool scanFat(const SectorReader &rd, qint64 base, qint64 size, RangeList &used, UsedBlocks::Partition &p) {
+    QByteArray bootBuf;
+    if (size < 512 || !rd.read(base, 512, bootBuf)) return false;
+    const uchar *b = u(bootBuf);
+    if (b[0] != 0xEB && b[0] != 0xE9) return false;
+    if (le16(b + 510) != 0xAA55) return false;
+    const qint64 bps = le16(b + 11), spc = b[13], rsv = le16(b + 14), nfats = b[16];
+    if ((bps != 512 && bps != 1024 && bps != 2048 && bps != 4096) || spc == 0 || (spc & (spc - 1)) || rsv == 0 || nfats == 0) return false;
+    const qint64 rootEnt = le16(b + 17);
+    const qint64 fatSz = le16(b + 22) ? le16(b + 22) : le32(b + 36);
+    const qint64 tot = le16(b + 19) ? le16(b + 19) : le32(b + 32);
+    const qint64 rootSecs = (rootEnt * 32 + bps - 1) / bps;
+    const qint64 dataSec = rsv + nfats * fatSz + rootSecs;
+    if (fatSz == 0 || tot <= dataSec || tot * bps > size) return false;
+
+    const qint64 clusters = (tot - dataSec) / spc;
+    const qint64 clusterBytes = spc * bps;
+    if (clusters < 4085) { p.fs = "FAT12"; p.note = "FAT12 копируется целиком"; return false; }
+    const int width = clusters < 65525 ? 2 : 4;
+    p.fs = width == 2 ? "FAT16" : "FAT32";
+
+    // Загрузочная область, все копии FAT и корневой каталог FAT16
+    used.add(base, dataSec * bps);
+    const qint64 dataBase = base + dataSec * bps;
+    const qint64 perChunk = 1 << 20;
+    QByteArray fat;
+    for (qint64 c0=0; c0 < clusters + 2; c0 += perChunk) {
+        const qint64 n = std::min(perChunk, clusters + 2 - c0);
+        if (!rd.read(base + rsv * bps + c0 * width, n * width, fat)) { p.note = "не прочитать FAT"; return false; }
+        const uchar *e = u(fat);
+        for (qint64 i=0; i<n; ++i) {
+            const qint64 c = c0 + i;
+            if (c < 2) continue;
+            const quint32 v = width == 2 ? le16(e + i*2) : (le32(e + i*4) & 0x0FFFFFFF);
+            if (v != 0) used.add(dataBase + (c - 2) * clusterBytes, clusterBytes);
+        }
+    }
+    return true;
+}
+
+// ---------- NTFS ----------
+
+// Отрезок кластеров нерезидентного атрибута; lcn = -1 — разреженный
+struct NtfsRun {
+    qint64 lcn;
+    qint64 count;
+};
+
+static bool scanNtfs(const SectorReader &rd, qint64 base, qint64 size, RangeList &used, UsedBlocks::Partition &p) {
+    QByteArray bootBuf;
+    if (size < 512 || !rd.read(base, 512, bootBuf)) return false;
+    const uchar *b = u(bootBuf);
+    if (std::memcmp(b + 3, "NTFS    ", 8) != 0) return false;
+    p.fs = "NTFS";
+
+    const qint64 bps = le16(b + 11);
+    const int spcRaw = b[13];
+    const qint64 spc = spcRaw <= 0x80 ? spcRaw : (qint64(1) << (256 - spcRaw));
+    const qint64 cluster = bps * spc;
+    const qint64 totalSec = qint64(le64(b + 40));
+    const qint64 mftLcn = qint64(le64(b + 48));
+    const qint8 recRaw = qint8(b[64]);
+    const qint64 recSize = recRaw > 0 ? recRaw * cluster : (qint64(1) << -recRaw);
+    if (bps < 512 || cluster <= 0 || totalSec <= 0 || totalSec * bps > size || recSize < 512 || recSize > 65536) {
+        p.note = "некорректный загрузочный сектор";
+        return false;
+    }
+    const qint64 clusters = totalSec / spc;
+
+    // Запись MFT №6 — $Bitmap; первые записи MFT всегда лежат подряд
+    QByteArray rec;
+    if (!rd.read(base + mftLcn * cluster + 6 * recSize, recSize, rec)) { p.note = "не прочитать MFT"; return false; }
+    uchar *r = reinterpret_cast<uchar*>(rec.data());
+    if (std::memcmp(r, "FILE", 4) != 0) { p.note = "повреждена запись $Bitmap"; return false; }
+    const qint64 usaOff = le16(r + 4), usaCount = le16(r + 6);
+    if (usaOff + usaCount * 2 > recSize || (usaCount - 1) * 512 > recSize) { p.note = "повреждена запись $Bitmap"; return false; }
+    for (qint64 i=1; i<usaCount; ++i) {
+        uchar *tail = r + i * 512 - 2;
+        if (std::memcmp(tail, r + usaOff, 2) != 0) { p.note = "повреждена запись $Bitmap"; return false; }
+        std::memcpy(tail, r + usaOff + i * 2, 2);
+    }
+
+    // Атрибут $DATA (0x80), нерезидентный: список отрезков кластеров
+    QVector<NtfsRun> runs;
+    qint64 bitmapBytes = 0;
+    for (qint64 a = le16(r + 20); a + 16 <= recSize; ) {
+        const quint32 type = le32(r + a), len = le32(r + a + 4);
+        if (type == 0xFFFFFFFF || len < 16 || a + len > recSize) break;
+        if (type == 0x80 && r[a + 8] == 1) {
+            bitmapBytes = qint64(le64(r + a + 48));
+            qint64 pos = a + le16(r + a + 32), lcn = 0;
+            while (pos < a + len && r[pos] != 0) {
+                const int lenSize = r[pos] & 0x0F, offSize = r[pos] >> 4;
+                if (lenSize == 0 || lenSize > 8 || offSize > 8 || pos + 1 + lenSize + offSize > a + len) break;
+                qint64 count = 0, delta = 0;
+                for (int k=0; k<lenSize; ++k) count |= qint64(r[pos + 1 + k]) << (8*k);
+                for (int k=0; k<offSize; ++k) delta |= qint64(r[pos + 1 + lenSize + k]) << (8*k);
+                if (offSize > 0 && offSize < 8 && (r[pos + lenSize + offSize] & 0x80)) delta -= qint64(1) << (8*offSize);
+                if (offSize == 0) runs.push_back({-1, count});
+                else { lcn += delta; runs.push_back({lcn, count}); }
+                pos += 1 + lenSize + offSize;
+            }
+            break;
+        }
+        a += len;
+    }
+    if (runs.isEmpty() || bitmapBytes < (clusters + 7) / 8) { p.note = "не найден $Bitmap"; return false; }
+
+    QByteArray bitmap, part;
+    const qint64 need = (clusters + 7) / 8;
+    for (const auto &run : runs) {
+        for (qint64 done=0; done < run.count && bitmap.size() < need; ) {
+            const qint64 n = std::min<qint64>(run.count - done, std::max<qint64>(1, (4 << 20) / cluster));
+            const qint64 bytes = std::min(n * cluster, need - bitmap.size());
+            if (run.lcn < 0) bitmap.append(QByteArray(int(bytes), '\0'));
+            else if (!rd.read(base + (run.lcn + done) * cluster, bytes, part)) { p.note = "не прочитать $Bitmap"; return false; }
+            else bitmap.append(part);
+            done += n;
+        }
+    }
+    if (bitmap.size() < need) { p.note = "$Bitmap короче тома"; return false; }
+
+    addBitmap(u(bitmap), clusters, base, cluster, used);
+    // Резервная копия загрузочного сектора — сразу за последним сектором тома
+    used.add(base + totalSec * bps, std::min(bps, size - totalSec * bps));
+    return true;
+}
+
+// ---------- таблицы разделов ----------
+
+static bool parseGpt(const SectorReader &rd, qint64 size, qint64 sector, QVector<ByteRange> &parts) {
+    QByteArray hdr, ents;
+    if (!rd.read(sector, 92, hdr) || std::memcmp(hdr.constData(), "EFI PART", 8) != 0) return false;
+    const qint64 entriesLba = qint64(le64(u(hdr) + 72));
+    const qint64 n = le32(u(hdr) + 80), esz = le32(u(hdr) + 84);
+    if (esz < 128 || esz > 4096 || n <= 0 || n > 4096 || !rd.read(entriesLba * sector, n * esz, ents)) return false;
+    for (qint64 i=0; i<n; ++i) {
+        const uchar *e = u(ents) + i * esz;
+        static const uchar zero[16] = {};
+        if (std::memcmp(e, zero, 16) == 0) continue;
+        const qint64 first = qint64(le64(e + 32)), last = qint64(le64(e + 40));
+        if (first <= 0 || last < first) continue;
+        ByteRange r;
+        r.offset = first * sector;
+        r.length = std::min((last - first + 1) * sector, size - r.offset);
+        if (r.length > 0) parts.push_back(r);
+    }
+    return true;
+}
+
+static bool isExtended(uchar type) { return type == 0x05 || type == 0x0F || type == 0x85; }
+
+// LBA в записях — в логических секторах носителя: 512 или 4096 на дисках 4Kn и их образах
+static bool parseMbr(const SectorReader &rd, const QByteArray &mbr, qint64 size, qint64 sector, QVector<ByteRange> &parts) {
+    const uchar *m = u(mbr);
+    if (le16(m + 510) != 0xAA55) return false;
+    for (int i=0; i<4; ++i) {
+        const uchar *e = m + 446 + i*16;
+        if (e[0] != 0x00 && e[0] != 0x80) return false;
+    }
+    for (int i=0; i<4; ++i) {
+        const uchar *e = m + 446 + i*16;
+        const qint64 start = qint64(le32(e + 8)) * sector, len = qint64(le32(e + 12)) * sector;
+        if (e[4] == 0 || len == 0) continue;
+        if (start <= 0 || start >= size) return false;
+        if (!isExtended(e[4])) {
+            ByteRange r;
+            r.offset = start; r.length = std::min(len, size - start);
+            parts.push_back(r);
+            continue;
+        }
+        // Цепочка EBR: первая запись — логический раздел, вторая — следующий EBR относительно начала расширенного
+        qint64 ebr = start;
+        QByteArray sec;
+        for (int guard=0; guard < 128 && ebr > 0 && ebr < size; ++guard) {
+            if (!rd.read(ebr, 512, sec) || le16(u(sec) + 510) != 0xAA55) break;
+            const uchar *l = u(sec) + 446, *next = l + 16;
+            const qint64 lstart = ebr + qint64(le32(l + 8)) * sector, llen = qint64(le32(l + 12)) * sector;
+            if (l[4] != 0 && llen > 0 && lstart < size) {
+                ByteRange r;
+                r.offset = lstart; r.length = std::min(llen, size - lstart);
+                parts.push_back(r);
+            }
+            if (next[4] == 0 || le32(next + 8) == 0) break;
+            ebr = start + qint64(le32(next + 8)) * sector;
+        }
+    }
+    return true;
+}
+
+// Сектор 0 — загрузочный сектор ФС без таблицы разделов (FAT/NTFS на весь диск)?
+static bool isVolumeBootSector(const QByteArray &sec) {
+    const uchar *b = u(sec);
+    if (std::memcmp(b + 3, "NTFS    ", 8) == 0) return true;
+    if (b[0] != 0xEB && b[0] != 0xE9) return false;
+    const quint16 bps = le16(b + 11);
+    return (bps == 512 || bps == 1024 || bps == 2048 || bps == 4096) && b[13] != 0 && le16(b + 14) != 0 && b[16] != 0;
+}
+
+// Разделы по порядку смещений; без разметки — один на весь размер.
+// GPT сама показывает размер сектора (заголовок во втором секторе), для MBR берётся sector.
+static bool findPartitions(const SectorReader &rd, qint64 size, qint64 sector, QVector<ByteRange> &found, QString &scheme, QString &diag) {
+    QByteArray sec0;
+    if (!rd.read(0, 512, sec0)) { diag = "не прочитать первый сектор"; return false; }
+    found.clear();
+    const qint64 other = sector == 4096 ? 512 : 4096;
+    if (parseGpt(rd, size, sector, found) || parseGpt(rd, size, other, found)) scheme = "GPT";
+    else if (!isVolumeBootSector(sec0) && parseMbr(rd, sec0, size, sector, found) && !found.isEmpty()) scheme = "MBR";
+    else { found.clear(); scheme = "нет"; }
+    if (found.isEmpty()) {
+        ByteRange whole;
+        whole.length = size;
+        found.push_back(whole);
+    }
+    std::sort(found.begin(), found.end(), [](const ByteRange &a, const ByteRange &b) { return a.offset < b.offset; });
+    return true;
+}
+
+// ФС раздела по сигнатуре загрузочного сектора или суперблока, без разбора
+static QString probeFs(const SectorReader &rd, qint64 base, qint64 size) {
+    QByteArray sec, sb;
+    if (size < 512 || !rd.read(base, 512, sec)) return QString();
+    const char *b = sec.constData();
+    if (std::memcmp(b + 3, "NTFS    ", 8) == 0) return "NTFS";
+    if (std::memcmp(b + 3, "EXFAT   ", 8) == 0) return "exFAT";
+    if (std::memcmp(b + 82, "FAT32   ", 8) == 0) return "FAT32";
+    if (std::memcmp(b + 54, "FAT", 3) == 0) return "FAT";
+    if (size >= 2048 && rd.read(base + 1024, 1024, sb) && le16(u(sb) + 56) == 0xEF53) return "ext2/3/4";
+    return QString();
+}
+
+bool UsedBlocks::partitions(QFile &f, qint64 size, qint64 sector, QVector<Partition> &parts, QString &scheme, QString &diag) {
+    SectorReader rd(f.handle(), size);
+    QVector<ByteRange> found;
+    if (!findPartitions(rd, size, sector, found, scheme, diag)) return false;
+    parts.clear();
+    for (const ByteRange &r : found) {
+        Partition p;
+        p.offset = r.offset;
+        p.size = p.used = r.length;
+        p.fs = probeFs(rd, r.offset, r.length);
+        parts.push_back(p);
+    }
+    return true;
+}
+
+bool UsedBlocks::parseRange(const QString &text, ByteRange &r, QString &diag) {
+    auto number = [](QString t, qint64 &v) {
+        t = t.trimmed().toUpper();
+        qint64 mul = 1;
+        const QString units = "KMGT";
+        if (!t.isEmpty() && units.contains(t[t.size() - 1])) {
+            for (int i = 0; i <= units.indexOf(t[t.size() - 1]); ++i) mul *= 1024;
+            t.chop(1);
+        }
+        bool ok = false;
+        const qint64 n = t.toLongLong(&ok);
+        // С суффиксом произведение может не поместиться в qint64
+        if (!ok || n < 0 || n > std::numeric_limits<qint64>::max() / mul) return false;
+        v = n * mul;
+        return true;
+    };
+    const int colon = text.indexOf(':');
+    if (colon < 0 || !number(text.left(colon), r.offset) || !number(text.mid(colon + 1), r.length) || r.offset < 0 || r.length <= 0) {
+        diag = "ожидалось смещение:длина в байтах (суффиксы K, M, G, T): " + text;
+        return false;
+    }
+    return true;
+}
+
+bool UsedBlocks::scan(QFile &f, qint64 size, qint64 sector, QVector<ByteRange> &ranges, QVector<Partition> &parts, QString &scheme, QString &diag) {
+    SectorReader rd(f.handle(), size);
+    QVector<ByteRange> found;
+    if (!findPartitions(rd, size, sector, found, scheme, diag)) return false;
+
+    RangeList all;
+    qint64 covered = 0;
+    parts.clear();
+    for (const ByteRange &r : found) {
+        // Всё между разделами (загрузчик, заголовки GPT, резервная GPT) копируется как есть
+        if (r.offset > covered) all.add(covered, r.offset - covered);
+        covered = std::max(covered, r.offset + r.length);
+
+        Partition p;
+        p.offset = r.offset;
+        p.size = r.length;
+        RangeList used;
+        bool ok = scanExt(rd, r.offset, r.length, used, p);
+        if (!ok && p.fs.isEmpty()) ok = scanFat(rd, r.offset, r.length, used, p);
+        if (!ok && p.fs.isEmpty()) ok = scanNtfs(rd, r.offset, r.length, used, p);
+        if (!ok) {
+            if (p.note.isEmpty()) p.note = "ФС не распознана";
+            used = RangeList();
+            used.add(r.offset, r.length);
+        }
+        p.used = used.total();
+        all.append(used);
+        parts.push_back(p);
+    }
+    if (size > covered) all.add(covered, size - covered);
+
+    ranges = all.normalized();
+    return true;
+}
+
+bool UsedBlocks::intersects(const QVector<ByteRange> &ranges, qint64 off, qint64 len) {
+    // Первый диапазон, который заканчивается после off
+    auto it = std::upper_bound(ranges.begin(), ranges.end(), off,
+                               [](qint64 v, const ByteRange &r) { return v < r.offset + r.length; });
+    return it != ranges.end() && it->offset < off + len;
+}
+
+qint64 UsedBlocks::totalBytes(const QVector<ByteRange> &ranges) {
+    qint64 t=0;
+    for (const ByteRange &r : ranges) t += r.length;
+    return t;
+}
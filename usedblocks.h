@@ -0,0 +1,31 @@
+#pragma once
+#include "diskio.h"
+
+// Карта занятого места на диске или в файле образа: таблица разделов (MBR/GPT)
+// и битмапы занятости ext2/3/4, FAT16/FAT32 и NTFS.
+// Всё, что не удалось разобрать (неизвестные ФС, FAT12, место вне разделов), считается занятым целиком.
+class UsedBlocks {
+public:
+    struct Partition {
+        qint64 offset = 0;
+        qint64 size = 0;
+        QString fs;        // "ext4", "FAT32", "NTFS"... или пусто, если ФС не распознана
+        qint64 used = 0;   // сколько байт раздела будет прочитано
+        QString note;      // почему раздел копируется целиком
+    };
+
+    // Разобрать f (устройство или образ) размером size. sector — логический сектор носителя (512 или 4096):
+    // в нём MBR считает LBA разделов, GPT проверяется при обоих размерах. ranges — отсортированные непересекающиеся
+    // диапазоны для чтения: занятые блоки, метаданные ФС и всё вне разделов.
+    // scheme — "GPT", "MBR" или "нет" (ФС на весь диск или разметка не распознана).
+    static bool scan(QFile &f, qint64 size, qint64 sector, QVector<ByteRange> &ranges, QVector<Partition> &parts, QString &scheme, QString &diag);
+
+    // Только таблица разделов, без битмапов ФС: читается несколько секторов. fs — по сигнатуре, used = size.
+    static bool partitions(QFile &f, qint64 size, qint64 sector, QVector<Partition> &parts, QString &scheme, QString &diag);
+    // "смещение:длина" в байтах, суффиксы K, M, G, T (степени 1024)
+    static bool parseRange(const QString &text, ByteRange &r, QString &diag);
+
+    // Пересекается ли [off, off+len) хоть с одним диапазоном
+    static bool intersects(const QVector<ByteRange> &ranges, qint64 off, qint64 len);
+    static qint64 totalBytes(const QVector<ByteRange> &ranges);
+};
@@ -0,0 +1,122 @@
+#include "xxh64.h"
+#include <QtEndian>
+#include <cstring>
+
+static const quint64 P1 = 11400714785074694791ULL;
+static const quint64 P2 = 14029467366897019727ULL;
+static const quint64 P3 = 1609587929392839161ULL;
+static const quint64 P4 = 9650029242287828579ULL;
+static const quint64 P5 = 2870177450012600261ULL;
+
+static inline quint64 rotl(quint64 x, int r) { return (x << r) | (x >> (64 - r)); }
+
+static inline quint64 read64(const uchar *p) { return qFromLittleEndian<quint64>(p); }
+static inline quint32 read32(const uchar *p) { return qFromLittleEndian<quint32>(p); }
+
+static inline quint64 round(quint64 acc, quint64 input) {
+    acc += input * P2;
+    acc = rotl(acc, 31);
+    return acc * P1;
+}
+
+static inline quint64 mergeRound(quint64 acc, quint64 val) {
+    acc ^= round(0, val);
+    return acc * P1 + P4;
+}
+
+void Xxh64::reset(quint64 seed) {
+    m_seed = seed;
+    m_v[0] = seed + P1 + P2;
+    m_v[1] = seed + P2;
+    m_v[2] = seed;
+    m_v[3] = seed - P1;
+    m_total = 0;
+    m_memSize = 0;
+}
+
+void Xxh64::update(const void *data, qint64 len) {
+    const uchar *p = static_cast<const uchar*>(data);
+    const uchar *end = p + len;
+    m_total += quint64(len);
+
+    if (m_memSize + len < 32) {
+        std::memcpy(m_mem + m_memSize, p, size_t(len));
+        m_memSize += int(len);
+        return;
+    }
+    if (m_memSize > 0) {
+        const int fill = 32 - m_memSize;
+        std::memcpy(m_mem + m_memSize, p, size_t(fill));
+        for (int i=0; i<4; ++i) m_v[i] = round(m_v[i], read64(m_mem + i*8));
+        p += fill;
+        m_memSize = 0;
+    }
+    // Основной цикл: четыре независимых аккумулятора по 8 байт
+    quint64 v1 = m_v[0], v2 = m_v[1], v3 = m_v[2], v4 = m_v[3];
+    while (end - p >= 32) {
+        v1 = round(v1, read64(p));
+        v2 = round(v2, read64(p + 8));
+        v3 = round(v3, read64(p + 16));
+        v4 = round(v4, read64(p + 24));
+        p += 32;
+    }
+    m_v[0] = v1; m_v[1] = v2; m_v[2] = v3; m_v[3] = v4;
+    if (p < end) {
+        m_memSize = int(end - p);
+        std::memcpy(m_mem, p, size_t(m_memSize));
+    }
+}
+
+quint64 Xxh64::digest() const {
+    quint64 h;
+    if (m_total >= 32) {
+        h = rotl(m_v[0], 1) + rotl(m_v[1], 7) + rotl(m_v[2], 12) + rotl(m_v[3], 18);
+        for (int i=0; i<4; ++i) h = mergeRound(h, m_v[i]);
+    } else {
+        h = m_seed + P5;
+    }
+    h += m_total;
+
+    const uchar *p = m_mem, *end = m_mem + m_memSize;
+    while (end - p >= 8) {
+        h ^= round(0, read64(p));
+        h = rotl(h, 27) * P1 + P4;
+        p += 8;
+    }
+    if (end - p >= 4) {
+        h ^= quint64(read32(p)) * P1;
+        h = rotl(h, 23) * P2 + P3;
+        p += 4;
+    }
+    while (p < end) {
+        h ^= (*p) * P5;
+        h = rotl(h, 11) * P1;
+        ++p;
+    }
+    h ^= h >> 33;
+    h *= P2;
+    h ^= h >> 29;
+    h *= P3;
+    h ^= h >> 32;
+    return h;
+}
+
+quint64 Xxh64::hash(const void *data, qint64 len, quint64 seed) {
+    Xxh64 h(seed);
+    h.update(data, len);
+    return h.digest();
+}
+
+bool Xxh64::selfTest() {
+    if (hash("", 0) != 0xEF46DB3751D8E999ULL) return false;
+    // 111 = три полосы по 32 байта + 8 + 4 + 3: основной цикл и все ветви хвоста
+    uchar data[111];
+    for (int i=0; i<111; ++i) data[i] = uchar(i*7 + 1);
+    if (hash(data, 111) != 0xE1D107AEE83D79E3ULL) return false;
+    // Кусками, не кратными полосе: перенос через m_mem
+    Xxh64 h(0x9E3779B97F4A7C15ULL);
+    h.update(data, 5);
+    h.update(data + 5, 40);
+    h.update(data + 45, 66);
+    return h.digest() == 0x852C1EFD4A4081F5ULL;
+}
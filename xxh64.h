@@ -0,0 +1,26 @@
+#pragma once
+#include <QtGlobal>
+
+// XXH64 — быстрый некриптографический хэш (совместим с эталонной реализацией xxHash).
+// Годится для сравнения блоков между прогонами, но не для защиты от подделки.
+class Xxh64 {
+public:
+    explicit Xxh64(quint64 seed = 0) { reset(seed); }
+
+    void reset(quint64 seed = 0);
+    void update(const void *data, qint64 len);
+    quint64 digest() const;
+
+    static quint64 hash(const void *data, qint64 len, quint64 seed = 0);
+
+    // Сверка с эталонными значениями xxHash (пустой ввод, 111 байт целиком и кусками, с seed и без).
+    // От совпадения зависят манифесты, дельты и хранилище чанков прошлых прогонов.
+    static bool selfTest();
+
+private:
+    quint64 m_v[4];
+    quint64 m_seed = 0;
+    quint64 m_total = 0;
+    uchar m_mem[32];
+    int m_memSize = 0;
+};
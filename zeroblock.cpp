@@ -0,0 +1,206 @@
+#include "zeroblock.h"
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#  define RAWWRITER_X86
+#  include <immintrin.h>
+#endif
+
+#ifdef Q_OS_WIN
+#  include <windows.h>
+#  include <io.h>
+#  include <winioctl.h>
+#else
+#  include <unistd.h>
+#  include <fcntl.h>
+#  include <sys/stat.h>
+#endif
+
+#ifdef Q_OS_LINUX
+#  include <sys/ioctl.h>
+#  include <linux/fs.h>
+#  include <linux/falloc.h>
+#endif
+
+static bool allZeroScalar(const uchar *p, qint64 n) {
+    qint64 i=0;
+    for (; i + 8 <= n; i += 8) {
+        quint64 w;
+        std::memcpy(&w, p+i, 8);
+        if (w) return false;
+    }
+    for (; i < n; ++i) if (p[i]) return false;
+    return true;
+}
+
+static bool equalScalar(const uchar *a, const uchar *b, qint64 n) {
+    return std::memcmp(a, b, size_t(n)) == 0;
+}
+
+#ifdef RAWWRITER_X86
+static bool equalSse2(const uchar *a, const uchar *b, qint64 n) {
+    qint64 i=0;
+    for (; i + 64 <= n; i += 64) {
+        __m128i x0 = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a+i)),    _mm_loadu_si128(reinterpret_cast<const __m128i*>(b+i)));
+        __m128i x1 = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a+i+16)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(b+i+16)));
+        __m128i x2 = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a+i+32)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(b+i+32)));
+        __m128i x3 = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a+i+48)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(b+i+48)));
+        __m128i o = _mm_or_si128(_mm_or_si128(x0, x1), _mm_or_si128(x2, x3));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(o, _mm_setzero_si128())) != 0xFFFF) return false;
+    }
+    return equalScalar(a+i, b+i, n-i);
+}
+
+#  if defined(__GNUC__)
+__attribute__((target("avx2")))
+static bool equalAvx2(const uchar *a, const uchar *b, qint64 n) {
+    qint64 i=0;
+    for (; i + 128 <= n; i += 128) {
+        __m256i x0 = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a+i)),    _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b+i)));
+        __m256i x1 = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a+i+32)), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b+i+32)));
+        __m256i x2 = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a+i+64)), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b+i+64)));
+        __m256i x3 = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a+i+96)), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b+i+96)));
+        __m256i o = _mm256_or_si256(_mm256_or_si256(x0, x1), _mm256_or_si256(x2, x3));
+        if (!_mm256_testz_si256(o, o)) return false;
+    }
+    return equalSse2(a+i, b+i, n-i);
+}
+#  endif
+
+static bool allZeroSse2(const uchar *p, qint64 n) {
+    qint64 i=0;
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 64 <= n; i += 64) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p+i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p+i+16));
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p+i+32));
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p+i+48));
+        __m128i o = _mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(o, zero)) != 0xFFFF) return false;
+    }
+    return allZeroScalar(p+i, n-i);
+}
+
+#  if defined(__GNUC__)
+__attribute__((target("avx2")))
+static bool allZeroAvx2(const uchar *p, qint64 n) {
+    qint64 i=0;
+    for (; i + 128 <= n; i += 128) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p+i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p+i+32));
+        __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p+i+64));
+        __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p+i+96));
+        __m256i o = _mm256_or_si256(_mm256_or_si256(a, b), _mm256_or_si256(c, d));
+        if (!_mm256_testz_si256(o, o)) return false;
+    }
+    return allZeroSse2(p+i, n-i);
+}
+#  endif
+#endif
+
+typedef bool (*AllZeroFn)(const uchar *, qint64);
+
+static AllZeroFn pickAllZero(const char **name) {
+#ifdef RAWWRITER_X86
+#  if defined(__GNUC__)
+    if (__builtin_cpu_supports("avx2")) { *name = "AVX2"; return allZeroAvx2; }
+#  endif
+    *name = "SSE2";
+    return allZeroSse2;
+#else
+    *name = "scalar";
+    return allZeroScalar;
+#endif
+}
+
+typedef bool (*EqualFn)(const uchar *, const uchar *, qint64);
+
+// Набор инструкций тот же, что у проверки нулей
+static EqualFn pickEqual() {
+#ifdef RAWWRITER_X86
+#  if defined(__GNUC__)
+    if (__builtin_cpu_supports("avx2")) return equalAvx2;
+#  endif
+    return equalSse2;
+#else
+    return equalScalar;
+#endif
+}
+
+static const char *g_simdName = "";
+static const AllZeroFn g_allZero = pickAllZero(&g_simdName);
+static const EqualFn g_equal = pickEqual();
+
+bool ZeroBlock::isAllZero(const char *p, qint64 n) {
+    return g_allZero(reinterpret_cast<const uchar*>(p), n);
+}
+
+bool ZeroBlock::isEqual(const char *a, const char *b, qint64 n) {
+    return g_equal(reinterpret_cast<const uchar*>(a), reinterpret_cast<const uchar*>(b), n);
+}
+
+const char *ZeroBlock::simdName() { return g_simdName; }
+
+void SparseTarget::open(int fd, CopyOptions::ZeroBlocks policy) {
+    m_fd = fd;
+    m_policy = policy;
+#ifdef Q_OS_WIN
+    // Диск не даст выставить sparse-атрибут — значит, это устройство
+    HANDLE h = (HANDLE)_get_osfhandle(fd);
+    DWORD ret = 0;
+    m_file = policy != CopyOptions::ZeroBlocks::Write &&
+             DeviceIoControl(h, FSCTL_SET_SPARSE, nullptr, 0, nullptr, 0, &ret, nullptr);
+    LARGE_INTEGER sz{};
+    if (m_file && GetFileSizeEx(h, &sz)) m_initialSize = sz.QuadPart;
+#else
+    struct stat st{};
+    if (::fstat(fd, &st) == 0) {
+        m_file = S_ISREG(st.st_mode);
+        m_initialSize = st.st_size;
+    }
+#endif
+}
+
+bool SparseTarget::zeroRange(qint64 off, qint64 len) {
+    if (!enabled()) return false;
+    if (m_file) {
+        // За старым концом файла достаточно ничего не писать — получится дырка
+        if (off >= m_initialSize) return true;
+#if defined(Q_OS_LINUX)
+        return ::fallocate(m_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, off, len) == 0;
+#elif defined(Q_OS_WIN)
+        FILE_ZERO_DATA_INFORMATION z{};
+        z.FileOffset.QuadPart = off;
+        z.BeyondFinalZero.QuadPart = off + len;
+        DWORD ret = 0;
+        return DeviceIoControl((HANDLE)_get_osfhandle(m_fd), FSCTL_SET_ZERO_DATA, &z, sizeof(z), nullptr, 0, &ret, nullptr);
+#else
+        return false;
+#endif
+    }
+
+    if (m_policy == CopyOptions::ZeroBlocks::Skip) return true;
+#ifdef Q_OS_LINUX
+    if (m_policy == CopyOptions::ZeroBlocks::Discard) {
+        // Сам BLKDISCARD не обещает нулей при чтении (SSD, тонкие LUN, SD-карты отдают старое).
+        // PUNCH_HOLE на блочном устройстве освобождает место, только если устройство гарантирует нули, иначе EOPNOTSUPP.
+        if (::fallocate(m_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, off, len) == 0) return true;
+        // Нули не гарантированы — дальше обнуляем устройством
+        m_policy = CopyOptions::ZeroBlocks::ZeroOut;
+        m_discardFallback = true;
+    }
+    quint64 range[2] = { quint64(off), quint64(len) };
+    if (::ioctl(m_fd, BLKZEROOUT, range) == 0) return true;
+    // Устройство не умеет — дальше пишем нули как обычно
+    m_policy = CopyOptions::ZeroBlocks::Write;
+    return false;
+#else
+    return false;
+#endif
+}
+
+bool SparseTarget::finish(QFile &dst, qint64 end) {
+    if (!enabled() || !m_file) return true;
+    if (dst.size() >= end) return true;
+    return dst.resize(end);
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include "diskio.h"
+
+// Поиск блоков из одних нулей и их обработка на стороне записи без передачи данных
+class ZeroBlock {
+public:
+    // true, если все n байт нулевые. SSE2/AVX2 на x86 (AVX2 выбирается во время выполнения).
+    static bool isAllZero(const char *p, qint64 n);
+    // true, если n байт a и b совпадают. Те же SSE2/AVX2, что у isAllZero.
+    static bool isEqual(const char *a, const char *b, qint64 n);
+    static const char *simdName();
+};
+
+// Приёмник нулевых диапазонов: дырки в файле (fallocate PUNCH_HOLE / sparse NTFS)
+// или BLKZEROOUT / освобождение места (discard с гарантией нулей) на устройстве, в зависимости от политики
+class SparseTarget {
+public:
+    void open(int fd, CopyOptions::ZeroBlocks policy);
+
+    bool enabled() const { return m_policy != CopyOptions::ZeroBlocks::Write; }
+    bool isFile() const { return m_file; }
+
+    // Обнулить [off, off+len) без записи данных. false — нужно записать нули обычным способом.
+    bool zeroRange(qint64 off, qint64 len);
+
+    // Discard: устройство не гарантирует нули после освобождения, нулевые блоки обнулялись BLKZEROOUT
+    bool discardFellBack() const { return m_discardFallback; }
+
+    // Если файл закончился дыркой — довести его размер до end
+    bool finish(QFile &dst, qint64 end);
+
+private:
+    int m_fd = -1;
+    CopyOptions::ZeroBlocks m_policy = CopyOptions::ZeroBlocks::Write;
+    bool m_file = false;
+    bool m_discardFallback = false;
+    qint64 m_initialSize = 0;
+};